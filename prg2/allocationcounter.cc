@@ -0,0 +1,37 @@
+// Allocationcounter.cc
+
+#include "allocationcounter.hh"
+
+#ifdef COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+
+std::atomic<std::uint64_t> allocations{ 0 };
+
+void* counted_allocate(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    // malloc(0) may return null, operator new may not
+    if (void* memory = std::malloc(size > 0 ? size : 1)) { return memory; }
+    throw std::bad_alloc();
+}
+
+}
+
+std::uint64_t allocation_count()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// The nothrow versions of the standard library call these, the over-aligned ones aren't counted
+void* operator new(std::size_t size) { return counted_allocate(size); }
+void* operator new[](std::size_t size) { return counted_allocate(size); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+#endif
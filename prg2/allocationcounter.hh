@@ -0,0 +1,17 @@
+// Allocationcounter.hh
+//
+// Counts the heap allocations of the whole program, so that perftest can show how many
+// allocations each command makes. Only compiled in when COUNT_ALLOCATIONS is defined,
+// because counting replaces the global operator new.
+
+#ifndef ALLOCATIONCOUNTER_HH
+#define ALLOCATIONCOUNTER_HH
+
+#ifdef COUNT_ALLOCATIONS
+#include <cstdint>
+
+// Number of times operator new or new[] has been called since the program started, by all threads
+std::uint64_t allocation_count();
+#endif
+
+#endif // ALLOCATIONCOUNTER_HH
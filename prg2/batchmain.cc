@@ -0,0 +1,118 @@
+// Batchmain.cc
+//
+// Main program of the headless batch engine (prg2-headless.pro): runs commands
+// from a file or stdin without Qt or any GUI initialization
+
+#include "mainprogram.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    void usage(std::string const& program)
+    {
+        std::cerr << "Usage: " << program << " [--input <command file>] [--output <output file>]"
+                  << " [--perftest \"<perftest parameters>\"] [--benchmark]" << std::endl
+                  << "  --input      read commands from the file instead of stdin" << std::endl
+                  << "  --output     write output to the file instead of stdout" << std::endl
+                  << "  --perftest   run perftest with the parameters after the commands, e.g. \"all 10 500 1000;10000 trials=3\"" << std::endl
+                  << "  --benchmark  print startup and run times to stderr" << std::endl;
+    }
+
+    double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    auto start_time = std::chrono::steady_clock::now();
+
+    std::vector<std::string> args(argv, argv+argc);
+    std::string program = args.empty() ? "prg2-headless" : args[0];
+
+    std::string input_filename;
+    std::string output_filename;
+    std::string perftest_params;
+    bool benchmark = false;
+
+    for (std::size_t i = 1; i < args.size(); ++i)
+    {
+        auto const& arg = args[i];
+        bool has_value = (i+1 < args.size());
+        if (arg == "--input" && has_value) { input_filename = args[++i]; }
+        else if (arg == "--output" && has_value) { output_filename = args[++i]; }
+        else if (arg == "--perftest" && has_value) { perftest_params = args[++i]; }
+        else if (arg == "--benchmark") { benchmark = true; }
+        else if (arg == "--help")
+        {
+            usage(program);
+            return EXIT_SUCCESS;
+        }
+        else
+        {
+            usage(program);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::ofstream output_file;
+    if (!output_filename.empty())
+    {
+        output_file.open(output_filename);
+        if (!output_file)
+        {
+            std::cerr << "Cannot open file '" << output_filename << "'!" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::ostream& output = output_filename.empty() ? std::cout : output_file;
+
+    // No need to keep C stdio and iostreams in sync, there's no GUI or C output
+    std::ios::sync_with_stdio(false);
+
+    MainProgram mainprg;
+    auto startup_time = seconds_since(start_time);
+
+    auto run_start_time = std::chrono::steady_clock::now();
+    if (!input_filename.empty())
+    {
+        MappedFile input(input_filename);
+        if (!input.ok())
+        {
+            std::cerr << "Cannot open file '" << input_filename << "'!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        mainprg.command_parser(input.contents(), output, MainProgram::PromptStyle::NORMAL);
+    }
+    else if (perftest_params.empty())
+    {
+        mainprg.command_parser(std::cin, output, MainProgram::PromptStyle::NO_ECHO);
+    }
+
+    if (!perftest_params.empty())
+    {
+        mainprg.command_parse_line("perftest " + perftest_params, output);
+    }
+    output.flush();
+    auto run_time = seconds_since(run_start_time);
+
+    if (benchmark)
+    {
+        std::cerr << "Startup time: " << startup_time << " sec" << std::endl
+                  << "Run time: " << run_time << " sec" << std::endl
+                  << "Total time: " << seconds_since(start_time) << " sec" << std::endl;
+    }
+
+    if (mainprg.test_status() == MainProgram::TestStatus::DIFFS_FOUND)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+// Concurrentdatastructures.cc
+
+#include "concurrentdatastructures.hh"
+
+std::shared_lock<std::shared_mutex> ConcurrentDatastructures::lock_shared() const
+{
+    // Passing through the turnstile blocks new readers while a writer is waiting
+    { std::lock_guard turnstile(turnstile_); }
+    return std::shared_lock(mutex_);
+}
+
+std::unique_lock<std::shared_mutex> ConcurrentDatastructures::lock_exclusive()
+{
+    std::lock_guard turnstile(turnstile_);
+    return std::unique_lock(mutex_);
+}
+
+unsigned int ConcurrentDatastructures::town_count() const
+{
+    auto lock = lock_shared();
+    return ds_.town_count();
+}
+
+Name ConcurrentDatastructures::get_town_name(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.get_town_name(id);
+}
+
+Coord ConcurrentDatastructures::get_town_coordinates(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.get_town_coordinates(id);
+}
+
+int ConcurrentDatastructures::get_town_tax(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.get_town_tax(id);
+}
+
+std::vector<TownID> ConcurrentDatastructures::all_towns() const
+{
+    auto lock = lock_shared();
+    return ds_.all_towns();
+}
+
+std::vector<TownID> ConcurrentDatastructures::find_towns(Name const& name) const
+{
+    auto lock = lock_shared();
+    return ds_.find_towns(name);
+}
+
+std::vector<TownID> ConcurrentDatastructures::towns_alphabetically() const
+{
+    auto lock = lock_shared();
+    return ds_.towns_alphabetically();
+}
+
+std::vector<TownID> ConcurrentDatastructures::towns_distance_increasing() const
+{
+    auto lock = lock_shared();
+    return ds_.towns_distance_increasing();
+}
+
+TownID ConcurrentDatastructures::min_distance() const
+{
+    auto lock = lock_shared();
+    return ds_.min_distance();
+}
+
+TownID ConcurrentDatastructures::max_distance() const
+{
+    auto lock = lock_shared();
+    return ds_.max_distance();
+}
+
+std::vector<TownID> ConcurrentDatastructures::get_town_vassals(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.get_town_vassals(id);
+}
+
+std::vector<TownID> ConcurrentDatastructures::taxer_path(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.taxer_path(id);
+}
+
+std::vector<TownID> ConcurrentDatastructures::towns_nearest(Coord coord) const
+{
+    auto lock = lock_shared();
+    return ds_.towns_nearest(coord);
+}
+
+std::vector<TownID> ConcurrentDatastructures::longest_vassal_path(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.longest_vassal_path(id);
+}
+
+int ConcurrentDatastructures::total_net_tax(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.total_net_tax(id);
+}
+
+std::vector<std::pair<TownID, TownID>> ConcurrentDatastructures::all_roads() const
+{
+    auto lock = lock_shared();
+    return ds_.all_roads();
+}
+
+std::vector<TownID> ConcurrentDatastructures::get_roads_from(TownID const& id) const
+{
+    auto lock = lock_shared();
+    return ds_.get_roads_from(id);
+}
+
+std::vector<TownID> ConcurrentDatastructures::any_route(TownID const& fromid, TownID const& toid) const
+{
+    auto lock = lock_shared();
+    return ds_.any_route(fromid, toid);
+}
+
+std::vector<TownID> ConcurrentDatastructures::least_towns_route(TownID const& fromid, TownID const& toid) const
+{
+    auto lock = lock_shared();
+    return ds_.least_towns_route(fromid, toid);
+}
+
+std::vector<TownID> ConcurrentDatastructures::road_cycle_route(TownID const& startid) const
+{
+    auto lock = lock_shared();
+    return ds_.road_cycle_route(startid);
+}
+
+std::vector<TownID> ConcurrentDatastructures::shortest_route(TownID const& fromid, TownID const& toid) const
+{
+    auto lock = lock_shared();
+    return ds_.shortest_route(fromid, toid);
+}
+
+void ConcurrentDatastructures::clear_all()
+{
+    auto lock = lock_exclusive();
+    ds_.clear_all();
+}
+
+bool ConcurrentDatastructures::add_town(TownID const& id, Name const& name, Coord coord, int tax)
+{
+    auto lock = lock_exclusive();
+    return ds_.add_town(id, name, coord, tax);
+}
+
+bool ConcurrentDatastructures::change_town_name(TownID const& id, Name const& newname)
+{
+    auto lock = lock_exclusive();
+    return ds_.change_town_name(id, newname);
+}
+
+bool ConcurrentDatastructures::add_vassalship(TownID const& vassalid, TownID const& masterid)
+{
+    auto lock = lock_exclusive();
+    return ds_.add_vassalship(vassalid, masterid);
+}
+
+bool ConcurrentDatastructures::remove_town(TownID const& id)
+{
+    auto lock = lock_exclusive();
+    return ds_.remove_town(id);
+}
+
+void ConcurrentDatastructures::clear_roads()
+{
+    auto lock = lock_exclusive();
+    ds_.clear_roads();
+}
+
+bool ConcurrentDatastructures::add_road(TownID const& town1_id, TownID const& town2_id)
+{
+    auto lock = lock_exclusive();
+    return ds_.add_road(town1_id, town2_id);
+}
+
+bool ConcurrentDatastructures::remove_road(TownID const& town1_id, TownID const& town2_id)
+{
+    auto lock = lock_exclusive();
+    return ds_.remove_road(town1_id, town2_id);
+}
+
+Distance ConcurrentDatastructures::trim_road_network()
+{
+    auto lock = lock_exclusive();
+    return ds_.trim_road_network();
+}
+
+unsigned int ConcurrentDatastructures::add_towns(std::vector<TownSpec> const& towns)
+{
+    auto lock = lock_exclusive();
+    return ds_.add_towns(towns);
+}
+
+unsigned int ConcurrentDatastructures::add_vassalships(std::vector<std::pair<TownID, TownID>> const& vassalships)
+{
+    auto lock = lock_exclusive();
+    return ds_.add_vassalships(vassalships);
+}
+
+unsigned int ConcurrentDatastructures::add_roads(std::vector<std::pair<TownID, TownID>> const& roads)
+{
+    auto lock = lock_exclusive();
+    return ds_.add_roads(roads);
+}
@@ -0,0 +1,86 @@
+// Concurrentdatastructures.hh
+//
+// Datastructures behind a reader/writer lock: any number of threads may
+// query at the same time, while an edit waits for exclusive access
+
+#ifndef CONCURRENTDATASTRUCTURES_HH
+#define CONCURRENTDATASTRUCTURES_HH
+
+#include "datastructures.hh"
+
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+
+class ConcurrentDatastructures
+{
+public:
+    // The performance of each operation is the same as in Datastructures,
+    // plus waiting for the lock. Queries take a shared lock and edits an exclusive one.
+
+    // Queries
+    unsigned int town_count() const;
+    Name get_town_name(TownID const& id) const;
+    Coord get_town_coordinates(TownID const& id) const;
+    int get_town_tax(TownID const& id) const;
+    std::vector<TownID> all_towns() const;
+    std::vector<TownID> find_towns(Name const& name) const;
+    std::vector<TownID> towns_alphabetically() const;
+    std::vector<TownID> towns_distance_increasing() const;
+    TownID min_distance() const;
+    TownID max_distance() const;
+    std::vector<TownID> get_town_vassals(TownID const& id) const;
+    std::vector<TownID> taxer_path(TownID const& id) const;
+    std::vector<TownID> towns_nearest(Coord coord) const;
+    std::vector<TownID> longest_vassal_path(TownID const& id) const;
+    int total_net_tax(TownID const& id) const;
+    std::vector<std::pair<TownID, TownID>> all_roads() const;
+    std::vector<TownID> get_roads_from(TownID const& id) const;
+    std::vector<TownID> any_route(TownID const& fromid, TownID const& toid) const;
+    std::vector<TownID> least_towns_route(TownID const& fromid, TownID const& toid) const;
+    std::vector<TownID> road_cycle_route(TownID const& startid) const;
+    std::vector<TownID> shortest_route(TownID const& fromid, TownID const& toid) const;
+
+    // Edits
+    void clear_all();
+    bool add_town(TownID const& id, Name const& name, Coord coord, int tax);
+    bool change_town_name(TownID const& id, Name const& newname);
+    bool add_vassalship(TownID const& vassalid, TownID const& masterid);
+    bool remove_town(TownID const& id);
+    void clear_roads();
+    bool add_road(TownID const& town1_id, TownID const& town2_id);
+    bool remove_road(TownID const& town1_id, TownID const& town2_id);
+    Distance trim_road_network();
+    unsigned int add_towns(std::vector<TownSpec> const& towns);
+    unsigned int add_vassalships(std::vector<std::pair<TownID, TownID>> const& vassalships);
+    unsigned int add_roads(std::vector<std::pair<TownID, TownID>> const& roads);
+
+    // Runs func(Datastructures const&) under a single shared lock,
+    // so that several queries see the same state
+    template <typename Func>
+    decltype(auto) read(Func&& func) const
+    {
+        auto lock = lock_shared();
+        return std::forward<Func>(func)(std::as_const(ds_));
+    }
+
+    // Runs func(Datastructures&) under a single exclusive lock
+    template <typename Func>
+    decltype(auto) write(Func&& func)
+    {
+        auto lock = lock_exclusive();
+        return std::forward<Func>(func)(ds_);
+    }
+
+private:
+    Datastructures ds_;
+    mutable std::shared_mutex mutex_;
+
+    // std::shared_mutex may let a steady stream of readers starve the writers,
+    // so a waiting writer holds the turnstile to keep new readers out until it gets its turn
+    mutable std::mutex turnstile_;
+    std::shared_lock<std::shared_mutex> lock_shared() const;
+    std::unique_lock<std::shared_mutex> lock_exclusive();
+};
+
+#endif // CONCURRENTDATASTRUCTURES_HH
@@ -5,12 +5,93 @@
  
 
 #include "datastructures.hh"
+#include "sorting.hh"
+#include "distancekernel.hh"
+#include "mappedrealm.hh"
+#include "realmfile.hh"
 
 #include <random>
 #include <cmath>
+#include <charconv>
 
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
+namespace
+{
+//a page cursor is the sort key of the last element of its page: each field as its length, ':' and
+//its characters, all written in hex so that the cursor is a single word that can be passed around as is
+std::string make_cursor(std::initializer_list<std::string_view> fields)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string cursor{};
+    auto append = [&cursor](std::string_view bytes)
+    {
+        for (const auto byte : bytes)
+        {
+            cursor.push_back(digits[static_cast<unsigned char>(byte) >> 4]);
+            cursor.push_back(digits[static_cast<unsigned char>(byte) & 0xf]);
+        }
+    };
+    for (const auto field : fields)
+    {
+        append(std::to_string(field.size()) + ":");
+        append(field);
+    }
+    return cursor;
+}
+
+//false if the cursor isn't one made by make_cursor() with field_count fields
+bool read_cursor(std::string const& cursor, std::size_t field_count, std::vector<std::string>& fields)
+{
+    if (cursor.size() % 2 != 0)
+        return false;
+
+    std::string bytes{};
+    bytes.reserve(cursor.size() / 2);
+    for (std::size_t i = 0; i < cursor.size(); i += 2)
+    {
+        unsigned int byte{};
+        const auto [end, error] = std::from_chars(cursor.data() + i, cursor.data() + i + 2, byte, 16);
+        if (error != std::errc{} || end != cursor.data() + i + 2)
+            return false;
+        bytes.push_back(static_cast<char>(byte));
+    }
+
+    fields.clear();
+    std::size_t position = 0;
+    while (position < bytes.size())
+    {
+        std::size_t length{};
+        const auto [end, error] = std::from_chars(bytes.data() + position, bytes.data() + bytes.size(), length);
+        if (error != std::errc{} || end == bytes.data() + bytes.size() || *end != ':')
+            return false;
+        position = static_cast<std::size_t>(end - bytes.data()) + 1;
+        if (length > bytes.size() - position)
+            return false;
+        fields.push_back(bytes.substr(position, length));
+        position += length;
+    }
+    return fields.size() == field_count;
+}
+
+//the limit entries from first on, or until the end
+template <typename Entry, typename Project>
+auto page_of(std::vector<Entry> const& entries, std::size_t first, std::size_t limit, Project project)
+{
+    first = std::min(first, entries.size());
+    const auto last = first + std::min(limit, entries.size() - first);
+
+    std::vector<std::decay_t<decltype(project(entries.front()))>> page{};
+    page.reserve(last - first);
+    std::transform(entries.begin() + static_cast<std::ptrdiff_t>(first), entries.begin() + static_cast<std::ptrdiff_t>(last),
+                   std::back_inserter(page), project);
+    return page;
+}
+
+auto same_entry = [](const auto& entry) { return entry; };
+auto entry_town = [](const auto& entry) { return entry.second; };
+}
+
 template <typename Type>
 Type random_in_range(Type start, Type end)
 {
@@ -28,36 +109,77 @@ Datastructures::Datastructures()
 Datastructures::~Datastructures()
 = default;
 
-unsigned int Datastructures::town_count()
+template <typename Type, typename Less>
+void Datastructures::sort_towns(std::vector<Type>& towns, Less less) const
+{
+    //the pool can only run one parallel_for at a time, so if another query
+    //is already sorting with it, sort in this thread instead
+    std::unique_lock lock(sort_mutex_, std::try_to_lock);
+    if (lock.owns_lock() && sort_pool_)
+        parallel_sort(towns.begin(), towns.end(), less, *sort_pool_);
+    else
+        std::sort(towns.begin(), towns.end(), less);
+}
+
+unsigned int Datastructures::town_count() const
 {
+    if (mapped_)
+        return mapped_->town_count();
+
     return static_cast<unsigned int>(database_.size());
 }
 
 void Datastructures::clear_all()
 {
+    //clearing a mapped snapshot closes it, after which the database is an empty one in memory
+    mapped_.reset();
     database_.clear();
+    names_.clear();
     roads_.clear();
+    towns_by_index_.clear();
+    town_xs_.clear();
+    town_ys_.clear();
+
+    //logged last like the other changes, a checkpoint written by log_mutation() must see the cleared database
+    log_mutation(MutationType::CLEAR_ALL, {});
 }
 
-bool Datastructures::add_town(TownID id, const Name& name, Coord coord, int tax)
+bool Datastructures::add_town(TownID const& id, const Name& name, Coord coord, int tax)
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return false;
+
     //insert() returns a boolean value indicating whether or not the insertion was successful
-    //we can just simply return that value
-    return database_.insert({ id, { id, name, coord, get_distance_from_coord(coord), tax } }).second;
+    const auto [town, inserted] = database_.try_emplace(id, Town{ id, {}, coord, get_distance_from_coord(coord), tax });
+    if (inserted)
+    {
+        town->second.name = names_.add(name);
+        index_town(&town->second);
+        log_mutation(MutationType::ADD_TOWN, { id, name }, { coord.x, coord.y, tax });
+    }
+
+    return inserted;
 }
 
-Name Datastructures::get_town_name(TownID id)
+Name Datastructures::get_town_name(TownID const& id) const
 {
+    if (mapped_)
+        return mapped_->get_town_name(id);
+
     const auto town = database_.find(id);
     //if town by this id doesn't exist
     if (town == database_.end())
         return NO_NAME;
 
-    return town->second.name;
+    return Name(names_.view(town->second.name));
 }
 
-Coord Datastructures::get_town_coordinates(TownID id)
+Coord Datastructures::get_town_coordinates(TownID const& id) const
 {
+    if (mapped_)
+        return mapped_->get_town_coordinates(id);
+
     const auto town = database_.find(id);
     //if town by this id doesn't exist
     if (town == database_.end())
@@ -66,8 +188,11 @@ Coord Datastructures::get_town_coordinates(TownID id)
     return town->second.coord;
 }
 
-int Datastructures::get_town_tax(TownID id)
+int Datastructures::get_town_tax(TownID const& id) const
 {
+    if (mapped_)
+        return mapped_->get_town_tax(id);
+
     const auto town = database_.find(id);
 
     //if town by this id doesn't exist
@@ -77,87 +202,164 @@ int Datastructures::get_town_tax(TownID id)
     return town->second.tax;
 }
 
-std::vector<TownID> Datastructures::all_towns()
+TownInfo Datastructures::get_town_info(TownID const& id) const
+{
+    if (mapped_)
+        return mapped_->get_town_info(id);
+
+    const auto town = database_.find(id);
+    //if town by this id doesn't exist
+    if (town == database_.end())
+        return {};
+
+    return { names_.view(town->second.name), town->second.coord, town->second.tax };
+}
+
+std::vector<TownInfo> Datastructures::get_towns_info(const std::vector<TownID>& ids) const
+{
+    std::vector<TownInfo> infos{};
+
+    //reserve space for vector to avoid possible multiple reallocations inside the loop
+    infos.reserve(ids.size());
+
+    std::transform(ids.begin(), ids.end(), std::back_inserter(infos), [this](const auto& id) { return get_town_info(id); });
+    return infos;
+}
+
+std::vector<TownID> Datastructures::all_towns() const
+{
+    if (mapped_)
+        return mapped_->all_towns();
+
+    return all_towns_as<TownID>();
+}
+
+TownViews Datastructures::all_towns_view() const
+{
+    if (mapped_)
+        return mapped_->all_towns_view();
+
+    return all_towns_as<TownView>();
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::all_towns_as() const
 {
-    std::vector<TownID> all_towns{};
+    std::vector<Element> all_towns{};
 
     //reserve space for vector to avoid possible multiple reallocations inside the loop
     all_towns.reserve(database_.size());
 
-    //transform to a vector of town ids by only taking the key of each database element
-    std::transform(database_.begin(), database_.end(), std::back_inserter(all_towns), [](const auto& town) { return town.first; });
+    //transform to a vector of town ids (or views) of each database element
+    std::transform(database_.begin(), database_.end(), std::back_inserter(all_towns), [this](const auto& town) { return town_as<Element>(&town.second); });
     return all_towns;
 }
 
-std::vector<TownID> Datastructures::find_towns(const Name& name)
+std::vector<TownID> Datastructures::find_towns(const Name& name) const
 {
+    if (mapped_)
+        return mapped_->find_towns(name);
+
     std::vector<TownID> matching_towns{};
 
-    //loop through each town in the database adding the matching
-    //towns to output vector
-    for (const auto& [id, town] : database_)
-        if (town.name == name)
-            matching_towns.push_back(id);
+    //loop through the towns in index order adding the matching towns to output vector,
+    //the names were added to the arena in about the same order so it's read sequentially
+    for (const auto town : towns_by_index_)
+        if (town->name.length == name.size() && names_.view(town->name) == name)
+            matching_towns.push_back(town->id);
     return matching_towns;
 }
 
-bool Datastructures::change_town_name(TownID id, const Name& newname)
+bool Datastructures::change_town_name(TownID const& id, const Name& newname)
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return false;
+
     const auto town = database_.find(id);
     //if town by this id doesn't exist
     if (town == database_.end())
         return false;
 
-    town->second.name = newname;
+    names_.replace(town->second.name, newname);
+    if (names_.needs_compaction())
+        compact_names();
+    log_mutation(MutationType::CHANGE_TOWN_NAME, { id, newname });
     return true;
 }
 
-std::vector<TownID> Datastructures::towns_alphabetically()
+std::vector<TownID> Datastructures::towns_alphabetically() const
+{
+    if (mapped_)
+        return mapped_->towns_alphabetically();
+
+    return towns_alphabetically_as<TownID>();
+}
+
+TownViews Datastructures::towns_alphabetically_view() const
+{
+    if (mapped_)
+        return mapped_->towns_alphabetically_view();
+
+    return towns_alphabetically_as<TownView>();
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::towns_alphabetically_as() const
 {
-    std::vector<Town*> towns{};
+    //the names are sorted as views into the arena next to their towns,
+    //so that comparing two names doesn't go through the towns first
+    std::vector<std::pair<std::string_view, const Town*>> towns{};
 
     //reserve space to avoid possible reallocations
-    towns.reserve(database_.size());
+    towns.reserve(towns_by_index_.size());
 
-    //transform to a vector of town ids by only taking the key of each database element
-    std::transform(database_.begin(), database_.end(), std::back_inserter(towns), [](auto& town) { return &town.second; });
+    //the towns in index order read the arena about sequentially
+    std::transform(towns_by_index_.begin(), towns_by_index_.end(), std::back_inserter(towns), [this](const auto& town)
+    {
+        return std::pair{ names_.view(town->name), town };
+    });
 
-    //sort using default string comparison
-    std::sort(towns.begin(), towns.end(), [](const auto& town1, const auto& town2)
+    //sort using default string comparison, ties are broken by id so that the order is always the same
+    sort_towns(towns, [](const auto& town1, const auto& town2)
     {
-        return town1->name < town2->name;
+        return town1.first != town2.first ? town1.first < town2.first : town1.second->id < town2.second->id;
     });
 
-    std::vector<TownID> town_ids{};
+    std::vector<Element> town_ids{};
 
     //reserve space to avoid possible reallocations
-    town_ids.reserve(database_.size());
+    town_ids.reserve(towns.size());
 
-    //transform vector of town pointers to a vector of town ids
-    std::transform(towns.begin(), towns.end(), std::back_inserter(town_ids), [](const auto& town)
+    //transform vector of town pointers to a vector of town ids (or views)
+    std::transform(towns.begin(), towns.end(), std::back_inserter(town_ids), [this](const auto& town)
     {
-        return town->id;
+        return town_as<Element>(town.second);
     });
 
     return town_ids;
 }
 
-std::vector<TownID> Datastructures::towns_distance_increasing()
+std::vector<TownID> Datastructures::towns_distance_increasing() const
 {
+    if (mapped_)
+        return mapped_->towns_distance_increasing();
+
     //if there are no towns, we don't need to do anything
     if (database_.empty())
         return {};
 
-    std::vector<Town*> towns{};
+    std::vector<const Town*> towns{};
+
+    //reserve space to avoid possible reallocations
+    towns.reserve(database_.size());
 
-    //transform unordered_map<string, Town> to a vector of Town pointers
+    //transform the database to a vector of Town pointers
     std::transform(database_.begin(), database_.end(), std::back_inserter(towns), [](auto& town) { return &town.second; });
 
-    //sort using a custom comparator lambda
-    std::sort(towns.begin(), towns.end(), [](const auto& town1, const auto& town2)
-    {
-        return town1->distance_from_origin < town2->distance_from_origin;
-    });
+    //radix sort by the distance, ties are broken by id so that the order is always the same
+    radix_sort(towns, [](const auto& town) { return town->distance_from_origin; },
+               [](const auto& town1, const auto& town2) { return town1->id < town2->id; });
 
     std::vector<TownID> town_ids{};
 
@@ -166,36 +368,46 @@ std::vector<TownID> Datastructures::towns_distance_increasing()
     return town_ids;
 }
 
-TownID Datastructures::min_distance()
+TownID Datastructures::min_distance() const
 {
+    if (mapped_)
+        return mapped_->min_distance();
+
     //if there are no towns in the database
     if (database_.empty())
         return NO_TOWNID;
 
     //finds the element with a minimum distance from (0,0) using a custom comparator lambda
-    //returns the key of the element (the town's id)
+    //returns the key of the element (the town's id), ties are broken by id like in towns_distance_increasing()
     return std::min_element(database_.begin(), database_.end(), [](const auto& town1, const auto& town2)
     {
-        return town1.second.distance_from_origin < town2.second.distance_from_origin;
+        return std::tie(town1.second.distance_from_origin, town1.first) < std::tie(town2.second.distance_from_origin, town2.first);
     })->first;
 }
 
-TownID Datastructures::max_distance()
+TownID Datastructures::max_distance() const
 {
+    if (mapped_)
+        return mapped_->max_distance();
+
     //if there are no towns in the database
     if (database_.empty())
         return NO_TOWNID;
 
     //finds the element with a maximum distance from (0,0) using a custom comparator lambda
-    //returns the key of the element (the town's id)
+    //returns the key of the element (the town's id), the last town of towns_distance_increasing()
     return std::max_element(database_.begin(), database_.end(), [](const auto& town1, const auto& town2)
     {
-        return town1.second.distance_from_origin < town2.second.distance_from_origin;
+        return std::tie(town1.second.distance_from_origin, town1.first) < std::tie(town2.second.distance_from_origin, town2.first);
     })->first;
 }
 
-bool Datastructures::add_vassalship(TownID vassalid, TownID masterid)
+bool Datastructures::add_vassalship(TownID const& vassalid, TownID const& masterid)
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return false;
+
     //if vassal town doesnt exist
     const auto vassal = database_.find(vassalid);
     if (vassal == database_.end())
@@ -212,18 +424,22 @@ bool Datastructures::add_vassalship(TownID vassalid, TownID masterid)
 
     master->second.vassals.push_back(&vassal->second);
     vassal->second.master = &master->second;
+    log_mutation(MutationType::ADD_VASSALSHIP, { vassalid, masterid });
     return true;
 }
 
-std::vector<TownID> Datastructures::get_town_vassals(TownID id)
+std::vector<TownID> Datastructures::get_town_vassals(TownID const& id) const
 {
+    if (mapped_)
+        return mapped_->get_town_vassals(id);
+
     //if town doesnt exist
     const auto town = database_.find(id);
     if (town == database_.end())
         return { NO_TOWNID };
 
     std::vector<TownID> vassal_ids{};
-    const auto vassals = town->second.vassals;
+    const auto& vassals = town->second.vassals;
 
     //reserve space to avoid possible reallocations
     vassal_ids.reserve(vassals.size());
@@ -233,15 +449,32 @@ std::vector<TownID> Datastructures::get_town_vassals(TownID id)
     return vassal_ids;
 }
 
-std::vector<TownID> Datastructures::taxer_path(TownID id)
+std::vector<TownID> Datastructures::taxer_path(TownID const& id) const
+{
+    if (mapped_)
+        return mapped_->taxer_path(id);
+
+    return taxer_path_as<TownID>(id);
+}
+
+TownViews Datastructures::taxer_path_view(TownID const& id) const
+{
+    if (mapped_)
+        return mapped_->taxer_path_view(id);
+
+    return taxer_path_as<TownView>(id);
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::taxer_path_as(TownID const& id) const
 {
     //if town doesnt exist
     const auto town = database_.find(id);
     if (town == database_.end())
-        return { NO_TOWNID };
+        return { Element{ NO_TOWNID } };
 
     //vector of taxers where this town itself is the first element
-    std::vector taxers{ id };
+    std::vector taxers{ town_as<Element>(&town->second) };
 
     //temp variable to store deeper and deeper masters
     auto deeper_master = town->second.master;
@@ -253,7 +486,7 @@ std::vector<TownID> Datastructures::taxer_path(TownID id)
     //find deeper and deeper masters
     for (;;)
     {
-        taxers.push_back(deeper_master->id);
+        taxers.push_back(town_as<Element>(deeper_master));
         //return once there is no deeper master
         if (!deeper_master->master)
             return taxers;
@@ -261,8 +494,12 @@ std::vector<TownID> Datastructures::taxer_path(TownID id)
     }
 }
 
-bool Datastructures::remove_town(TownID id)
+bool Datastructures::remove_town(TownID const& id)
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return false;
+
     //if town doesnt exist
     const auto town = database_.find(id);
     if (town == database_.end())
@@ -295,10 +532,7 @@ bool Datastructures::remove_town(TownID id)
     if (!town->second.roads_to.empty())
     {
         for(auto& [connected_town, distance] : town->second.roads_to)
-            connected_town->roads_to.erase(std::find_if(connected_town->roads_to.begin(), connected_town->roads_to.end(), [&town](const auto& road)
-            {
-                return road.town == &town->second;
-            }));
+            erase_road(connected_town, &town->second);
 
 
         roads_.erase(std::remove_if(roads_.begin(), roads_.end(), [&id](const auto& town_pair)
@@ -308,17 +542,25 @@ bool Datastructures::remove_town(TownID id)
     }
 
     //finally remove this town from the database
-    database_.erase(id);
+    names_.release(town->second.name);
+    unindex_town(&town->second);
+    database_.erase(town);
+    if (names_.needs_compaction())
+        compact_names();
+    log_mutation(MutationType::REMOVE_TOWN, { id });
     return true;
 }
 
-std::vector<TownID> Datastructures::towns_nearest(Coord coord)
+std::vector<TownID> Datastructures::towns_nearest(Coord coord) const
 {
+    if (mapped_)
+        return mapped_->towns_nearest(coord);
+
     //temp struct to represent a town and its distance from
     //the desired point
     struct TownDistance
     {
-        TownID id{};
+        const TownID* id{};
         Distance distance{};
     };
 
@@ -326,39 +568,39 @@ std::vector<TownID> Datastructures::towns_nearest(Coord coord)
     if (database_.empty())
         return {};
 
-    std::vector<TownDistance*> towns_distance{};
+    std::vector<TownDistance> towns_distance{};
     //reserve space to avoid possible reallocations
     towns_distance.reserve(database_.size());
 
-    //transform the database to a vector of TownDistance pointers
-    //pre calculates the distance from the desired point for each town
-    std::transform(database_.begin(), database_.end(), std::back_inserter(towns_distance), [coord](const auto& town)
-    {
-        return new TownDistance{ town.second.id, get_distance_from_coord(town.second.coord, coord) };
-    });
+    //pre calculates the distance from the desired point for each town,
+    //all at once from the coordinate columns
+    std::vector<Distance> distances(towns_by_index_.size());
+    coord_distances(coord, town_xs_.data(), town_ys_.data(), distances.size(), distances.data());
 
-    //efficiently sort based on the distances that were calculated above
-    std::sort(towns_distance.begin(), towns_distance.end(), [](const auto& town1, const auto& town2)
-    {
-        return town1->distance < town2->distance;
-    });
+    //combine the towns and their distances to a vector of TownDistances
+    std::transform(towns_by_index_.begin(), towns_by_index_.end(), distances.begin(), std::back_inserter(towns_distance),
+                   [](const auto& town, const auto& distance) { return TownDistance{ &town->id, distance }; });
+
+    //radix sort based on the distances that were calculated above,
+    //ties are broken by id so that the order is always the same
+    radix_sort(towns_distance, [](const auto& town) { return town.distance; },
+               [](const auto& town1, const auto& town2) { return *town1.id < *town2.id; });
 
     std::vector<TownID> town_ids{};
     //reserve space to avoid possible reallocations
     town_ids.reserve(database_.size());
 
-    //transform vector of TownDistance pointers to a vector or TownIDs
-    std::transform(towns_distance.begin(), towns_distance.end(), std::back_inserter(town_ids), [](const auto& town) { return town->id; });
-
-    //deallocate the TownDistance pointers that were created in the beginning
-    for (const auto& town : towns_distance)
-        delete town;
+    //transform vector of TownDistances to a vector or TownIDs
+    std::transform(towns_distance.begin(), towns_distance.end(), std::back_inserter(town_ids), [](const auto& town) { return *town.id; });
 
     return town_ids;
 }
 
-std::vector<TownID> Datastructures::longest_vassal_path(TownID id)
+std::vector<TownID> Datastructures::longest_vassal_path(TownID const& id) const
 {
+    if (mapped_)
+        return mapped_->longest_vassal_path(id);
+
     //if there are no towns, we don't need to do anything
     if (database_.empty())
         return {};
@@ -377,8 +619,11 @@ std::vector<TownID> Datastructures::longest_vassal_path(TownID id)
     return longest_path;
 }
 
-int Datastructures::total_net_tax(TownID id)
+int Datastructures::total_net_tax(TownID const& id) const
 {
+    if (mapped_)
+        return mapped_->total_net_tax(id);
+
     //if there are no towns, we don't need to do anything
     if (database_.empty())
         return NO_VALUE;
@@ -407,19 +652,49 @@ int Datastructures::total_net_tax(TownID id)
 
 void Datastructures::clear_roads()
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return;
+
     for (auto& [id, town] : database_)
-        town.roads_to.clear();
+        clear_town_roads(&town);
 
     roads_.clear();
+    log_mutation(MutationType::CLEAR_ROADS, {});
 }
 
-std::vector<std::pair<TownID, TownID>> Datastructures::all_roads()
+std::vector<std::pair<TownID, TownID>> Datastructures::all_roads() const
 {
+    if (mapped_)
+        return mapped_->all_roads();
+
     return roads_;
 }
 
-bool Datastructures::add_road(TownID town1_id, TownID town2_id)
+RoadViews Datastructures::all_roads_view() const
+{
+    if (mapped_)
+        return mapped_->all_roads_view();
+
+    RoadViews all_roads{};
+
+    //reserve space to avoid possible reallocations
+    all_roads.reserve(roads_.size());
+
+    //the towns of the roads are looked up once here, instead of by whoever uses the ids
+    std::transform(roads_.begin(), roads_.end(), std::back_inserter(all_roads), [this](const auto& town_pair)
+    {
+        return std::pair{ town_as<TownView>(&database_.at(town_pair.first)), town_as<TownView>(&database_.at(town_pair.second)) };
+    });
+    return all_roads;
+}
+
+bool Datastructures::add_road(TownID const& town1_id, TownID const& town2_id)
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return false;
+
     //if the towns are the same
     if (town1_id == town2_id)
         return false;
@@ -433,24 +708,16 @@ bool Datastructures::add_road(TownID town1_id, TownID town2_id)
     if (town2 == database_.end())
         return false;
 
-    auto& town1_roads = town1->second.roads_to;
-    auto& town2_roads = town2->second.roads_to;
-
     //if the road already exists
-    //searching from a town's roads_to unordered_set is faster than searching from the roads_ list
-    const auto road = std::find_if(town1_roads.begin(), town1_roads.end(), [&town2_id](const auto& road)
-    {
-        return road.town->id == town2_id;
-    });
-
-    if (road != town1_roads.end())
+    //searching from a town's roads is faster than searching from the roads_ list
+    if (find_road(&town1->second, &town2->second))
         return false;
 
     const auto road_length = get_distance_from_coord(town1->second.coord, town2->second.coord);
 
     //add the road for both towns
-    town1_roads.insert({ &town2->second, road_length });
-    town2_roads.insert({ &town1->second, road_length });
+    insert_road(&town1->second, { &town2->second, road_length });
+    insert_road(&town2->second, { &town1->second, road_length });
 
     //town with the smaller id comes first
     const auto town_pair = town1_id < town2_id ? std::make_pair(town1_id, town2_id) : std::make_pair(town2_id, town1_id);
@@ -458,29 +725,56 @@ bool Datastructures::add_road(TownID town1_id, TownID town2_id)
     //add this road to the list of all roads
     roads_.push_back(town_pair);
 
+    log_mutation(MutationType::ADD_ROAD, { town1_id, town2_id });
     return true;
 }
 
-std::vector<TownID> Datastructures::get_roads_from(TownID id)
+std::vector<TownID> Datastructures::get_roads_from(TownID const& id) const
+{
+    if (mapped_)
+        return mapped_->get_roads_from(id);
+
+    return get_roads_from_as<TownID>(id);
+}
+
+TownViews Datastructures::get_roads_from_view(TownID const& id) const
+{
+    if (mapped_)
+        return mapped_->get_roads_from_view(id);
+
+    return get_roads_from_as<TownView>(id);
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::get_roads_from_as(TownID const& id) const
 {
     //if town doesnt exist
     const auto town = database_.find(id);
     if (town == database_.end())
-        return { NO_TOWNID };
+        return { Element{ NO_TOWNID } };
 
-    std::vector<TownID> connected_towns{};
-    std::transform(town->second.roads_to.begin(), town->second.roads_to.end(), std::back_inserter(connected_towns), [](const auto& road) { return road.town->id; });
+    std::vector<Element> connected_towns{};
+    std::transform(town->second.roads_to.begin(), town->second.roads_to.end(), std::back_inserter(connected_towns), [this](const auto& road) { return town_as<Element>(road.town); });
 
     return connected_towns;
 }
 
-std::vector<TownID> Datastructures::any_route(TownID fromid, TownID toid)
+std::vector<TownID> Datastructures::any_route(TownID const& fromid, TownID const& toid) const
 {
     return least_towns_route(fromid, toid);
 }
 
-bool Datastructures::remove_road(TownID town1_id, TownID town2_id)
+TownViews Datastructures::any_route_view(TownID const& fromid, TownID const& toid) const
+{
+    return least_towns_route_view(fromid, toid);
+}
+
+bool Datastructures::remove_road(TownID const& town1_id, TownID const& town2_id)
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return false;
+
     //if the towns are the same
     if (town1_id == town2_id)
         return false;
@@ -494,36 +788,41 @@ bool Datastructures::remove_road(TownID town1_id, TownID town2_id)
     if (town2 == database_.end())
         return false;
 
-    auto& town1_roads = town1->second.roads_to;
-    auto& town2_roads = town2->second.roads_to;
-
-    //search for the road from the first town
-    const auto town1_road = std::find_if(town1_roads.begin(), town1_roads.end(), [&town2_id](const auto& road)
-    {
-        return road.town->id == town2_id;
-    });
-
     //if the road doesn't exist in town 1
-    if (town1_road == town1_roads.end())
+    if (!find_road(&town1->second, &town2->second))
         return false;
 
-    town1_roads.erase(town1_road);
-
     //if the road existed in town1, it has to exist in town2 as well
-    town2_roads.erase(std::find_if(town2_roads.begin(), town2_roads.end(), [&town1_id](const auto& road)
-    {
-        return road.town->id == town1_id;
-    }));
+    erase_road(&town1->second, &town2->second);
+    erase_road(&town2->second, &town1->second);
 
     roads_.erase(std::find_if(roads_.begin(), roads_.end(), [&town1_id, &town2_id](const auto& town_pair)
     {
         return (town_pair.first == town1_id && town_pair.second == town2_id) || (town_pair.first == town2_id && town_pair.second == town1_id);
     }));
 
+    log_mutation(MutationType::REMOVE_ROAD, { town1_id, town2_id });
     return true;
 }
 
-std::vector<TownID> Datastructures::least_towns_route(TownID fromid, TownID toid)
+std::vector<TownID> Datastructures::least_towns_route(TownID const& fromid, TownID const& toid) const
+{
+    if (mapped_)
+        return mapped_->least_towns_route(fromid, toid);
+
+    return least_towns_route_as<TownID>(fromid, toid);
+}
+
+TownViews Datastructures::least_towns_route_view(TownID const& fromid, TownID const& toid) const
+{
+    if (mapped_)
+        return mapped_->least_towns_route_view(fromid, toid);
+
+    return least_towns_route_as<TownView>(fromid, toid);
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::least_towns_route_as(TownID const& fromid, TownID const& toid) const
 {
     //if the start and destination are the same, there is no route
     if (fromid == toid)
@@ -532,24 +831,20 @@ std::vector<TownID> Datastructures::least_towns_route(TownID fromid, TownID toid
     //if either of the towns doesn't exist
     const auto town1 = database_.find(fromid);
     if (town1 == database_.end())
-        return { NO_TOWNID };
+        return { Element{ NO_TOWNID } };
 
     const auto town2 = database_.find(toid);
     if (town2 == database_.end())
-        return { NO_TOWNID };
+        return { Element{ NO_TOWNID } };
 
     const auto& start = &town1->second;
     const auto& destination = &town2->second;
 
-    //reset bfs related fields for each town
-    for (auto& [id, town] : database_)
-    {
-        town.processed = false;
-        town.prev_town = nullptr;
-    }
+    //bfs related fields for each town
+    SearchStates states(towns_by_index_.size());
 
-    start->processed = true;
-    std::deque queue{ start };
+    states[start->index].processed = true;
+    std::deque<const Town*> queue{ start };
 
     while (!queue.empty())
     {
@@ -558,19 +853,20 @@ std::vector<TownID> Datastructures::least_towns_route(TownID fromid, TownID toid
 
         for (auto& road : town->roads_to)
         {
-            if (road.town->processed)
+            auto& state = states[road.town->index];
+            if (state.processed)
                 continue;
 
             //if the currently processed town is
             //the destination town, we're done
             if (road.town == destination)
             {
-                destination->prev_town = town;
-                return construct_town_path(destination);
+                state.prev_town = town;
+                return construct_town_path<Element>(destination, states);
             }
 
-            road.town->processed = true;
-            road.town->prev_town = town;
+            state.processed = true;
+            state.prev_town = town;
 
             queue.push_back(road.town);
         }
@@ -579,48 +875,62 @@ std::vector<TownID> Datastructures::least_towns_route(TownID fromid, TownID toid
     return { };
 }
 
-std::vector<TownID> Datastructures::road_cycle_route(TownID startid)
+std::vector<TownID> Datastructures::road_cycle_route(TownID const& startid) const
+{
+    if (mapped_)
+        return mapped_->road_cycle_route(startid);
+
+    return road_cycle_route_as<TownID>(startid);
+}
+
+TownViews Datastructures::road_cycle_route_view(TownID const& startid) const
+{
+    if (mapped_)
+        return mapped_->road_cycle_route_view(startid);
+
+    return road_cycle_route_as<TownView>(startid);
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::road_cycle_route_as(TownID const& startid) const
 {
     //if town doesn't exist
     const auto start = database_.find(startid);
     if (start == database_.end())
-        return { NO_TOWNID };
+        return { Element{ NO_TOWNID } };
 
-    //reset dfs related fields for each town
-    for (auto& [id, town] : database_)
-    {
-        town.processed = false;
-        town.prev_town = nullptr;
-    }
+    //dfs related fields for each town
+    SearchStates states(towns_by_index_.size());
 
-    std::stack<Town*> stack{};
+    std::stack<const Town*> stack{};
     stack.push(&start->second);
 
     while (!stack.empty())
     {
-        auto& town = stack.top();
+        const auto town = stack.top();
         stack.pop();
 
-        if (town->processed)
+        if (states[town->index].processed)
             continue;
 
-        town->processed = true;
+        states[town->index].processed = true;
         stack.push(town);
 
         for(auto& road : town->roads_to)
         {
-            if (!road.town->processed)
+            auto& state = states[road.town->index];
+            if (!state.processed)
             {
-                road.town->prev_town = town;
+                state.prev_town = town;
                 stack.push(road.town);
             }
             //if we found an already processed town
             //and we're not going backwards to where
             //we came from, we're done
-            else if (road.town != town->prev_town)
+            else if (road.town != states[town->index].prev_town)
             {
-                auto path = construct_town_path(town);
-                path.push_back(road.town->id);
+                auto path = construct_town_path<Element>(town, states);
+                path.push_back(town_as<Element>(road.town));
                 return path;
             }
         }
@@ -629,7 +939,24 @@ std::vector<TownID> Datastructures::road_cycle_route(TownID startid)
     return { };
 }
 
-std::vector<TownID> Datastructures::shortest_route(TownID fromid, TownID toid)
+std::vector<TownID> Datastructures::shortest_route(TownID const& fromid, TownID const& toid) const
+{
+    if (mapped_)
+        return mapped_->shortest_route(fromid, toid);
+
+    return shortest_route_as<TownID>(fromid, toid);
+}
+
+TownViews Datastructures::shortest_route_view(TownID const& fromid, TownID const& toid) const
+{
+    if (mapped_)
+        return mapped_->shortest_route_view(fromid, toid);
+
+    return shortest_route_as<TownView>(fromid, toid);
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::shortest_route_as(TownID const& fromid, TownID const& toid) const
 {
     //if the start and destination are the same, there is no route
     if (fromid == toid)
@@ -638,31 +965,28 @@ std::vector<TownID> Datastructures::shortest_route(TownID fromid, TownID toid)
     //if either of the towns doesn't exist
     const auto town1 = database_.find(fromid);
     if (town1 == database_.end())
-        return { NO_TOWNID };
+        return { Element{ NO_TOWNID } };
 
     const auto town2 = database_.find(toid);
     if (town2 == database_.end())
-        return { NO_TOWNID };
+        return { Element{ NO_TOWNID } };
 
     const auto& start = &town1->second;
     const auto& destination = &town2->second;
 
-    //reset A* related fields for each town
-    for (auto& [id, town] : database_)
-    {
-        town.processed = false;
-        town.distance = MAX_VALUE;
-        town.distance_estimate = MAX_VALUE;
-        town.prev_town = nullptr;
-    }
+    //A* related fields for each town
+    SearchStates states(towns_by_index_.size());
 
-    start->processed = true;
-    start->distance = 0;
+    states[start->index].processed = true;
+    states[start->index].distance = 0;
 
     //custom comparator for the priority queue, so it can tell the priority
     //of towns based off their distance estimates
-    auto comparator = [](const Town* first, const Town* second) { return first->distance_estimate > second->distance_estimate; };
-    std::priority_queue<Town*, std::vector<Town*>, decltype(comparator)> queue(comparator);
+    auto comparator = [&states](const Town* first, const Town* second)
+    {
+        return states[first->index].distance_estimate > states[second->index].distance_estimate;
+    };
+    std::priority_queue<const Town*, std::vector<const Town*>, decltype(comparator)> queue(comparator);
     queue.push(start);
 
     while (!queue.empty())
@@ -673,16 +997,16 @@ std::vector<TownID> Datastructures::shortest_route(TownID fromid, TownID toid)
         //if the currently processed town is
         //the destination town, we're done
         if (town == destination) 
-            return construct_town_path(town);
+            return construct_town_path<Element>(town, states);
 
         for (auto& road : town->roads_to)
         {
             //set the distance & distance estimate for
             //the town connected by this road
-            relax_a(town, &road);
-            if (!road.town->processed)
+            relax_a(town, &road, states);
+            if (!states[road.town->index].processed)
             {
-                road.town->processed = true;
+                states[road.town->index].processed = true;
                 queue.push(road.town);
             }
         }
@@ -693,6 +1017,10 @@ std::vector<TownID> Datastructures::shortest_route(TownID fromid, TownID toid)
 
 Distance Datastructures::trim_road_network()
 {
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return NO_DISTANCE;
+
     //if there are no roads
     if (roads_.empty())
         return 0;
@@ -707,6 +1035,9 @@ Distance Datastructures::trim_road_network()
     //store all roads in a set so it's automatically sorted by road distance (cost)
     std::set<std::pair<Distance, connected_towns*>> all_roads{};
 
+    //which towns have been connected to the spanning tree
+    std::vector<bool> processed(towns_by_index_.size());
+
     //populate all_roads and clear each town's roads
     for(auto& db_town : database_)
     {
@@ -717,16 +1048,12 @@ Distance Datastructures::trim_road_network()
 
             //if we added the road from this town already, lets remove it from the second town's roads 
             //so it doesn't get added twice
-            road.town->roads_to.erase(std::find_if(road.town->roads_to.begin(), road.town->roads_to.end(), [&db_town](const auto& road)
-            {
-                return road.town->id == db_town.second.id;
-            }));
+            erase_road(road.town, &db_town.second);
         }
 
         //once each road for this town has been processed, we can just clear them all
         //and move onto the next town
-        db_town.second.roads_to.clear();
-        db_town.second.processed = false;
+        clear_town_roads(&db_town.second);
     }
 
     roads_.clear();
@@ -744,13 +1071,13 @@ Distance Datastructures::trim_road_network()
         const auto town2 = town_pair->town2;
 
         //if both towns are unprocessed, create a new sub_set
-        if (!town1->processed && !town2->processed)
+        if (!processed[town1->index] && !processed[town2->index])
         {
-            town1->processed = true;
-            town2->processed = true;
+            processed[town1->index] = true;
+            processed[town2->index] = true;
 
-            town1->roads_to.insert({ town2, cost });
-            town2->roads_to.insert({ town1, cost });
+            insert_road(town1, { town2, cost });
+            insert_road(town2, { town1, cost });
 
             const auto concatenated_ids = town1->id < town2->id ? std::make_pair(town1->id, town2->id) : std::make_pair(town2->id, town1->id);
             roads_.push_back(concatenated_ids);
@@ -763,12 +1090,12 @@ Distance Datastructures::trim_road_network()
 
         //if either town is unprocessed, add the unprocessed town into the
         //processed town's subset
-        if (!town1->processed || !town2->processed)
+        if (!processed[town1->index] || !processed[town2->index])
         {
-            auto unprocessed_town = !town1->processed ? town1 : town2;
-            auto processed_town = town1->processed ? town1 : town2;
+            auto unprocessed_town = !processed[town1->index] ? town1 : town2;
+            auto processed_town = processed[town1->index] ? town1 : town2;
 
-            unprocessed_town->processed = true;
+            processed[unprocessed_town->index] = true;
 
             for (auto& sub_set : sub_sets)
             {
@@ -779,8 +1106,8 @@ Distance Datastructures::trim_road_network()
                 }
             }
 
-            unprocessed_town->roads_to.insert({ processed_town, cost });
-            processed_town->roads_to.insert({ unprocessed_town, cost });
+            insert_road(unprocessed_town, { processed_town, cost });
+            insert_road(processed_town, { unprocessed_town, cost });
 
             const auto concatenated_ids = town1->id < town2->id ? std::make_pair(town1->id, town2->id) : std::make_pair(town2->id, town1->id);
             roads_.push_back(concatenated_ids);
@@ -824,8 +1151,8 @@ Distance Datastructures::trim_road_network()
         else
             sub_set2->merge(*sub_set1);
 
-        town1->roads_to.insert({ town2, cost });
-        town2->roads_to.insert({ town1, cost });
+        insert_road(town1, { town2, cost });
+        insert_road(town2, { town1, cost });
 
         const auto concatenated_ids = town1->id < town2->id ? std::make_pair(town1->id, town2->id) : std::make_pair(town2->id, town1->id);
         roads_.push_back(concatenated_ids);
@@ -835,10 +1162,130 @@ Distance Datastructures::trim_road_network()
     //finally deallocate the connected_town pairs
     for (const auto& [cost, connected_towns] : all_roads)
         delete connected_towns;
-    
+
+    ++changes_;
+
+    //the remaining roads are logged instead of the trim itself, because equally long roads
+    //are ordered by their addresses in memory, which differ when the log is replayed
+    if (log_)
+    {
+        std::vector<std::string_view> remaining_roads{};
+        remaining_roads.reserve(2 * roads_.size());
+        for (const auto& [town1_id, town2_id] : roads_)
+        {
+            remaining_roads.push_back(town1_id);
+            remaining_roads.push_back(town2_id);
+        }
+        if (log_->append(MutationType::TRIM_ROAD_NETWORK, remaining_roads))
+            checkpoint_log();
+    }
+
     return total_distance;
 }
 
+
+
+//
+// Batch operations
+//
+
+
+unsigned int Datastructures::add_towns(const std::vector<TownSpec>& towns)
+{
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return 0;
+
+    //reserve space for the whole batch at once so that the database is rehashed at most once
+    database_.reserve(database_.size() + towns.size());
+    towns_by_index_.reserve(towns_by_index_.size() + towns.size());
+    town_xs_.reserve(town_xs_.size() + towns.size());
+    town_ys_.reserve(town_ys_.size() + towns.size());
+    const auto first_added = towns_by_index_.size();
+
+    unsigned int added{};
+    for (const auto& [id, name, coord, tax] : towns)
+    {
+        //try_emplace doesn't insert anything if the id is already taken
+        const auto [town, inserted] = database_.try_emplace(id);
+        if (!inserted)
+            continue;
+
+        town->second.id = id;
+        town->second.name = names_.add(name);
+        town->second.coord = coord;
+        town->second.tax = tax;
+        index_town(&town->second);
+        log_mutation(MutationType::ADD_TOWN, { id, name }, { coord.x, coord.y, tax });
+        ++added;
+    }
+
+    //the added towns are at the end of the coordinate columns,
+    //so their distances from the origin can be calculated all at once
+    std::vector<Distance> distances(added);
+    coord_distances({ 0, 0 }, town_xs_.data() + first_added, town_ys_.data() + first_added, added, distances.data());
+    for (unsigned int i = 0; i < added; ++i)
+        towns_by_index_[first_added + i]->distance_from_origin = distances[i];
+
+    return added;
+}
+
+unsigned int Datastructures::add_vassalships(const std::vector<std::pair<TownID, TownID>>& vassalships)
+{
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return 0;
+
+    unsigned int added{};
+    for (const auto& [vassalid, masterid] : vassalships)
+        if (add_vassalship(vassalid, masterid))
+            ++added;
+
+    return added;
+}
+
+unsigned int Datastructures::add_roads(const std::vector<std::pair<TownID, TownID>>& roads)
+{
+    //a mapped snapshot is read-only
+    if (mapped_)
+        return 0;
+
+    //the list of all roads grows at most once for the whole batch
+    roads_.reserve(roads_.size() + roads.size());
+
+    unsigned int added{};
+    for (const auto& [town1_id, town2_id] : roads)
+    {
+        //if the towns are the same
+        if (town1_id == town2_id)
+            continue;
+
+        //if either of the towns doesn't exist
+        const auto town1 = database_.find(town1_id);
+        if (town1 == database_.end())
+            continue;
+
+        const auto town2 = database_.find(town2_id);
+        if (town2 == database_.end())
+            continue;
+
+        const auto road_length = get_distance_from_coord(town1->second.coord, town2->second.coord);
+
+        //if the road already exists, found from town1's few roads or its road index
+        if (find_road(&town1->second, &town2->second))
+            continue;
+        insert_road(&town1->second, { &town2->second, road_length });
+        insert_road(&town2->second, { &town1->second, road_length });
+
+        //town with the smaller id comes first
+        roads_.push_back(town1_id < town2_id ? std::make_pair(town1_id, town2_id) : std::make_pair(town2_id, town1_id));
+        log_mutation(MutationType::ADD_ROAD, { town1_id, town2_id });
+        ++added;
+    }
+
+    return added;
+}
+
 size_t Datastructures::recursive_vassal_path(const Town* town, std::vector<TownID>& current_path, std::vector<TownID>& longest_path)
 {
     //if the current town no longer has vassals
@@ -864,12 +1311,8 @@ size_t Datastructures::recursive_vassal_path(const Town* town, std::vector<TownI
 
 Distance Datastructures::get_distance_from_coord(const Coord& town_location, const Coord& coord)
 {
-    const auto x = coord.x - town_location.x;
-    const auto y = coord.y - town_location.y;
-    //cast to int to floor efficiently
-    //when just doing comparisons, normally sqrt could be left out here to save on perfomance
-    //but the documentation has very strict rules on flooring before comparing, so it can't be left out
-    return static_cast<Distance>(sqrt(x * x + y * y));
+    //computed in 64 bits, so that large coordinates don't overflow
+    return coord_distance(town_location, coord);
 }
 
 void Datastructures::transfer_vassals(const Town* current_master, Town* new_master)
@@ -883,6 +1326,68 @@ void Datastructures::transfer_vassals(const Town* current_master, Town* new_mast
     }
 }
 
+Road* Datastructures::find_road(Town* town, const Town* to)
+{
+    auto& roads = town->roads_to;
+    if (town->road_index)
+    {
+        const auto position = town->road_index->find(to);
+        return position == town->road_index->end() ? nullptr : &roads[position->second];
+    }
+
+    //without an index the town has only its few inline roads
+    const auto road = std::find_if(roads.begin(), roads.end(), [to](const auto& road) { return road.town == to; });
+    return road == roads.end() ? nullptr : road;
+}
+
+void Datastructures::insert_road(Town* town, Road road)
+{
+    auto& roads = town->roads_to;
+    roads.push_back(road);
+    if (town->road_index)
+    {
+        town->road_index->emplace(road.town, static_cast<std::uint32_t>(roads.size() - 1));
+        return;
+    }
+
+    //the roads no longer fit inline, so they are indexed from now on
+    if (roads.size() > TOWN_INLINE_ROADS)
+    {
+        town->road_index = std::make_unique<RoadIndex>();
+        town->road_index->reserve(2 * roads.size());
+        for (std::size_t i = 0; i < roads.size(); ++i)
+            town->road_index->emplace(roads[i].town, static_cast<std::uint32_t>(i));
+    }
+}
+
+void Datastructures::erase_road(Town* town, const Town* to)
+{
+    auto& roads = town->roads_to;
+    if (!town->road_index)
+    {
+        roads.erase(std::find_if(roads.begin(), roads.end(), [to](const auto& road) { return road.town == to; }));
+        return;
+    }
+
+    //the last road is moved in the erased road's place, so that nothing else moves
+    auto& index = *town->road_index;
+    const auto position = index.find(to);
+    const auto last = roads.back();
+    if (position->second != roads.size() - 1)
+    {
+        roads[position->second] = last;
+        index[last.town] = position->second;
+    }
+    index.erase(position);
+    roads.pop_back();
+}
+
+void Datastructures::clear_town_roads(Town* town)
+{
+    town->roads_to.clear();
+    town->road_index.reset();
+}
+
 int Datastructures::recursive_net_tax(const Town* town)
 {
     //if the current town no longer has vassals
@@ -906,34 +1411,336 @@ int Datastructures::recursive_net_tax(const Town* town)
     return tax_earnings + town->tax;
 }
 
-std::vector<TownID> Datastructures::construct_town_path(const Town* last_town)
+template <typename Element>
+Element Datastructures::town_as(const Town* town) const
+{
+    if constexpr (std::is_same_v<Element, TownView>)
+        return { town->id.view(), { names_.view(town->name), town->coord, town->tax } };
+    else
+        return town->id;
+}
+
+template <typename Element>
+std::vector<Element> Datastructures::construct_town_path(const Town* last_town, const SearchStates& states) const
 {
-    std::vector route{ last_town->id };
-    auto step = last_town->prev_town;
+    std::vector route{ town_as<Element>(last_town) };
+    auto step = states[last_town->index].prev_town;
 
     //construct the route we came from by
     //going backwards until cant go back anymore
     for (;;)
     {
-        if (!step->prev_town)
+        if (!states[step->index].prev_town)
             break;
-        route.push_back(step->id);
-        step = step->prev_town;
+        route.push_back(town_as<Element>(step));
+        step = states[step->index].prev_town;
     }
 
-    route.push_back(step->id);
+    route.push_back(town_as<Element>(step));
     //flip the route from end->start to start->end
     std::reverse(route.begin(), route.end());
     return route;
 }
 
-void Datastructures::relax_a(Town* town, const Road* road)
+void Datastructures::relax_a(const Town* town, const Road* road, SearchStates& states)
 {
     const auto cost = get_distance_from_coord(town->coord, road->town->coord);
-    if (road->town->distance > town->distance + cost)
+    const auto distance = states[town->index].distance;
+    auto& state = states[road->town->index];
+    if (state.distance > distance + cost)
     {
-        road->town->distance = town->distance + cost;
-        road->town->distance_estimate = road->town->distance + road->length;
-        road->town->prev_town = town;
+        state.distance = distance + cost;
+        state.distance_estimate = state.distance + road->length;
+        state.prev_town = town;
     }
 }
+
+void Datastructures::index_town(Town* town)
+{
+    town->index = towns_by_index_.size();
+    towns_by_index_.push_back(town);
+    town_xs_.push_back(town->coord.x);
+    town_ys_.push_back(town->coord.y);
+}
+
+void Datastructures::unindex_town(const Town* town)
+{
+    //move the last town to the removed town's place, so that the indices stay dense
+    const auto last = towns_by_index_.back();
+    last->index = town->index;
+    towns_by_index_[town->index] = last;
+    towns_by_index_.pop_back();
+    town_xs_[town->index] = town_xs_.back();
+    town_xs_.pop_back();
+    town_ys_[town->index] = town_ys_.back();
+    town_ys_.pop_back();
+}
+
+void Datastructures::compact_names()
+{
+    NameArena compacted{};
+    compacted.reserve(names_.live_size());
+    for (const auto town : towns_by_index_)
+        town->name = compacted.add(names_.view(town->name));
+    names_ = std::move(compacted);
+}
+
+TownViews Datastructures::towns_alphabetically_page(std::size_t offset, std::size_t limit) const
+{
+    std::lock_guard lock(page_mutex_);
+    return page_of(alphabetical_index(), offset, limit, same_entry);
+}
+
+TownViews Datastructures::towns_distance_increasing_page(std::size_t offset, std::size_t limit) const
+{
+    std::lock_guard lock(page_mutex_);
+    return page_of(distance_index(), offset, limit, entry_town);
+}
+
+RoadViews Datastructures::all_roads_page(std::size_t offset, std::size_t limit) const
+{
+    std::lock_guard lock(page_mutex_);
+    return page_of(road_index(), offset, limit, same_entry);
+}
+
+TownPage Datastructures::towns_alphabetically_after(std::string const& cursor, std::size_t limit) const
+{
+    std::vector<std::string> key{};
+    if (!cursor.empty() && !read_cursor(cursor, 2, key))
+        return { { TownView{ NO_TOWNID } }, {} };
+
+    std::lock_guard lock(page_mutex_);
+    const auto& towns = alphabetical_index();
+
+    //the first town after the cursor's (name, id)
+    auto first = towns.begin();
+    if (!cursor.empty())
+        first = std::upper_bound(towns.begin(), towns.end(), std::pair<std::string_view, std::string_view>{ key[0], key[1] },
+                                 [](const auto& key, const auto& town) { return key < std::pair{ town.info.name, town.id }; });
+
+    TownPage page{ page_of(towns, static_cast<std::size_t>(first - towns.begin()), limit, same_entry), {} };
+    if (!page.towns.empty() && first + static_cast<std::ptrdiff_t>(page.towns.size()) != towns.end())
+        page.next = make_cursor({ page.towns.back().info.name, page.towns.back().id });
+    return page;
+}
+
+TownPage Datastructures::towns_distance_increasing_after(std::string const& cursor, std::size_t limit) const
+{
+    std::vector<std::string> key{};
+    Distance distance{};
+    if (!cursor.empty())
+    {
+        if (!read_cursor(cursor, 2, key))
+            return { { TownView{ NO_TOWNID } }, {} };
+        const auto [end, error] = std::from_chars(key[0].data(), key[0].data() + key[0].size(), distance);
+        if (error != std::errc{} || end != key[0].data() + key[0].size())
+            return { { TownView{ NO_TOWNID } }, {} };
+    }
+
+    std::lock_guard lock(page_mutex_);
+    const auto& towns = distance_index();
+
+    //the first town after the cursor's (distance, id)
+    auto first = towns.begin();
+    if (!cursor.empty())
+        first = std::upper_bound(towns.begin(), towns.end(), std::pair<Distance, std::string_view>{ distance, key[1] },
+                                 [](const auto& key, const auto& town) { return key < std::pair{ town.first, town.second.id }; });
+
+    TownPage page{ page_of(towns, static_cast<std::size_t>(first - towns.begin()), limit, entry_town), {} };
+    if (!page.towns.empty() && first + static_cast<std::ptrdiff_t>(page.towns.size()) != towns.end())
+    {
+        const auto& last = *(first + static_cast<std::ptrdiff_t>(page.towns.size()) - 1);
+        page.next = make_cursor({ std::to_string(last.first), last.second.id });
+    }
+    return page;
+}
+
+RoadPage Datastructures::all_roads_after(std::string const& cursor, std::size_t limit) const
+{
+    std::vector<std::string> key{};
+    if (!cursor.empty() && !read_cursor(cursor, 2, key))
+        return { { { TownView{ NO_TOWNID }, TownView{ NO_TOWNID } } }, {} };
+
+    std::lock_guard lock(page_mutex_);
+    const auto& roads = road_index();
+
+    //the first road after the cursor's (town1 id, town2 id)
+    auto first = roads.begin();
+    if (!cursor.empty())
+        first = std::upper_bound(roads.begin(), roads.end(), std::pair<std::string_view, std::string_view>{ key[0], key[1] },
+                                 [](const auto& key, const auto& road) { return key < std::pair{ road.first.id, road.second.id }; });
+
+    RoadPage page{ page_of(roads, static_cast<std::size_t>(first - roads.begin()), limit, same_entry), {} };
+    if (!page.roads.empty() && first + static_cast<std::ptrdiff_t>(page.roads.size()) != roads.end())
+        page.next = make_cursor({ page.roads.back().first.id, page.roads.back().second.id });
+    return page;
+}
+
+const std::vector<TownView>& Datastructures::alphabetical_index() const
+{
+    if (alphabetical_index_.changes != changes_)
+    {
+        alphabetical_index_.entries = towns_alphabetically_view();
+        alphabetical_index_.changes = changes_;
+    }
+    return alphabetical_index_.entries;
+}
+
+const std::vector<std::pair<Distance, TownView>>& Datastructures::distance_index() const
+{
+    if (distance_index_.changes != changes_)
+    {
+        //the same order as towns_distance_increasing(), with the distances kept for the cursors
+        auto& towns = distance_index_.entries;
+        towns.clear();
+        for (const auto& town : all_towns_view())
+            towns.emplace_back(get_distance_from_coord(town.info.coord), town);
+        radix_sort(towns, [](const auto& town) { return town.first; },
+                   [](const auto& town1, const auto& town2) { return town1.second.id < town2.second.id; });
+        distance_index_.changes = changes_;
+    }
+    return distance_index_.entries;
+}
+
+const std::vector<std::pair<TownView, TownView>>& Datastructures::road_index() const
+{
+    if (road_index_.changes != changes_)
+    {
+        auto& roads = road_index_.entries;
+        roads = all_roads_view();
+        std::sort(roads.begin(), roads.end(), [](const auto& road1, const auto& road2)
+        {
+            return std::pair{ road1.first.id, road1.second.id } < std::pair{ road2.first.id, road2.second.id };
+        });
+        road_index_.changes = changes_;
+    }
+    return road_index_.entries;
+}
+
+void Datastructures::set_sort_threads(unsigned int threads)
+{
+    std::lock_guard lock(sort_mutex_);
+    if (threads > 1)
+        sort_pool_ = std::make_unique<ThreadPool>(threads);
+    else
+        sort_pool_.reset();
+}
+
+unsigned int Datastructures::sort_threads() const
+{
+    std::lock_guard lock(sort_mutex_);
+    return sort_pool_ ? sort_pool_->size() : 1;
+}
+
+bool Datastructures::open_mapped(const std::string& filename, bool check_contents, std::string& error)
+{
+    //the mapped file can't be changed, so there would be nothing to log
+    if (log_)
+    {
+        error = "Cannot map a snapshot while the mutation log is open";
+        return false;
+    }
+
+    auto mapped = std::make_unique<MappedRealm>(filename, check_contents);
+    if (!mapped->ok())
+    {
+        error = mapped->error();
+        return false;
+    }
+
+    //the towns in memory are no longer needed, queries go to the file from now on
+    clear_all();
+    mapped_ = std::move(mapped);
+    return true;
+}
+
+void Datastructures::close_mapped()
+{
+    mapped_.reset();
+    ++changes_;
+}
+
+bool Datastructures::is_mapped() const
+{
+    return mapped_ != nullptr;
+}
+
+bool Datastructures::open_log(const std::string& directory, const MutationLogSettings& settings, std::string& error)
+{
+    if (mapped_)
+    {
+        error = "A mapped snapshot can't be logged";
+        return false;
+    }
+
+    //the previous log is closed first, so that the recovery isn't logged to it
+    if (log_ && !close_log(error))
+        return false;
+
+    auto log = std::make_unique<MutationLog>(directory, settings, *this);
+    if (!log->ok())
+    {
+        error = log->error();
+        return false;
+    }
+
+    log_ = std::move(log);
+    return true;
+}
+
+bool Datastructures::close_log(std::string& error)
+{
+    if (!log_)
+        return true;
+
+    const auto synced = log_->sync();
+    if (!synced)
+        error = log_->error();
+    log_.reset();
+    return synced;
+}
+
+bool Datastructures::checkpoint(std::string& error)
+{
+    if (!log_)
+    {
+        error = "The mutation log isn't open";
+        return false;
+    }
+    return log_->checkpoint(*this, error);
+}
+
+const MutationLog* Datastructures::mutation_log() const
+{
+    return log_.get();
+}
+
+NameMemory Datastructures::name_memory() const
+{
+    if (mapped_)
+        return {};
+
+    //names up to this long are stored in the std::string itself, longer ones in a heap block
+    //of at least 32 bytes, with 8 bytes of malloc's bookkeeping, rounded up to 16 bytes
+    const auto inline_capacity = std::string().capacity();
+    std::size_t strings = database_.size() * sizeof(std::string);
+    for (const auto town : towns_by_index_)
+        if (town->name.length > inline_capacity)
+            strings += std::max<std::size_t>(32, (town->name.length + 1 + 8 + 15) / 16 * 16);
+
+    return { names_.capacity() + database_.size() * sizeof(NameHandle), strings };
+}
+
+void Datastructures::log_mutation(MutationType type, std::initializer_list<std::string_view> strings, std::initializer_list<std::int64_t> numbers)
+{
+    ++changes_;
+    if (log_ && log_->append(type, strings, numbers))
+        checkpoint_log();
+}
+
+void Datastructures::checkpoint_log()
+{
+    //a failed checkpoint is tried again later, the changes are still in the log meanwhile
+    std::string error;
+    log_->checkpoint(*this, error);
+}
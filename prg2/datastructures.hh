@@ -8,6 +8,7 @@
 #define DATASTRUCTURES_HH
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <tuple>
 #include <utility>
@@ -16,14 +17,24 @@
 #include <exception>
 #include <iterator>
 #include <unordered_set>
+#include <unordered_map>
 #include <deque>
 #include <stack>
 #include <queue>
 #include <set>
+#include <memory>
+#include <mutex>
 
+#include "threadpool.hh"
+#include "mutationlog.hh"
+#include "townid.hh"
+#include "namearena.hh"
+#include "smallvector.hh"
+#include "sizeclasspool.hh"
+#include "flattownmap.hh"
 
-// Types for IDs
-using TownID = std::string;
+
+// Types for IDs, TownID is in townid.hh
 using Name = std::string;
 
 // Return values for cases where required thing was not found
@@ -101,6 +112,7 @@ private:
 
 //forward declare
 struct Town;
+class MappedRealm;
 
 struct Road
 {
@@ -108,45 +120,103 @@ struct Road
     Distance length{};
 };
 
-struct RoadHasher
-{
-    //hash based off the town pointer
-    size_t operator()(const Road& road) const
-    {
-        return std::hash<Town*>()(road.town);
-    }
-};
+// vassals and roads a town can have without allocating memory for them
+constexpr std::size_t TOWN_INLINE_VASSALS = 4;
+constexpr std::size_t TOWN_INLINE_ROADS = 4;
+
+// position of each road in a town's roads_to by the town it leads to
+using RoadIndex = std::unordered_map<const Town*, std::uint32_t>;
 
-struct RoadComparator
-{
-    //compare based off town pointers
-    bool operator()(const Road& first, const Road& second) const
-    {
-        return first.town == second.town;
-    }
-};
 
 // a struct to represnt a town and its data
 struct Town
 {
     TownID id{};
-    Name name{};
+    NameHandle name{}; //the characters are in Datastructures' names_
     Coord coord{};
     Distance distance_from_origin{};
     int tax{};
     Town* master{};
-    std::vector<Town*> vassals{};
-    std::unordered_set<Road, RoadHasher, RoadComparator> roads_to{};
 
-    //fields for graph algorims
+    //most towns have only a few vassals and roads, which are then stored in the town itself
+    SmallVector<Town*, TOWN_INLINE_VASSALS> vassals{};
+    SmallVector<Road, TOWN_INLINE_ROADS> roads_to{};
+
+    //once a town has more roads than fit inline, they are also indexed by the town they lead to,
+    //so that finding and removing a road of a town with many roads stays constant on average
+    std::unique_ptr<RoadIndex> road_index{};
+
+    //position of the town in Datastructures' towns_by_index_,
+    //graph algorithms keep their per-town state in vectors indexed by this
+    std::size_t index{};
+};
+
+// the state of a single town during a graph search
+// kept outside of the towns, so that searches don't modify the database
+// and several searches can run at the same time
+struct SearchState
+{
     bool processed{};
-    Town* prev_town{};
-    Distance distance{};
-    Distance distance_estimate{};
+    const Town* prev_town{};
+    Distance distance{ MAX_VALUE };
+    Distance distance_estimate{ MAX_VALUE };
 };
 
-//typedef for the main database that holds all the data about towns
-using Database = std::unordered_map<TownID, Town>;
+using SearchStates = std::vector<SearchState>;
+
+//typedef for the main database that holds all the data about towns,
+//its elements are allocated from Datastructures' town_pool_
+using Database = FlatTownMap<Town>;
+
+// the data of a single town for inserting many towns at once
+struct TownSpec
+{
+    TownID id{};
+    Name name{};
+    Coord coord{};
+    int tax{};
+};
+
+// the data of a single town from get_town_info(), the name is a view into the database
+// that is valid until the database is changed
+struct TownInfo
+{
+    std::string_view name{ NO_NAME };
+    Coord coord{ NO_COORD };
+    int tax{ NO_VALUE };
+};
+
+// a town in the lists returned by the *_view() functions: the id and the town's data as views
+// into the database instead of copies, valid until the database is changed
+struct TownView
+{
+    std::string_view id{};
+    TownInfo info{};
+};
+
+using TownViews = std::vector<TownView>;
+using RoadViews = std::vector<std::pair<TownView, TownView>>;
+
+// a page from the *_after() functions, and the cursor that gives the page after it,
+// which is empty after the last page
+struct TownPage
+{
+    TownViews towns{};
+    std::string next{};
+};
+
+struct RoadPage
+{
+    RoadViews roads{};
+    std::string next{};
+};
+
+// memory taken by the names of the towns, in bytes
+struct NameMemory
+{
+    std::size_t arena{};   // the NameArena and the handles in the towns
+    std::size_t strings{}; // estimate for the same names as a std::string in each town
+};
 
 
 class Datastructures
@@ -164,7 +234,7 @@ public:
     // Short rationale for estimate:
     // The containers size (number of elements) is tracked during its use,
     // no extra calculations are needed to retrieve its size.
-    unsigned int town_count();
+    unsigned int town_count() const;
 
     // Estimate of performance: Theta(n), where n is the number of elements in the database
     // Short rationale for estimate:
@@ -175,43 +245,54 @@ public:
     // Short rationale for estimate:
     // The documentation states that inserting to an
     // unordered map is linear in the worst case, but in the average case constant
-    bool add_town(TownID id, Name const& name, Coord coord, int tax);
+    bool add_town(TownID const& id, Name const& name, Coord coord, int tax);
 
     // Estimate of performance: O(n), Omega(1), where n is the container size
     // Short rationale for estimate:
     // The documentation states that finding from an
     // unordered map is linear in the worst case, but in the average case constant
-    Name get_town_name(TownID id);
+    Name get_town_name(TownID const& id) const;
 
     // Estimate of performance: O(n), Omega(1), where n is the container size
     // Short rationale for estimate:
     // The documentation states that finding from an
     // unordered map is linear in the worst case, but in the average case constant
-    Coord get_town_coordinates(TownID id);
+    Coord get_town_coordinates(TownID const& id) const;
 
     // Estimate of performance: O(n), Omega(1), where n is the container size
     // Short rationale for estimate:
     // The documentation states that finding from an
     // unordered map is linear in the worst case, but in the average case constant
-    int get_town_tax(TownID id);
+    int get_town_tax(TownID const& id) const;
+
+    // Estimate of performance: O(n), Omega(1), where n is the container size
+    // Short rationale for estimate:
+    // The same single lookup as in the three functions above gives all of them,
+    // and the name isn't copied. The fields are NO_NAME, NO_COORD and NO_VALUE if there's no such town.
+    TownInfo get_town_info(TownID const& id) const;
+
+    // Estimate of performance: O(nk), Omega(k), where k is the number of ids
+    // Short rationale for estimate:
+    // One lookup per id, into a vector that is allocated once
+    std::vector<TownInfo> get_towns_info(std::vector<TownID> const& ids) const;
 
     // Estimate of performance: Theta(n), where n is the number of elements in the database
     // Short rationale for estimate:
     // std::transform performs exactly the container's number of elements amount of specified operations
     // and back inserting to a vector is constant in time.
-    std::vector<TownID> all_towns();
+    std::vector<TownID> all_towns() const;
 
     // Estimate of performance: Theta(n), where n is the number of elements in the database
     // Short rationale for estimate:
     // The for-loop has to go through each element in the database 
     // and back inserting to a vector is constant in time.
-    std::vector<TownID> find_towns(Name const& name);
+    std::vector<TownID> find_towns(Name const& name) const;
 
     // Estimate of performance: O(n), Omega(1), where n is the container size
     // Short rationale for estimate:
     // The documentation states that finding from an
     // unordered map is linear in the worst case, but in the average case constant
-    bool change_town_name(TownID id, Name const& newname);
+    bool change_town_name(TownID const& id, Name const& newname);
 
     // Estimate of performance: Theta(nlog(n)), where n is the number of elements in the database
     // Short rationale for estimate:
@@ -221,44 +302,44 @@ public:
     // comparisons, where n is the amount of elements in the vector (the size of the database)
     // the comparisons are also constant in time in this case
     // nlog(n) is worse than n, so it's the asymptotic performance
-    std::vector<TownID> towns_alphabetically();
+    std::vector<TownID> towns_alphabetically() const;
 
-    // Estimate of performance: Theta(nlog(n)), where n is the number of elements in the database
+    // Estimate of performance: O(nlog(n)), Omega(n), where n is the number of elements in the database
     // Short rationale for estimate:
     // std::transform performs exactly the container's number of elements amount of specified operations
     // and back inserting to a vector is constant in time.
-    // According to the documentation, std::sorting the vector is performs nlog(n) amount of
-    // comparisons, where n is the amount of elements in the vector (the size of the database)
-    // The comparisons are also constant in time in this case.
-    // nlog(n) is worse than n, so it's the asymptotic performance
-    std::vector<TownID> towns_distance_increasing();
+    // The radix sort makes at most 4 linear passes over the distances. Only towns with equal
+    // distances are then compared by id, which is nlog(n) only if most of the distances are equal.
+    std::vector<TownID> towns_distance_increasing() const;
 
     // Estimate of performance: Theta(n), where n is the number of elements in the database
     // Short rationale for estimate:
     // According to the documentation, std::min_element performs exactly max(n-1, 0) amount
     // of comparisons, there n is the amount of elements in the container.
-    // The comparisons are constant in time in this case.
-    TownID min_distance();
+    // The comparisons are constant in time in this case, only towns at the same distance compare ids.
+    // Ties are broken by id, so the result is the first town of towns_distance_increasing().
+    TownID min_distance() const;
 
     // Estimate of performance: Theta(n), where n is the number of elements in the database
     // Short rationale for estimate:
     // According to the documentation, std::max_element performs exactly max(n-1, 0) amount
     // of comparisons, there n is the amount of elements in the container.
-    // The comparisons are constant in time in this case.
-    TownID max_distance();
+    // The comparisons are constant in time in this case, only towns at the same distance compare ids.
+    // Ties are broken by id, so the result is the last town of towns_distance_increasing().
+    TownID max_distance() const;
 
     // Estimate of performance: O(n), Omega(1), where n is the container size
     // Short rationale for estimate:
     // The documentation states that finding from an
     // unordered map is linear in the worst case, but in the average case constant.
     // Back inserting to vector is constant in time.
-    bool add_vassalship(TownID vassalid, TownID masterid);
+    bool add_vassalship(TownID const& vassalid, TownID const& masterid);
 
     // Estimate of performance: Theta(n)
     // Short rationale for estimate:
     // std::transform performs exactly the container's number of elements amount of specified operations
     // and back inserting to a vector is constant in time.
-    std::vector<TownID> get_town_vassals(TownID id);
+    std::vector<TownID> get_town_vassals(TownID const& id) const;
 
     // Estimate of performance: O(n), Omega(1), where n is the number of elements in the database.
     // Short rationale for estimate:
@@ -269,7 +350,7 @@ public:
     // where n is the number of elements in the database.
     // In the best case finding from the database is constant and the town doesn't have masters.
     // The average case is somewhere in-between and likely closer to constant than linear.
-    std::vector<TownID> taxer_path(TownID id);
+    std::vector<TownID> taxer_path(TownID const& id) const;
 
     // Non-compulsory phase 1 operations
 
@@ -283,17 +364,15 @@ public:
     // Also the for-loop can in the worst case run n times, and in the best case not run at all
     // In all of these n is the number of elements in the database.
     // The average case is somewhere in-between.
-    bool remove_town(TownID id);
+    bool remove_town(TownID const& id);
 
-    // Estimate of performance: Theta(nlog(n)), where n is the number of elements in the database
+    // Estimate of performance: O(nlog(n)), Omega(n), where n is the number of elements in the database
     // Short rationale for estimate:
     // std::transform performs exactly the container's number of elements amount of specified operations
     // and back inserting to a vector is constant in time.
-    // According to the documentation, std::sorting the vector is performs nlog(n) amount of
-    // comparisons, where n is the amount of elements in the vector (the size of the database)
-    // The comparisons are also constant in time in this case.
-    // nlog(n) is worse than n, so it's the asymptotic performance.
-    std::vector<TownID> towns_nearest(Coord coord);
+    // The radix sort makes at most 4 linear passes over the distances. Only towns with equal
+    // distances are then compared by id, which is nlog(n) only if most of the distances are equal.
+    std::vector<TownID> towns_nearest(Coord coord) const;
 
     // Estimate of performance: O(n), Omega(1) where n is the number of elements in the database 
     // Short rationale for estimate:
@@ -303,7 +382,7 @@ public:
     // In the worse case it can be each of towns in the database,
     // and in the best cast the requested town doesn't have vassals.
     // The average case is somewhere in-between.
-    std::vector<TownID> longest_vassal_path(TownID id);
+    std::vector<TownID> longest_vassal_path(TownID const& id) const;
 
     // Estimate of performance: O(n), Omega(1) where n is the number of elements in the database 
     // Short rationale for estimate:
@@ -313,7 +392,7 @@ public:
     // In the worse case it can be each of towns in the database,
     // and in the best cast the requested town doesn't have vassals.
     // The average case is somewhere in-between.
-    int total_net_tax(TownID id);
+    int total_net_tax(TownID const& id) const;
 
 
     // Phase 2 operations
@@ -328,18 +407,16 @@ public:
     // Estimate of performance: Theta(1)
     // Short rationale for estimate:
     // All the work is already done in add_road, only need to return 
-    std::vector<std::pair<TownID, TownID>> all_roads();
+    std::vector<std::pair<TownID, TownID>> all_roads() const;
 
-    // Estimate of performance: O(n), Omega(1), where n is the number is the number of towns in the database
+    // Estimate of performance: O(n), Theta(1), where n is the number is the number of towns in the database
     // Short rationale for estimate:
     // The documentation states that finding from an
     // unordered map is linear in the worst case, but in the average case constant.
-    // std::find_if needs to check each road in the worst case, and in the best case only one road.
-    // Also, even in the worst case, a single town can't have more roads than there are total towns.
-    // The documentation states that inserting to a unordered_set is linear in the worst case,
-    // but in the average case constant.
-    // Pushing back to a vector is constant.
-    bool add_road(TownID town1_id, TownID town2_id);
+    // Checking whether the road exists scans town1's few inline roads, or looks the road up from its
+    // road index once it has more, which is also constant on average and linear in the worst case.
+    // Pushing back to the towns' small vectors of roads and to the list of all roads is constant amortized.
+    bool add_road(TownID const& town1_id, TownID const& town2_id);
 
     // Estimate of performance: O(n), where n is the number is the number of towns in the database
     // Short rationale for estimate:
@@ -347,12 +424,12 @@ public:
     // unordered map is linear in the worst case, but in the average case constant.
     // std::transform goes through each road the town has, and even in the worst case a single town can't
     // have more roads than there are total towns.
-    std::vector<TownID> get_roads_from(TownID id);
+    std::vector<TownID> get_roads_from(TownID const& id) const;
 
     // Estimate of performance: O(n+k), where where n is the number is the number of towns and k is the number of roads in the database
     // Short rationale for estimate:
     // See the performance estimate for least_towns_route().
-    std::vector<TownID> any_route(TownID fromid, TownID toid);
+    std::vector<TownID> any_route(TownID const& fromid, TownID const& toid) const;
 
     // Non-compulsory phase 2 operations
 
@@ -360,12 +437,10 @@ public:
     // Short rationale for estimate:
     // The documentation states that finding from an
     // unordered map is linear in the worst case, but in the average case constant.
-    // std::find_if goes though a town's roads, in the worst case it needs to go through all of them.
-    // and even in the worst case a single town can't have more roads than there are total towns or roads.
-    // Vector erases may need to move elements. In the worst case all of the elements, and in the best case none.
-    // But if the vector doesn't need to move any elements, find_if needed to go to the very last element, so this is
-    // still linear.
-    bool remove_road(TownID town1_id, TownID town2_id);
+    // Finding and erasing the road from the towns' roads is constant on average: a town with only inline roads
+    // has at most a few, and a town with more looks the road up from its road index and moves its last road in its place.
+    // Erasing the road from the list of all roads needs std::find_if, which is linear in the number of roads.
+    bool remove_road(TownID const& town1_id, TownID const& town2_id);
 
     // Estimate of performance: O(n+k), where where n is the number is the number of towns and k is the number of roads in the database
     // Short rationale for estimate:
@@ -376,7 +451,7 @@ public:
     // Inside the while loop popping from the deque is constant, according to the documentation,
     // and inside the for loop in the worst case we need to process every single road of every single town.
     // And pushing back to the deque is constant, according to the documentation.
-    std::vector<TownID> least_towns_route(TownID fromid, TownID toid);
+    std::vector<TownID> least_towns_route(TownID const& fromid, TownID const& toid) const;
 
     // Estimate of performance: O(n+k), where where n is the number is the number of towns and k is the number of roads in the database
     // Short rationale for estimate:
@@ -387,7 +462,7 @@ public:
     // Inside the while loop popping from the stack is constant, according to the documentation,
     // and inside the for loop in the worst case we need to process every single road of every single town.
     // And pushing back to the stack is constant, according to the documentation.
-    std::vector<TownID> road_cycle_route(TownID startid);
+    std::vector<TownID> road_cycle_route(TownID const& startid) const;
 
     // Estimate of performance: O((n+k)log(n)), where where n is the number is the number of towns and k is the number of roads in the database
     // Short rationale for estimate:
@@ -398,17 +473,14 @@ public:
     // Inside the while loop .top() and .pop() on the priority queue are constant, according to the documentation,
     // and inside the for loop in the worst case we need to process every single road of every single town.
     // And pushing to the priority queue is performs log(n) amount of comparisons, according to the documentation.
-    std::vector<TownID> shortest_route(TownID fromid, TownID toid);
+    std::vector<TownID> shortest_route(TownID const& fromid, TownID const& toid) const;
 
     // Estimate of performance: O(n*max(n,k)*n), Omega(max(n,k)), where where n is the number is the number of towns and k is the number of roads in the database
     // Short rationale for estimate:
     // When preparing the all_roads container, we need to loop through each town's each road
-    // and inserting to the all_roads set is logarithmic in size. Erasing from town's roads_to vector is linear in the
-    // worst case, and in the worst case the town is connected to all other towns. Linear is worse than logarithmic, so we get n*k*n.
-    // However, in practise it's pretty much impossible to get such bad performance, the loop gets better all the time as we process more data
-    // and the data that would give n*k*n in the beginning would have to be very specially constructed, if such data is even possible.
-    // In the best case there are no roads, or the data is constructed so, that we find everything on first try and erase from the
-    // vector's end. Then the finds and erases are constant.
+    // and inserting to the all_roads set is logarithmic in size. Erasing the road from the other town's roads is constant
+    // on average (see remove_road()) and linear in the worst case of the road index, in which the town is connected to all
+    // other towns, so we get n*k*n. In practise the erases are constant.
     // For the Kruskal algorithm:
     // In the worst case we loop through each road in the database .
     // Inside the loop we perform insert() or find() operations, which are linear in
@@ -421,13 +493,250 @@ public:
     // Then we get Omega(k) for the Kurskal algorithm.
     Distance trim_road_network();
 
+
+    // Batch operations
+    // These are meant for loading large amounts of data at once, e.g. when starting up.
+    // The result is the same as when adding each element one by one with the single element
+    // operations above, in the same order, but space is reserved once for the whole batch.
+
+    // Estimate of performance: O(k*n), Omega(k), where k is the number of towns in the batch
+    // and n is the number of towns in the database
+    // Short rationale for estimate:
+    // Space for the whole batch is reserved once, so the database is rehashed at most once.
+    // After that each insertion is constant on average and linear in the worst case.
+    // Returns the number of towns that were added.
+    unsigned int add_towns(std::vector<TownSpec> const& towns);
+
+    // Estimate of performance: O(k*n), Omega(k), where k is the number of vassalships in the batch
+    // and n is the number of towns in the database
+    // Short rationale for estimate:
+    // Each (vassal, master) pair is added like in add_vassalship().
+    // Returns the number of vassalships that were added.
+    unsigned int add_vassalships(std::vector<std::pair<TownID, TownID>> const& vassalships);
+
+    // Estimate of performance: O(k*n), Omega(k), where k is the number of roads in the batch
+    // and n is the number of towns in the database
+    // Short rationale for estimate:
+    // The list of all roads is reserved for once. For each road finding the towns is constant
+    // on average and linear in the worst case, and so is checking the town's roads for the road
+    // (a scan of the few inline roads, or a lookup from the town's road index once it has more),
+    // because a town can have at most n-1 roads. Adding the road to the towns is constant amortized.
+    // Returns the number of roads that were added.
+    unsigned int add_roads(std::vector<std::pair<TownID, TownID>> const& roads);
+
+
+    // Views
+    // The same lists as the functions above return, with each town's id, name, coordinates and
+    // tax as a TownView into the database instead of a copy of the id. The views are valid until
+    // the database is changed, so they are meant for printing or otherwise using the result at once,
+    // without copying the ids and then looking each town up again.
+
+    // Estimate of performance: the same as for the function of the same name without _view
+    // Short rationale for estimate:
+    // The same algorithms, only the towns at the end are turned into views instead of ids.
+    // all_roads_view() looks up both towns of each road, which is constant on average.
+    TownViews all_towns_view() const;
+    TownViews towns_alphabetically_view() const;
+    TownViews taxer_path_view(TownID const& id) const;
+    RoadViews all_roads_view() const;
+    TownViews get_roads_from_view(TownID const& id) const;
+    TownViews any_route_view(TownID const& fromid, TownID const& toid) const;
+    TownViews least_towns_route_view(TownID const& fromid, TownID const& toid) const;
+    TownViews road_cycle_route_view(TownID const& startid) const;
+    TownViews shortest_route_view(TownID const& fromid, TownID const& toid) const;
+
+
+    // Pages
+    // Parts of the lists of towns_alphabetically(), towns_distance_increasing() and all_roads()
+    // (roads ordered by their towns' ids), as views like above. The *_page() functions give the
+    // limit elements from offset on. The *_after() functions give the limit elements after the
+    // cursor of the previous page, "" for the first page. A cursor is the sort key of the last
+    // element of its page, so the next page continues from the right place even if the database
+    // has changed in between. An invalid cursor gives a page of a single NO_TOWNID town.
+    // The pages come from ordered indexes, which are built when a page is first asked for after
+    // a change, so the first page after a change costs as much as the whole list.
+
+    // Estimate of performance: Theta(p) when the index is up to date, where p is the page size,
+    // otherwise like for the whole list
+    // Short rationale for estimate:
+    // The page is copied from the ordered index starting at offset
+    TownViews towns_alphabetically_page(std::size_t offset, std::size_t limit) const;
+    TownViews towns_distance_increasing_page(std::size_t offset, std::size_t limit) const;
+    RoadViews all_roads_page(std::size_t offset, std::size_t limit) const;
+
+    // Estimate of performance: O(log(n)+p) when the index is up to date, where p is the page size,
+    // otherwise like for the whole list
+    // Short rationale for estimate:
+    // The position after the cursor is binary searched from the ordered index
+    TownPage towns_alphabetically_after(std::string const& cursor, std::size_t limit) const;
+    TownPage towns_distance_increasing_after(std::string const& cursor, std::size_t limit) const;
+    RoadPage all_roads_after(std::string const& cursor, std::size_t limit) const;
+
+
+    // Sorting settings
+
+    // Estimate of performance: O(t), where t is the number of threads
+    // Short rationale for estimate:
+    // The old sorting threads are stopped and the new ones started.
+    // towns_alphabetically() sorts with this many threads,
+    // 1 (the default) sorts with std::sort in the calling thread.
+    void set_sort_threads(unsigned int threads);
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The number is stored in the thread pool
+    unsigned int sort_threads() const;
+
+    // Read-only mapped mode
+    // The database can be replaced with a realm file saved by RealmFile::save(), which is then
+    // memory mapped and queried in place (see MappedRealm), instead of being loaded into memory.
+    // While a file is mapped, every operation that would change the database fails
+    // (returns false, 0 or NO_DISTANCE), except clear_all(), which closes the file.
+
+    // Estimate of performance: Theta(1), or Theta(n+k) with check_contents, where n is the
+    // number of towns and k the number of roads in the file
+    // Short rationale for estimate:
+    // Only the file's header is read, unless check_contents is given. Clearing the database in
+    // memory is linear in its size. Returns false and the reason in error if the file couldn't
+    // be mapped or isn't valid, in which case the database is left unchanged.
+    bool open_mapped(std::string const& filename, bool check_contents, std::string& error);
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The file is unmapped, and the database is left empty
+    void close_mapped();
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // Only checks whether a file is mapped
+    bool is_mapped() const;
+
+    // Mutation log
+    // While the log is open, every successful change is appended to a write-ahead log in a
+    // directory (see MutationLog), with a checkpoint of the whole database every
+    // settings.checkpoint_interval changes. Opening the log again recovers the database.
+
+    // Estimate of performance: O(n+k+m), where n and k are the number of towns and roads
+    // in the latest checkpoint and m the number of changes logged after it
+    // Short rationale for estimate:
+    // The checkpoint is loaded and only the changes after it are replayed.
+    // Replaces the database with the recovered one. Returns false and the reason in error if
+    // the directory couldn't be recovered, in which case the database holds what could be.
+    bool open_log(std::string const& directory, MutationLogSettings const& settings, std::string& error);
+
+    // Estimate of performance: Theta(g), where g is the size of the unwritten group of changes
+    // Short rationale for estimate:
+    // The last group is written and synced. Returns false and the reason in error if
+    // a write to the log has failed since it was opened.
+    bool close_log(std::string& error);
+
+    // Estimate of performance: O(n+k)
+    // Short rationale for estimate:
+    // The whole database is saved with RealmFile::save()
+    bool checkpoint(std::string& error);
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The log is stored, nullptr when it isn't open
+    const MutationLog* mutation_log() const;
+
+    // Estimate of performance: Theta(n)
+    // Short rationale for estimate:
+    // The std::string estimate needs the length of every name.
+    // Heap blocks are estimated with the overhead and rounding of glibc's malloc.
+    NameMemory name_memory() const;
+
+    // RealmFile saves and loads the whole database in binary
+    friend class RealmFile;
+
 private:
+    // the nodes of database_, declared first so that it's destroyed last
+    SizeClassPool town_pool_{};
+
     // database to hold all information about towns
-    Database database_{};
+    Database database_{ Database::allocator_type{ &town_pool_ } };
 
     // list of all roads currently in the database
     std::vector<std::pair<TownID, TownID>> roads_{};
 
+    // the names of the towns, compacted when change_town_name() and remove_town() have left
+    // more garbage in it than there are names
+    NameArena names_{};
+
+    // every town in the database in no particular order, Town::index is the town's position here
+    std::vector<Town*> towns_by_index_{};
+
+    // coordinates of the towns in the same order as towns_by_index_, in columns so that
+    // distances to all the towns can be calculated with coord_distances() at once
+    std::vector<int> town_xs_{};
+    std::vector<int> town_ys_{};
+
+    // the mapped realm file when in read-only mapped mode, all queries go to it
+    std::unique_ptr<MappedRealm> mapped_{};
+
+    // the write-ahead log of the changes when it's open
+    std::unique_ptr<MutationLog> log_{};
+
+    // number of changes to the database, the ordered indexes are rebuilt when it has changed
+    std::uint64_t changes_ = 0;
+
+    // an ordered index of the page functions and changes_ when it was built
+    template <typename Entry>
+    struct OrderedIndex
+    {
+        std::vector<Entry> entries{};
+        std::uint64_t changes = std::numeric_limits<std::uint64_t>::max();
+    };
+
+    // the indexes are built by the first page function that needs them, which holds page_mutex_
+    mutable std::mutex page_mutex_{};
+    mutable OrderedIndex<TownView> alphabetical_index_{};
+    mutable OrderedIndex<std::pair<Distance, TownView>> distance_index_{};
+    mutable OrderedIndex<std::pair<TownView, TownView>> road_index_{};
+
+    // threads for sorting, only used by one query at a time, others sort in their own thread meanwhile
+    std::unique_ptr<ThreadPool> sort_pool_{};
+    mutable std::mutex sort_mutex_{};
+
+    // helper functions that give the lists both as ids and as views, Element is TownID or TownView
+    template <typename Element>
+    Element town_as(const Town* town) const;
+    template <typename Element>
+    std::vector<Element> all_towns_as() const;
+    template <typename Element>
+    std::vector<Element> towns_alphabetically_as() const;
+    template <typename Element>
+    std::vector<Element> taxer_path_as(TownID const& id) const;
+    template <typename Element>
+    std::vector<Element> get_roads_from_as(TownID const& id) const;
+    template <typename Element>
+    std::vector<Element> least_towns_route_as(TownID const& fromid, TownID const& toid) const;
+    template <typename Element>
+    std::vector<Element> road_cycle_route_as(TownID const& startid) const;
+    template <typename Element>
+    std::vector<Element> shortest_route_as(TownID const& fromid, TownID const& toid) const;
+
+    // helper function for the ordered queries, sorts with sort_pool_ when it's free
+    template <typename Type, typename Less>
+    void sort_towns(std::vector<Type>& towns, Less less) const;
+
+    // helper functions to rebuild the ordered indexes if the database has changed, page_mutex_ must be held
+    const std::vector<TownView>& alphabetical_index() const;
+    const std::vector<std::pair<Distance, TownView>>& distance_index() const;
+    const std::vector<std::pair<TownView, TownView>>& road_index() const;
+
+    // helper functions to count a successful change, append it to log_ and write a checkpoint when it's due
+    void log_mutation(MutationType type, std::initializer_list<std::string_view> strings,
+                      std::initializer_list<std::int64_t> numbers = {});
+    void checkpoint_log();
+
+    // helper function to copy the names to a new arena without the garbage
+    void compact_names();
+
+    // helper functions to keep towns_by_index_ up to date
+    void index_town(Town* town);
+    void unindex_town(const Town* town);
+
     // helper function to calculate distance between a town and a coordinate
     // coordinate defaults to (0,0)
     [[nodiscard]] static Distance get_distance_from_coord(const Coord& town_location, const Coord& coord = { 0, 0 });
@@ -435,6 +744,13 @@ private:
     // helper function to transfer a list of vassals to a new master town
     static void transfer_vassals(const Town* current_master, Town* new_master);
 
+    // helper functions for a town's roads, which use the town's road index when it has one:
+    // constant on average, and constant for a town with only inline roads
+    static Road* find_road(Town* town, const Town* to);
+    static void insert_road(Town* town, Road road);
+    static void erase_road(Town* town, const Town* to);
+    static void clear_town_roads(Town* town);
+
     // dfs recursive algorithm to get the longest vassal path for a town
     static size_t recursive_vassal_path(const Town* town, std::vector<TownID>& current_path, std::vector<TownID>& longest_path);
 
@@ -442,10 +758,11 @@ private:
     static int recursive_net_tax(const Town* town);
 
     // helper function for graph algorithms to construct the path that was traversed
-    [[nodiscard]] static std::vector<TownID> construct_town_path(const Town* last_town);
+    template <typename Element>
+    [[nodiscard]] std::vector<Element> construct_town_path(const Town* last_town, const SearchStates& states) const;
 
     // helper function for A* algorithm
-    static void relax_a(Town* town, const Road* road);
+    static void relax_a(const Town* town, const Road* road, SearchStates& states);
 };
 
 #endif // DATASTRUCTURES_HH
@@ -0,0 +1,112 @@
+// Distancekernel.cc
+
+#include "distancekernel.hh"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DISTANCEKERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// Below this squared distance the double computation is exact: the square fits in the 53 bits
+// of a double, and its square root is never rounded up to the next integer
+constexpr double EXACT_DOUBLE_LIMIT = static_cast<double>(std::int64_t{1} << 50);
+
+// The slow path for coordinates far apart, only uses integers after the first guess
+Distance exact_distance(std::int64_t dx, std::int64_t dy)
+{
+    //a difference of 2^31 or more alone makes the distance too long for Distance
+    dx = std::llabs(dx);
+    dy = std::llabs(dy);
+    constexpr std::int64_t limit = std::int64_t{1} << 31;
+    if (dx >= limit || dy >= limit)
+        return MAX_VALUE;
+
+    //both squares are under 2^62, so the sum fits in 64 bits
+    const auto square = static_cast<std::uint64_t>(dx * dx) + static_cast<std::uint64_t>(dy * dy);
+    auto root = static_cast<std::uint64_t>(std::sqrt(static_cast<double>(square)));
+    while (root * root > square)
+        --root;
+    while ((root + 1) * (root + 1) <= square)
+        ++root;
+    return root > static_cast<std::uint64_t>(MAX_VALUE) ? MAX_VALUE : static_cast<Distance>(root);
+}
+
+void scalar_distances(Coord point, const int* xs, const int* ys, std::size_t count, Distance* out)
+{
+    for (std::size_t i = 0; i < count; ++i)
+        out[i] = coord_distance(point, { xs[i], ys[i] });
+}
+
+#ifdef DISTANCEKERNEL_AVX2
+__attribute__((target("avx2")))
+void avx2_distances(Coord point, const int* xs, const int* ys, std::size_t count, Distance* out)
+{
+    const auto px = _mm256_set1_pd(point.x);
+    const auto py = _mm256_set1_pd(point.y);
+    const auto limit = _mm256_set1_pd(EXACT_DOUBLE_LIMIT);
+
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        //the differences of two ints are exact in double, so are the squares below the limit
+        const auto dx = _mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + i))), px);
+        const auto dy = _mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ys + i))), py);
+        const auto square = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        if (_mm256_movemask_pd(_mm256_cmp_pd(square, limit, _CMP_GE_OQ)) != 0)
+        {
+            scalar_distances(point, xs + i, ys + i, 4, out + i);
+            continue;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvttpd_epi32(_mm256_sqrt_pd(square)));
+    }
+    scalar_distances(point, xs + i, ys + i, count - i, out + i);
+}
+
+bool has_avx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#else
+bool has_avx2()
+{
+    return false;
+}
+#endif
+
+}
+
+Distance coord_distance(Coord c1, Coord c2)
+{
+    const auto dx = static_cast<std::int64_t>(c2.x) - c1.x;
+    const auto dy = static_cast<std::int64_t>(c2.y) - c1.y;
+    const auto square = static_cast<double>(dx) * dx + static_cast<double>(dy) * dy;
+    if (square >= EXACT_DOUBLE_LIMIT)
+        return exact_distance(dx, dy);
+    //cast to int to floor efficiently
+    return static_cast<Distance>(std::sqrt(square));
+}
+
+void coord_distances(Coord point, const int* xs, const int* ys, std::size_t count, Distance* out)
+{
+#ifdef DISTANCEKERNEL_AVX2
+    if (has_avx2())
+    {
+        avx2_distances(point, xs, ys, count, out);
+        return;
+    }
+#endif
+    scalar_distances(point, xs, ys, count, out);
+}
+
+const char* distance_kernel_name()
+{
+    return has_avx2() ? "avx2" : "scalar";
+}
@@ -0,0 +1,24 @@
+// Distancekernel.hh
+//
+// Floored Euclidean distances between coordinates, one at a time or for a whole column
+
+#ifndef DISTANCEKERNEL_HH
+#define DISTANCEKERNEL_HH
+
+#include "datastructures.hh"
+
+#include <cstddef>
+
+// Floored Euclidean distance between two coordinates. The differences and squares are
+// computed in 64 bits, so any int coordinates work. Distances that don't fit in Distance
+// are clamped to MAX_VALUE.
+Distance coord_distance(Coord c1, Coord c2);
+
+// out[i] = coord_distance(point, {xs[i], ys[i]}) for each i in [0, count).
+// Uses AVX2 when the processor supports it, otherwise the same computation one coordinate at a time.
+void coord_distances(Coord point, const int* xs, const int* ys, std::size_t count, Distance* out);
+
+// Name of the kernel coord_distances() uses on this processor, "avx2" or "scalar"
+const char* distance_kernel_name();
+
+#endif // DISTANCEKERNEL_HH
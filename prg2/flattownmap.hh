@@ -0,0 +1,354 @@
+// Flattownmap.hh
+//
+// Open addressing hash table keyed by TownID, used as the id index of the town database.
+// The slots are in one flat array and hold the id's hash next to a pointer to the element,
+// so a lookup usually touches one or two cache lines of slots and then the element itself.
+
+#ifndef FLATTOWNMAP_HH
+#define FLATTOWNMAP_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "sizeclasspool.hh"
+#include "townid.hh"
+
+// Robin Hood hashing with linear probing: an element that is further from its home slot takes
+// the place of one that is closer to its own, which keeps the probe sequences short, lets a
+// lookup stop as soon as it sees an element closer to home than the key would be, and lets
+// erase shift the following elements back instead of leaving tombstones.
+//
+// The elements are allocated one by one from a SizeClassPool and never move, so pointers and
+// references to them stay valid until they are erased, like in std::unordered_map. Iterators
+// are invalidated by inserting and erasing.
+template <typename Value>
+class FlatTownMap
+{
+public:
+    using key_type = TownID;
+    using mapped_type = Value;
+    using value_type = std::pair<const TownID, Value>;
+    using size_type = std::size_t;
+
+    // the table grows when more than 7/8 of the slots are in use
+    static constexpr std::size_t MAX_LOAD_NUMERATOR = 7;
+    static constexpr std::size_t MAX_LOAD_DENOMINATOR = 8;
+    static constexpr std::size_t MIN_CAPACITY = 16;
+
+private:
+    struct Slot
+    {
+        value_type* element;
+        // low bits of the id's hash, so that most other ids are skipped without following the pointer
+        std::uint32_t hash_bits;
+        // 0 for an empty slot, otherwise the distance from the element's home slot plus one
+        std::uint32_t distance;
+    };
+
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename FlatTownMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, value_type const&, value_type&>;
+        using pointer = std::conditional_t<Const, value_type const*, value_type*>;
+
+        Iterator() = default;
+        // iterator converts to const_iterator
+        template <bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+        Iterator(Iterator<OtherConst> const& other) : slot_(other.slot_), end_(other.end_) {}
+
+        reference operator*() const { return *slot_->element; }
+        pointer operator->() const { return slot_->element; }
+
+        Iterator& operator++()
+        {
+            ++slot_;
+            skip_empty();
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        friend bool operator==(Iterator const& it1, Iterator const& it2) { return it1.slot_ == it2.slot_; }
+        friend bool operator!=(Iterator const& it1, Iterator const& it2) { return it1.slot_ != it2.slot_; }
+
+    private:
+        friend class FlatTownMap;
+        template <bool> friend class Iterator;
+
+        Iterator(Slot const* slot, Slot const* end) : slot_(slot), end_(end) {}
+
+        void skip_empty()
+        {
+            while (slot_ != end_ && slot_->distance == 0) { ++slot_; }
+        }
+
+        Slot const* slot_ = nullptr;
+        Slot const* end_ = nullptr;
+    };
+
+public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using allocator_type = PoolAllocator<value_type>;
+
+    explicit FlatTownMap(allocator_type const& allocator) : allocator_(allocator) {}
+    ~FlatTownMap() { destroy_elements(); }
+
+    FlatTownMap(FlatTownMap const&) = delete;
+    FlatTownMap& operator=(FlatTownMap const&) = delete;
+
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+    [[nodiscard]] std::size_t bucket_count() const noexcept { return capacity_; }
+
+    iterator begin() noexcept { return make_iterator(slots_.get()); }
+    iterator end() noexcept { return { slots_end(), slots_end() }; }
+    const_iterator begin() const noexcept { return make_iterator(slots_.get()); }
+    const_iterator end() const noexcept { return { slots_end(), slots_end() }; }
+
+    // Estimate of performance: Theta(1) on average, O(n) in the worst case
+    // Short rationale for estimate:
+    // The probe sequence from the id's home slot is short on average, because the table is
+    // at most 7/8 full and Robin Hood hashing evens out the distances. The id is compared to
+    // an element only when the hash bits in its slot match.
+    iterator find(TownID const& id) noexcept
+    {
+        const auto slot = find_slot(id);
+        return slot ? iterator{ slot, slots_end() } : end();
+    }
+    const_iterator find(TownID const& id) const noexcept
+    {
+        const auto slot = find_slot(id);
+        return slot ? const_iterator{ slot, slots_end() } : end();
+    }
+
+    [[nodiscard]] std::size_t count(TownID const& id) const noexcept { return find_slot(id) ? 1 : 0; }
+
+    Value& at(TownID const& id)
+    {
+        const auto slot = find_slot(id);
+        if (!slot) { throw std::out_of_range("FlatTownMap::at"); }
+        return slot->element->second;
+    }
+    Value const& at(TownID const& id) const
+    {
+        const auto slot = find_slot(id);
+        if (!slot) { throw std::out_of_range("FlatTownMap::at"); }
+        return slot->element->second;
+    }
+
+    // Estimate of performance: Theta(1) amortized on average, O(n) in the worst case
+    // Short rationale for estimate:
+    // Like find(), after which the new element is placed where the search stopped, shifting
+    // the rest of the probe sequence one slot forward. The table doubles when it gets too full.
+    // Inserts only if the id isn't in the table yet, returns the element and whether it was inserted.
+    std::pair<iterator, bool> insert(value_type const& value)
+    {
+        return emplace_unique(value.first, [&value](value_type* element) { new (element) value_type(value); });
+    }
+    std::pair<iterator, bool> insert(value_type&& value)
+    {
+        return emplace_unique(value.first, [&value](value_type* element) { new (element) value_type(std::move(value)); });
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(TownID const& id, Args&&... args)
+    {
+        return emplace_unique(id, [&id, &args...](value_type* element)
+        {
+            new (element) value_type(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+    }
+
+    // Estimate of performance: Theta(1) on average, O(n) in the worst case
+    // Short rationale for estimate:
+    // The elements after the erased one are shifted one slot back until one that is in its
+    // home slot or an empty slot, which is a short sequence on average
+    void erase(const_iterator position)
+    {
+        erase_slot(static_cast<std::size_t>(position.slot_ - slots_.get()));
+    }
+    std::size_t erase(TownID const& id)
+    {
+        const auto slot = find_slot(id);
+        if (!slot) { return 0; }
+        erase_slot(static_cast<std::size_t>(slot - slots_.get()));
+        return 1;
+    }
+
+    // Keeps the slots, like std::unordered_map keeps its buckets
+    void clear()
+    {
+        destroy_elements();
+        for (std::size_t i = 0; i < capacity_; ++i) { slots_[i] = Slot{}; }
+        size_ = 0;
+    }
+
+    // Makes room for count elements without growing the table
+    void reserve(std::size_t count)
+    {
+        auto capacity = capacity_ > 0 ? capacity_ : MIN_CAPACITY;
+        while (count * MAX_LOAD_DENOMINATOR > capacity * MAX_LOAD_NUMERATOR) { capacity *= 2; }
+        if (capacity != capacity_) { rehash(capacity); }
+    }
+
+private:
+    allocator_type allocator_;
+    std::unique_ptr<Slot[]> slots_{};
+    std::size_t capacity_ = 0; // a power of two
+    std::size_t size_ = 0;
+    unsigned int shift_ = 0;   // 64 - log2(capacity_)
+
+    Slot* slots_end() const noexcept { return slots_.get() + capacity_; }
+
+    template <bool Const = false>
+    Iterator<Const> make_iterator(Slot const* slot) const noexcept
+    {
+        Iterator<Const> it{ slot, slots_end() };
+        it.skip_empty();
+        return it;
+    }
+
+    // The home slot comes from the high bits of the hash multiplied by 2^64 / golden ratio,
+    // so that the home slots spread over the table even if the low bits of the hashes don't differ much
+    std::size_t home_slot(std::size_t hash) const noexcept
+    {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    Slot* find_slot(TownID const& id) const noexcept
+    {
+        if (size_ == 0) { return nullptr; }
+        const auto hash_bits = static_cast<std::uint32_t>(id.hash());
+        const auto mask = capacity_ - 1;
+        auto index = home_slot(id.hash());
+        for (std::uint32_t distance = 1; ; ++distance)
+        {
+            auto& slot = slots_[index];
+            //an element closer to its home than the id would be means that the id isn't in the table
+            if (slot.distance < distance) { return nullptr; }
+            if (slot.hash_bits == hash_bits && slot.element->first == id) { return &slot; }
+            index = (index + 1) & mask;
+        }
+    }
+
+    template <typename Construct>
+    std::pair<iterator, bool> emplace_unique(TownID const& id, Construct construct)
+    {
+        if ((size_ + 1) * MAX_LOAD_DENOMINATOR > capacity_ * MAX_LOAD_NUMERATOR)
+        {
+            rehash(capacity_ > 0 ? 2 * capacity_ : MIN_CAPACITY);
+        }
+
+        const auto hash_bits = static_cast<std::uint32_t>(id.hash());
+        const auto mask = capacity_ - 1;
+        auto index = home_slot(id.hash());
+        std::uint32_t distance = 1;
+        for (; ; ++distance, index = (index + 1) & mask)
+        {
+            const auto& slot = slots_[index];
+            if (slot.distance < distance) { break; }
+            if (slot.hash_bits == hash_bits && slot.element->first == id)
+            {
+                return { iterator{ &slot, slots_end() }, false };
+            }
+        }
+
+        //the element is constructed only when the id is known to be new
+        const auto element = std::allocator_traits<allocator_type>::allocate(allocator_, 1);
+        try
+        {
+            construct(element);
+        }
+        catch (...)
+        {
+            std::allocator_traits<allocator_type>::deallocate(allocator_, element, 1);
+            throw;
+        }
+        place(Slot{ element, hash_bits, distance }, index);
+        ++size_;
+        return { iterator{ &slots_[index], slots_end() }, true };
+    }
+
+    // puts the slot at index, pushing the elements from there on forward like Robin Hood
+    void place(Slot slot, std::size_t index) noexcept
+    {
+        const auto mask = capacity_ - 1;
+        while (slots_[index].distance != 0)
+        {
+            if (slots_[index].distance < slot.distance) { std::swap(slot, slots_[index]); }
+            index = (index + 1) & mask;
+            ++slot.distance;
+        }
+        slots_[index] = slot;
+    }
+
+    void erase_slot(std::size_t index)
+    {
+        const auto element = slots_[index].element;
+        std::allocator_traits<allocator_type>::destroy(allocator_, element);
+        std::allocator_traits<allocator_type>::deallocate(allocator_, element, 1);
+
+        //shifting back instead of leaving a tombstone keeps the lookups of the following elements short
+        const auto mask = capacity_ - 1;
+        auto next = (index + 1) & mask;
+        while (slots_[next].distance > 1)
+        {
+            slots_[index] = slots_[next];
+            --slots_[index].distance;
+            index = next;
+            next = (next + 1) & mask;
+        }
+        slots_[index] = Slot{};
+        --size_;
+    }
+
+    void rehash(std::size_t capacity)
+    {
+        auto old_slots = std::move(slots_);
+        const auto old_capacity = capacity_;
+
+        slots_ = std::make_unique<Slot[]>(capacity);
+        capacity_ = capacity;
+        shift_ = 64;
+        for (auto c = capacity; c > 1; c /= 2) { --shift_; }
+
+        for (std::size_t i = 0; i < old_capacity; ++i)
+        {
+            if (old_slots[i].distance != 0)
+            {
+                const auto element = old_slots[i].element;
+                place(Slot{ element, old_slots[i].hash_bits, 1 }, home_slot(element->first.hash()));
+            }
+        }
+    }
+
+    void destroy_elements() noexcept
+    {
+        for (std::size_t i = 0; i < capacity_; ++i)
+        {
+            if (slots_[i].distance != 0)
+            {
+                std::allocator_traits<allocator_type>::destroy(allocator_, slots_[i].element);
+                std::allocator_traits<allocator_type>::deallocate(allocator_, slots_[i].element, 1);
+            }
+        }
+    }
+};
+
+#endif // FLATTOWNMAP_HH
@@ -10,6 +10,9 @@
 using std::string;
 using std::getline;
 
+#include <string_view>
+using std::string_view;
+
 #include <iostream>
 using std::cout;
 using std::cin;
@@ -30,6 +33,7 @@ using std::ostream;
 
 #include <fstream>
 using std::ifstream;
+using std::ofstream;
 
 #include <sstream>
 using std::istringstream;
@@ -49,11 +53,14 @@ using std::tie;
 using std::regex_match;
 using std::regex_search;
 using std::smatch;
+using std::cmatch;
 using std::regex;
 using std::sregex_token_iterator;
 
 #include <algorithm>
 using std::find_if;
+using std::count;
+using std::count_if;
 using std::find;
 using std::binary_search;
 using std::max_element;
@@ -68,6 +75,10 @@ using std::uniform_int_distribution;
 
 #include <chrono>
 
+#include <filesystem>
+
+#include <cstdio>
+
 #include <functional>
 using std::function;
 using std::equal_to;
@@ -78,6 +89,8 @@ using std::vector;
 #include <set>
 using std::set;
 
+#include <unordered_map>
+
 #include <array>
 using std::array;
 
@@ -108,11 +121,25 @@ using std::transform;
 #include <iterator>
 using std::back_inserter;
 
+#include <charconv>
+using std::to_chars;
+
 #include <cstddef>
 #include <cassert>
 
+#include <thread>
+using std::thread;
+
+#include <atomic>
+using std::atomic;
+
 
 #include "mainprogram.hh"
+#include "concurrentdatastructures.hh"
+#include "snapshotdatastructures.hh"
+#include "sorting.hh"
+#include "realmfile.hh"
+#include "allocationcounter.hh"
 
 #include "datastructures.hh"
 
@@ -122,11 +149,9 @@ using std::back_inserter;
 
 string const MainProgram::PROMPT = "> ";
 
-void MainProgram::test_get_functions(TownID id)
+void MainProgram::test_get_functions(TownID const& id)
 {
-    ds_.get_town_name(id);
-    ds_.get_town_coordinates(id);
-    ds_.get_town_tax(id);
+    ds_.get_town_info(id);
 }
 
 MainProgram::CmdResult MainProgram::cmd_add_town(ostream& /*output*/, MatchIter begin, MatchIter end)
@@ -160,7 +185,7 @@ void MainProgram::test_print_town()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
         test_get_functions(id);
     }
 }
@@ -181,8 +206,8 @@ void MainProgram::test_change_town_name()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
-        auto newname = n_to_name(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
+        auto newname = n_to_name(random_test_town());
         ds_.change_town_name(id, newname);
     }
 }
@@ -258,8 +283,8 @@ void MainProgram::test_remove_road()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id1 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
-        auto id2 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id1 = n_to_townid(random_test_town());
+        auto id2 = n_to_townid(random_test_town());
         ds_.remove_road(id1, id2);
     }
 }
@@ -269,16 +294,16 @@ MainProgram::CmdResult MainProgram::cmd_taxer_path(std::ostream& /*output*/, Mai
     TownID id = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
-    auto result = ds_.taxer_path(id);
+    auto result = ds_.taxer_path_view(id);
     if (result.empty()) { return {ResultType::HIERARCHY, {NO_TOWNID}}; }
-    else { return {ResultType::HIERARCHY, result}; }
+    else { return {ResultType::HIERARCHY, std::move(result)}; }
 }
 
 void MainProgram::test_taxer_path()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
         ds_.taxer_path(id);
     }
 }
@@ -297,7 +322,7 @@ void MainProgram::test_longest_vassal_path()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
         ds_.longest_vassal_path(id);
     }
 }
@@ -326,7 +351,7 @@ void MainProgram::test_total_net_tax()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
         ds_.total_net_tax(id);
     }
 }
@@ -347,9 +372,7 @@ MainProgram::CmdResult MainProgram::cmd_towns_nearest(ostream& /*output*/, Match
 
 void MainProgram::test_towns_nearest()
 {
-    int x = random<int>(1, 10000);
-    int y = random<int>(1, 10000);
-    ds_.towns_nearest({x, y});
+    ds_.towns_nearest(random_test_coord());
 }
 
 MainProgram::CmdResult MainProgram::cmd_remove_town(ostream& output, MatchIter begin, MatchIter end)
@@ -376,7 +399,7 @@ void MainProgram::test_remove_town()
     // Choose random number to remove
     if (random_towns_added_ > 0) // Don't remove if there's nothing to remove
     {
-        auto name = n_to_name(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto name = n_to_name(random_test_town());
         ds_.remove_town(name);
     }
 }
@@ -405,6 +428,50 @@ void MainProgram::add_random_towns(unsigned int size, Coord min, Coord max)
     }
 }
 
+void MainProgram::generate_bulk_data(unsigned int size, unsigned int roads, BulkData& data, Coord min, Coord max)
+{
+    // The random numbers are drawn in the same order as in add_random_towns() and add_random_roads(),
+    // so the generated data is identical to what they would add
+    auto first = random_towns_added_;
+
+    data.towns.clear();
+    data.towns.reserve(size);
+    data.vassalships.clear();
+    data.vassalships.reserve(size);
+    for (unsigned int i = 0; i < size; ++i)
+    {
+        auto townnum = first + i;
+
+        int x = random<int>(min.x, max.x);
+        int y = random<int>(min.y, max.y);
+        int tax = random<int>(1, 10000);
+        data.towns.push_back({n_to_townid(townnum), n_to_name(townnum), {x, y}, tax});
+
+        // Add random taxer whose number is smaller
+        if (townnum > 0)
+        {
+            data.vassalships.emplace_back(data.towns.back().id, n_to_townid(random<decltype(townnum)>(0, townnum)));
+        }
+    }
+
+    data.roads.clear();
+    data.roads.reserve(roads);
+    for (unsigned int i = 0; i < roads; ++i)
+    {
+        auto id1 = n_to_townid(random<decltype(first)>(0, first + size));
+        auto id2 = n_to_townid(random<decltype(first)>(0, first + size));
+        data.roads.emplace_back(std::move(id1), std::move(id2));
+    }
+}
+
+void MainProgram::add_bulk_data(BulkData const& data)
+{
+    ds_.add_towns(data.towns);
+    ds_.add_vassalships(data.vassalships);
+    ds_.add_roads(data.roads);
+    random_towns_added_ += data.towns.size();
+}
+
 MainProgram::CmdResult MainProgram::cmd_random_add(ostream& output, MatchIter begin, MatchIter end)
 {
     string sizestr = *begin++;
@@ -471,14 +538,14 @@ MainProgram::CmdResult MainProgram::cmd_all_towns(ostream& output, MatchIter beg
 {
     assert( begin == end && "Impossible number of parameters!");
 
-    auto towns = ds_.all_towns();
+    auto towns = ds_.all_towns_view();
     if (towns.empty())
     {
         output << "No towns!" << endl;
     }
 
-    std::sort(towns.begin(), towns.end());
-    return {ResultType::LIST, towns};
+    sort_by_id(towns);
+    return {ResultType::LIST, std::move(towns)};
 }
 
 void MainProgram::test_all_towns()
@@ -490,21 +557,23 @@ MainProgram::CmdResult MainProgram::cmd_all_roads(std::ostream& output, MainProg
 {
     assert( begin == end && "Impossible number of parameters!");
 
-    auto roads = ds_.all_roads();
+    // The towns of the roads come with their coordinates, so they aren't looked up again here
+    auto roads = ds_.all_roads_view();
     if (roads.empty())
     {
         output << "No roads!" << endl;
     }
 
-    std::sort(roads.begin(), roads.end());
+    std::sort(roads.begin(), roads.end(), [](auto const& road1, auto const& road2)
+    {
+        return std::tie(road1.first.id, road1.second.id) < std::tie(road2.first.id, road2.second.id);
+    });
 
     unsigned long int n = 1;
     for (auto const& p : roads)
     {
-        auto coord1 = ds_.get_town_coordinates(p.first);
-        auto coord2 = ds_.get_town_coordinates(p.second);
-        auto dist = calc_distance(coord1, coord2);
-        output << n << ": " << p.first << " <-> " << p.second << " (" << dist << ")" << std::endl;
+        auto dist = calc_distance(p.first.info.coord, p.second.info.coord);
+        output << n << ": " << p.first.id << " <-> " << p.second.id << " (" << dist << ")" << std::endl;
         ++n;
     }
 
@@ -536,7 +605,7 @@ void MainProgram::test_town_vassals()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
         ds_.get_town_vassals(id);
     }
 }
@@ -546,22 +615,22 @@ MainProgram::CmdResult MainProgram::cmd_roads_from(std::ostream& output, MainPro
     string id = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
-    auto vassals = ds_.get_roads_from(id);
-    if (vassals.empty())
+    auto towns = ds_.get_roads_from_view(id);
+    if (towns.empty())
     {
         output << "No roads!" << endl;
     }
 
-    std::sort(vassals.begin(), vassals.end());
+    sort_by_id(towns);
 
-    return {ResultType::LIST, vassals};
+    return {ResultType::LIST, std::move(towns)};
 }
 
 void MainProgram::test_roads_from()
 {
     if (random_towns_added_ > 0) // Don't do anything if there's no towns
     {
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
         ds_.get_roads_from(id);
     }
 }
@@ -598,10 +667,12 @@ void MainProgram::test_random_roads()
 
 void MainProgram::add_random_roads(unsigned int n)
 {
+    // Towns are picked with the perftest distribution (dist=), which is uniform while the test data is built,
+    // so generate_bulk_data() still draws the same roads
     for (unsigned int i=0; i<n; ++i)
     {
-        auto id1 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
-        auto id2 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id1 = n_to_townid(random_test_town());
+        auto id2 = n_to_townid(random_test_town());
         ds_.add_road(id1, id2);
     }
 }
@@ -658,54 +729,61 @@ MainProgram::CmdResult MainProgram::cmd_clear_all(ostream& output, MatchIter beg
     return {};
 }
 
-string MainProgram::print_town(TownID id, ostream& output, bool nl)
+string MainProgram::print_town(TownID const& id, ostream& output, bool nl)
+{
+    string storage;
+    OutputBuffer buffer(output, storage);
+    print_town(id, buffer, nl);
+    return (id != NO_TOWNID) ? id.str() : "";
+}
+
+void MainProgram::print_town(TownID const& id, OutputBuffer& output, bool nl)
 {
     try
     {
-        if (id != NO_TOWNID)
-        {
-            auto name = ds_.get_town_name(id);
-            auto xy = ds_.get_town_coordinates(id);
-            if (!name.empty())
-            {
-                output << name << ": ";
-            }
-            else
-            {
-                output << "*: ";
-            }
-
-            auto tax = ds_.get_town_tax(id);
-            if (tax != NO_VALUE)
-            {
-                output << "tax=" << tax << ", ";
-            }
-            else
-            {
-                output << "tax=NO_VALUE, ";
-            }
+        print_town(TownView{ id, (id != NO_TOWNID) ? ds_.get_town_info(id) : TownInfo{} }, output, nl);
+    }
+    catch (NotImplemented const& e)
+    {
+        output << '\n' << "NotImplemented while printing town : " << e.what() << '\n';
+        std::cerr << endl << "NotImplemented while printing town : " << e.what() << endl;
+    }
+}
 
-            output << "pos=";
-            print_coord(xy, output, false);
-            output << ", id=" << id;
-            if (nl) { output << endl; }
+void MainProgram::print_town(TownView const& town, OutputBuffer& output, bool nl)
+{
+    if (town.id != NO_TOWNID.view())
+    {
+        auto name = town.info.name;
+        auto xy = town.info.coord;
+        if (!name.empty())
+        {
+            output << name << ": ";
+        }
+        else
+        {
+            output << "*: ";
+        }
 
-            ostringstream retstream;
-            retstream << id;
-            return retstream.str();
+        auto tax = town.info.tax;
+        if (tax != NO_VALUE)
+        {
+            output << "tax=" << tax << ", ";
         }
         else
         {
-            output << "--NO_TOWNID--";
-            if (nl) { output << endl; }
-            return "";
+            output << "tax=NO_VALUE, ";
         }
+
+        output << "pos=";
+        print_coord(xy, output, false);
+        output << ", id=" << town.id;
+        if (nl) { output << '\n'; }
     }
-    catch (NotImplemented const& e)
+    else
     {
-        output << endl << "NotImplemented while printing town : " << e.what() << endl;
-        std::cerr << endl << "NotImplemented while printing town : " << e.what() << endl;
-        return "";
+        output << "--NO_TOWNID--";
+        if (nl) { output << '\n'; }
     }
 }
 
@@ -730,25 +808,131 @@ void MainProgram::test_find_towns()
     // Choose random number to remove
     if (random_towns_added_ > 0) // Don't find if there's nothing to find
     {
-        auto name = n_to_name(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto name = n_to_name(random_test_town());
         ds_.find_towns(name);
     }
 }
 
+MainProgram::CmdResult MainProgram::cmd_page(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string list = *begin++;
+    string offsetstr = *begin++;
+    string limitstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto offset = convert_string_to<std::size_t>(offsetstr);
+    auto limit = convert_string_to<std::size_t>(limitstr);
+
+    // The towns are numbered by their place in the whole list, so that consecutive pages continue the numbering
+    if (list == "all_roads")
+    {
+        print_road_page(ds_.all_roads_page(offset, limit), offset + 1, output);
+    }
+    else if (list == "towns_alphabetically")
+    {
+        print_town_page(ds_.towns_alphabetically_page(offset, limit), offset + 1, output);
+    }
+    else
+    {
+        print_town_page(ds_.towns_distance_increasing_page(offset, limit), offset + 1, output);
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_page_after(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string list = *begin++;
+    string limitstr = *begin++;
+    string cursor = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto limit = convert_string_to<std::size_t>(limitstr);
+
+    // Without a cursor the first page is returned
+    std::string next;
+    if (list == "all_roads")
+    {
+        auto page = ds_.all_roads_after(cursor, limit);
+        if (page.roads.size() == 1 && page.roads.front().first.id == NO_TOWNID.view())
+        {
+            output << "Failed (invalid cursor)!!" << endl;
+            return {};
+        }
+        print_road_page(page.roads, 1, output);
+        next = std::move(page.next);
+    }
+    else
+    {
+        auto page = (list == "towns_alphabetically") ? ds_.towns_alphabetically_after(cursor, limit)
+                                                     : ds_.towns_distance_increasing_after(cursor, limit);
+        if (page.towns.size() == 1 && page.towns.front().id == NO_TOWNID.view())
+        {
+            output << "Failed (invalid cursor)!!" << endl;
+            return {};
+        }
+        print_town_page(page.towns, 1, output);
+        next = std::move(page.next);
+    }
+
+    if (next.empty())
+    {
+        output << "Last page" << endl;
+    }
+    else
+    {
+        output << "Next cursor: " << next << endl;
+    }
+
+    return {};
+}
+
+void MainProgram::print_town_page(TownViews const& towns, std::size_t first_num, std::ostream& output)
+{
+    if (towns.empty())
+    {
+        output << "No towns!" << endl;
+        return;
+    }
+
+    string storage;
+    OutputBuffer buffer(output, storage);
+    for (auto const& town : towns)
+    {
+        buffer << first_num++ << ". ";
+        print_town(town, buffer);
+    }
+}
+
+void MainProgram::print_road_page(RoadViews const& roads, std::size_t first_num, std::ostream& output)
+{
+    if (roads.empty())
+    {
+        output << "No roads!" << endl;
+        return;
+    }
+
+    for (auto const& road : roads)
+    {
+        auto dist = calc_distance(road.first.info.coord, road.second.info.coord);
+        output << first_num++ << ": " << road.first.id << " <-> " << road.second.id << " (" << dist << ")" << std::endl;
+    }
+}
+
 MainProgram::CmdResult MainProgram::cmd_any_route(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
 {
     string fromid = *begin++;
     string toid = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
-    auto result = ds_.any_route(fromid, toid);
+    auto result = ds_.any_route_view(fromid, toid);
     if (result.empty())
     {
         output << "No route found." << std::endl;
         return {};
     }
 
-    return {ResultType::ROUTE, result};
+    return {ResultType::ROUTE, std::move(result)};
 }
 
 void MainProgram::test_any_route()
@@ -756,8 +940,8 @@ void MainProgram::test_any_route()
     if (random_towns_added_ > 0)
     {
         // Choose two random towns
-        auto id1 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
-        auto id2 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id1 = n_to_townid(random_test_town());
+        auto id2 = n_to_townid(random_test_town());
         ds_.any_route(id1, id2);
     }
 }
@@ -768,14 +952,14 @@ MainProgram::CmdResult MainProgram::cmd_shortest_route(ostream& output, MatchIte
     string toid = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
-    auto result = ds_.shortest_route(fromid, toid);
+    auto result = ds_.shortest_route_view(fromid, toid);
     if (result.empty())
     {
         output << "No route found." << std::endl;
         return {};
     }
 
-    return {ResultType::ROUTE, result};
+    return {ResultType::ROUTE, std::move(result)};
 }
 
 void MainProgram::test_shortest_route()
@@ -783,8 +967,8 @@ void MainProgram::test_shortest_route()
     if (random_towns_added_ > 0)
     {
         // Choose two random towns
-        auto id1 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
-        auto id2 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id1 = n_to_townid(random_test_town());
+        auto id2 = n_to_townid(random_test_town());
         ds_.shortest_route(id1, id2);
     }
 }
@@ -795,14 +979,14 @@ MainProgram::CmdResult MainProgram::cmd_least_towns_route(std::ostream& output,
     string toid = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
-    auto result = ds_.least_towns_route(fromid, toid);
+    auto result = ds_.least_towns_route_view(fromid, toid);
     if (result.empty())
     {
         output << "No route found." << std::endl;
         return {};
     }
 
-    return {ResultType::ROUTE, result};
+    return {ResultType::ROUTE, std::move(result)};
 }
 
 void MainProgram::test_least_towns_route()
@@ -810,8 +994,8 @@ void MainProgram::test_least_towns_route()
     if (random_towns_added_ > 0)
     {
         // Choose two random towns
-        auto id1 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
-        auto id2 = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id1 = n_to_townid(random_test_town());
+        auto id2 = n_to_townid(random_test_town());
         ds_.least_towns_route(id1, id2);
     }
 }
@@ -821,14 +1005,14 @@ MainProgram::CmdResult MainProgram::cmd_road_cycle_route(std::ostream& output, M
     string fromid = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
-    auto result = ds_.road_cycle_route(fromid);
+    auto result = ds_.road_cycle_route_view(fromid);
     if (result.empty())
     {
         output << "No route found." << std::endl;
         return {};
     }
 
-    if (result.front() == NO_TOWNID)
+    if (result.front().id == NO_TOWNID.view())
     {
         output << "Town not found!" << endl;
         return {};
@@ -837,29 +1021,29 @@ MainProgram::CmdResult MainProgram::cmd_road_cycle_route(std::ostream& output, M
     if (result.size() < 2)
     {
         output << "Too short route (" << result.size() << ") to contain cycles!" << endl;
-        return {ResultType::ROUTE, result};
+        return {ResultType::ROUTE, std::move(result)};
     }
 
-    auto lasttown = result.back();
-    auto cycbeg = std::find_if(result.begin(), result.end()-1, [lasttown](auto const& id){ return id == lasttown; });
+    auto lasttown = result.back().id;
+    auto cycbeg = std::find_if(result.begin(), result.end()-1, [lasttown](auto const& town){ return town.id == lasttown; });
     if (cycbeg == result.end()-1)
     {
         output << "No cycle found in returned route!";
-        return {ResultType::ROUTE, result};
+        return {ResultType::ROUTE, std::move(result)};
     }
 
     // If necessary, swap cycle so that it starts with smaller townid
     if ((cycbeg+1) < (result.end()-2))
     {
-        auto idfirst = *cycbeg;
-        auto idlast = *(result.end()-2);
+        auto idfirst = cycbeg->id;
+        auto idlast = (result.end()-2)->id;
         if (idlast < idfirst)
         {
            std::reverse(cycbeg+1, result.end()-1);
         }
     }
 
-    return {ResultType::ROUTE, result};
+    return {ResultType::ROUTE, std::move(result)};
 }
 
 void MainProgram::test_road_cycle_route()
@@ -867,7 +1051,7 @@ void MainProgram::test_road_cycle_route()
     if (random_towns_added_ > 0)
     {
         // Choose random town
-        auto id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
+        auto id = n_to_townid(random_test_town());
         ds_.road_cycle_route(id);
     }
 }
@@ -916,6 +1100,21 @@ MainProgram::CmdResult MainProgram::cmd_randseed(std::ostream& output, MatchIter
     return {};
 }
 
+MainProgram::CmdResult MainProgram::cmd_sort_threads(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string threadsstr = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    if (!threadsstr.empty())
+    {
+        ds_.set_sort_threads(convert_string_to<unsigned int>(threadsstr));
+    }
+
+    output << "Sorting with " << ds_.sort_threads() << " thread(s)" << endl;
+
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter begin, MatchIter end)
 {
     string filename = *begin++;
@@ -931,11 +1130,11 @@ MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter beg
         new_output = &dummystr;
     }
 
-    ifstream input(filename);
-    if (input)
+    MappedFile input(filename);
+    if (input.ok())
     {
         output << "** Commands from '" << filename << "'" << endl;
-        command_parser(input, *new_output, PromptStyle::NORMAL);
+        command_parser(input.contents(), *new_output, PromptStyle::NORMAL);
         if (silent) { output << "...(output discarded in silent mode)..." << endl; }
         output << "** End of commands from '" << filename << "'" << endl;
     }
@@ -947,742 +1146,2440 @@ MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter beg
     return {};
 }
 
-
-MainProgram::CmdResult MainProgram::cmd_testread(std::ostream& output, MatchIter begin, MatchIter end)
+MainProgram::CmdResult MainProgram::cmd_load_data(std::ostream& output, MatchIter begin, MatchIter end)
 {
-    string infilename = *begin++;
-    string outfilename = *begin++;
+    string filename = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
-    ifstream input(infilename);
-    if (input)
+    MappedFile input(filename);
+    if (!input.ok())
     {
-        ifstream expected_output(outfilename);
-        if (output)
-        {
-            stringstream actual_output;
-            command_parser(input, actual_output, PromptStyle::NO_NESTING);
+        output << "Cannot open file '" << filename << "'!" << endl;
+        return {};
+    }
 
-            vector<string> actual_lines;
-            while (actual_output)
-            {
-                string line;
-                getline(actual_output, line);
-                if (!actual_output) { break; }
-                actual_lines.push_back(line);
-            }
+    // Collect the data of the whole file first, so that it can be added with the batch operations
+    vector<TownSpec> towns;
+    vector<pair<TownID, TownID>> vassalships;
+    vector<pair<TownID, TownID>> roads;
 
-            vector<string> expected_lines;
-            while (expected_output)
-            {
-                string line;
-                getline(expected_output, line);
-                if (!expected_output) { break; }
-                expected_lines.push_back(line);
-            }
+    LineReader lines(input.contents());
+    string_view line;
+    unsigned long int linenum = 0;
+    Params params;
+    while (lines.getline(line))
+    {
+        ++linenum;
+        if (line.empty()) { continue; }
 
-            string heading_actual = "Actual output";
-            unsigned int actual_max_length = heading_actual.length();
-            auto actual_max_iter = max_element(actual_lines.cbegin(), actual_lines.cend(),
-                                               [](string s1, string s2){ return s1.length() < s2.length(); });
-            if (actual_max_iter != actual_lines.cend())
-            {
-                actual_max_length = actual_max_iter->length();
-            }
+        CmdInfo const* cmd = nullptr;
+        auto status = parse_command(line, cmd, params);
+        if (status == ParseStatus::UNKNOWN_CMD)
+        {
+            output << "Line " << linenum << ": Unknown command!" << endl;
+            continue;
+        }
+        if (status == ParseStatus::INVALID_PARAMS)
+        {
+            output << "Line " << linenum << ": Invalid parameters for command '" << cmd->cmd << "'!" << endl;
+            continue;
+        }
 
-            string heading_expected = "Expected output";
-            unsigned int expected_max_length = heading_expected.length();
-            auto expected_max_iter = std::max_element(expected_lines.cbegin(), expected_lines.cend(),
-                                                    [](string s1, string s2){ return s1.length() < s2.length(); });
-            if (expected_max_iter != expected_lines.cend())
+        try
+        {
+            if (cmd->func == &MainProgram::cmd_add_town)
             {
-                expected_max_length = expected_max_iter->length();
+                Coord xy = {convert_string_to<int>(params[2]), convert_string_to<int>(params[3])};
+                towns.push_back({params[0], params[1], xy, convert_string_to<int>(params[4])});
             }
-
-            auto pos_actual = actual_lines.cbegin();
-            auto pos_expected = expected_lines.cbegin();
-            output << "  " << heading_actual << string(actual_max_length - heading_actual.length(), ' ') << " | " << heading_expected << endl;
-            output << "--" << string(actual_max_length, '-') << "-|-" << string(expected_max_length, '-') << endl;
-
-            bool lines_ok = true;
-            while (pos_expected != expected_lines.cend() || pos_actual != actual_lines.cend())
+            else if (cmd->func == &MainProgram::cmd_add_vassalship)
             {
-                if (pos_expected != expected_lines.cend())
-                {
-                    if (pos_actual != actual_lines.cend())
-                    {
-                        bool ok = (*pos_expected == *pos_actual);
-                        output << (ok ? ' ' : '?') << ' ' << *pos_actual << string(actual_max_length - pos_actual->length(), ' ')
-                               << " | " << *pos_expected << endl;
-                        lines_ok = lines_ok && ok;
-                        ++pos_actual;
-                    }
-                    else
-                    { // Actual output was too short
-                        output << "? " << string(actual_max_length, ' ')
-                               << " | " << *pos_expected << endl;
-                        lines_ok = false;
-                    }
-                    ++pos_expected;
-                }
-                else
-                { // Actual output was too long
-                    output << "? " << *pos_actual << string(actual_max_length - pos_actual->length(), ' ')
-                           << " | " << endl;
-                    lines_ok = false;
-                    ++pos_actual;
-                }
+                vassalships.emplace_back(params[0], params[1]);
             }
-            if (lines_ok)
+            else if (cmd->func == &MainProgram::cmd_add_road)
             {
-                output << "**No differences in output.**" << endl;
-                if (test_status_ == TestStatus::NOT_RUN)
-                {
-                    test_status_ = TestStatus::NO_DIFFS;
-                }
+                roads.emplace_back(params[0], params[1]);
             }
-            else
+            else if (cmd->func != &MainProgram::cmd_comment)
             {
-                output << "**Differences found! (Lines beginning with '?')**" << endl;
-                test_status_ = TestStatus::DIFFS_FOUND;
+                output << "Line " << linenum << ": Command '" << cmd->cmd << "' cannot be bulk loaded, ignored." << endl;
             }
-
         }
-        else
+        catch (std::invalid_argument const&)
         {
-            output << "Cannot open file '" << outfilename << "'!" << endl;
+            output << "Line " << linenum << ": Invalid parameters for command '" << cmd->cmd << "'!" << endl;
         }
     }
-    else
-    {
-        output << "Cannot open file '" << infilename << "'!" << endl;
-    }
 
+    // Towns are added first, then vassalships and roads between them
+    auto towns_added = ds_.add_towns(towns);
+    auto vassalships_added = ds_.add_vassalships(vassalships);
+    auto roads_added = ds_.add_roads(roads);
+
+    output << "Loaded " << towns_added << " towns, " << vassalships_added << " vassalships and "
+           << roads_added << " roads from '" << filename << "'" << endl;
+
+    view_dirty = true;
     return {};
 }
 
-MainProgram::CmdResult MainProgram::cmd_stopwatch(std::ostream& output, MatchIter begin, MatchIter end)
+MainProgram::CmdResult MainProgram::cmd_save_snapshot(std::ostream& output, MatchIter begin, MatchIter end)
 {
-    string on = *begin++;
-    string off = *begin++;
-    string next = *begin++;
-    assert(begin == end && "Invalid number of parameters");
+    string filename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
 
-    if (!on.empty())
-    {
-        stopwatch_mode = StopwatchMode::ON;
-        output << "Stopwatch: on" << endl;
-    }
-    else if (!off.empty())
-    {
-        stopwatch_mode = StopwatchMode::OFF;
-        output << "Stopwatch: off" << endl;
-    }
-    else if (!next.empty())
-    {
-        stopwatch_mode = StopwatchMode::NEXT;
-        output << "Stopwatch: on for the next command" << endl;
-    }
-    else
+    string error;
+    if (!RealmFile::save(ds_, filename, error))
     {
-        assert(!"Impossible stopwatch mode!");
+        output << error << "!" << endl;
+        return {};
     }
 
+    output << "Saved " << ds_.town_count() << " towns and " << ds_.all_roads().size() << " roads to '" << filename << "'" << endl;
     return {};
 }
 
-std::string MainProgram::print_town_name(TownID id, std::ostream &output, bool nl)
+MainProgram::CmdResult MainProgram::cmd_load_snapshot(std::ostream& output, MatchIter begin, MatchIter end)
 {
-    try
-    {
-        if (id != NO_TOWNID)
-        {
-            auto name = ds_.get_town_name(id);
-            if (!name.empty())
-            {
-                output << name;
-            }
-            else
-            {
-                output << "*";
-            }
+    string filename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
 
-            ostringstream retstream;
-            retstream << name;
-            if (nl) { output << endl; }
-            return retstream.str();
-        }
-        else
-        {
-            output << "--NO_TOWNID--";
-            if (nl) { output << endl; }
-            return "";
-        }
-    }
-    catch (NotImplemented const& e)
+    string error;
+    if (!RealmFile::load(ds_, filename, error))
     {
-        output << endl << "NotImplemented while printing town name : " << e.what() << endl;
-        std::cerr << endl << "NotImplemented while printing town name : " << e.what() << endl;
-        return "";
+        output << error << "!" << endl;
+        view_dirty = true; // A failed load may have emptied the database
+        return {};
     }
+
+    output << "Loaded " << ds_.town_count() << " towns and " << ds_.all_roads().size() << " roads from '" << filename << "'" << endl;
+    view_dirty = true;
+    return {};
 }
 
-std::string MainProgram::print_coord(Coord coord, std::ostream& output, bool nl)
+MainProgram::CmdResult MainProgram::cmd_open_snapshot(std::ostream& output, MatchIter begin, MatchIter end)
 {
-    if (coord != NO_COORD)
+    string filename = *begin++;
+    string check = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    string error;
+    if (!ds_.open_mapped(filename, !check.empty(), error))
     {
-        output << "(" << coord.x << "," << coord.y << ")";
-        ostringstream retstream;
-        retstream << "(" << coord.x << "," << coord.y << ")";
-        if (nl) { output << endl; }
-        return retstream.str();
+        output << error << "!" << endl;
+        return {};
     }
-    else
-    {
-        output << "(--NO_COORD--)";
-        if (nl) { output << endl; }
-        return "";
-    }
-}
 
-string const townidx = "([a-zA-Z0-9]+)";
-string const namex = "([a-zA-Z0-9-]+)";
-string const numx = "([0-9]+)";
-string const optcoordx = "\\([[:space:]]*[0-9]+[[:space:]]*,[[:space:]]*[0-9]+[[:space:]]*\\)";
-string const coordx = "\\([[:space:]]*([0-9]+)[[:space:]]*,[[:space:]]*([0-9]+)[[:space:]]*\\)";
-string const wsx = "[[:space:]]+";
+    output << "Mapped " << ds_.town_count() << " towns and " << ds_.all_roads().size() << " roads from '" << filename
+           << "' (read-only)" << endl;
+    view_dirty = true;
+    return {};
+}
 
-vector<MainProgram::CmdInfo> MainProgram::cmds_ =
+MainProgram::CmdResult MainProgram::cmd_close_snapshot(std::ostream& output, MatchIter begin, MatchIter end)
 {
-    {"add_town", "ID Name (x,y) tax", townidx+wsx+namex+wsx+coordx+wsx+numx, &MainProgram::cmd_add_town, nullptr },
-    {"random_add", "number_of_towns_to_add  (minx,miny) (maxx,maxy) (coordinates optional)",
-     numx+"(?:"+wsx+coordx+wsx+coordx+")?", &MainProgram::cmd_random_add, &MainProgram::test_random_add },
-    {"random_roads", "max_number_of_roads_to_add", numx,
-     &MainProgram::cmd_random_roads, &MainProgram::test_random_roads },
-    {"random_road_network", "", "", &MainProgram::cmd_random_road_network, nullptr },
-    {"print_town", "TownID", townidx, &MainProgram::cmd_print_town, &MainProgram::test_print_town },
-    {"all_towns", "", "", &MainProgram::cmd_all_towns, &MainProgram::test_all_towns },
-    {"all_roads", "", "", &MainProgram::cmd_all_roads, &MainProgram::test_all_roads },
-    {"town_count", "", "", &MainProgram::cmd_town_count, nullptr },
-    {"clear_all", "", "", &MainProgram::cmd_clear_all, nullptr },
-    {"towns_alphabetically", "", "", &MainProgram::NoParListCmd<&Datastructures::towns_alphabetically>, &MainProgram::NoParListTestCmd<&Datastructures::towns_alphabetically> },
-    {"towns_distance_increasing", "", "", &MainProgram::NoParListCmd<&Datastructures::towns_distance_increasing>,
-                                          &MainProgram::NoParListTestCmd<&Datastructures::towns_distance_increasing> },
-    {"mindist", "", "", &MainProgram::NoParTownCmd<&Datastructures::min_distance>, &MainProgram::NoParTownTestCmd<&Datastructures::min_distance> },
-    {"maxdist", "", "", &MainProgram::NoParTownCmd<&Datastructures::max_distance>, &MainProgram::NoParTownTestCmd<&Datastructures::max_distance> },
-    {"towns_nearest", "(x,y)", coordx, &MainProgram::cmd_towns_nearest, &MainProgram::test_towns_nearest },
-    {"remove_town", "ID", townidx, &MainProgram::cmd_remove_town, &MainProgram::test_remove_town },
-    {"find_towns", "name", namex, &MainProgram::cmd_find_towns, &MainProgram::test_find_towns },
-    {"change_town_name", "ID newname", townidx+wsx+namex, &MainProgram::cmd_change_town_name, &MainProgram::test_change_town_name },
-    {"add_vassalship", "VassalID TaxerID", townidx+wsx+townidx, &MainProgram::cmd_add_vassalship, nullptr },
-    {"town_vassals", "TownID", townidx, &MainProgram::cmd_town_vassals, &MainProgram::test_town_vassals },
-    {"add_road", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_add_road, nullptr },
-    {"remove_road", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_remove_road, &MainProgram::test_remove_road },
-    {"roads_from", "TownID", townidx, &MainProgram::cmd_roads_from, &MainProgram::test_roads_from },
-    {"clear_roads", "", "", &MainProgram::cmd_clear_roads, nullptr },
-    {"taxer_path", "ID", townidx, &MainProgram::cmd_taxer_path, &MainProgram::test_taxer_path },
-    {"longest_vassal_path", "ID", townidx, &MainProgram::cmd_longest_vassal_path, &MainProgram::test_longest_vassal_path },
-    {"total_net_tax", "ID", townidx, &MainProgram::cmd_total_net_tax, &MainProgram::test_total_net_tax },
-    {"any_route", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_any_route, &MainProgram::test_any_route },
-    {"shortest_route", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_shortest_route, &MainProgram::test_shortest_route },
-    {"least_towns_route", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_least_towns_route, &MainProgram::test_least_towns_route },
-    {"road_cycle_route", "TownID", townidx, &MainProgram::cmd_road_cycle_route, &MainProgram::test_road_cycle_route },
-    {"trim_road_network", "", "", &MainProgram::cmd_trim_road_network, &MainProgram::test_trim_road_network },
-    {"quit", "", "", nullptr, nullptr },
-    {"help", "", "", &MainProgram::help_command, nullptr },
-    {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
-    {"testread", "\"in-filename\" \"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_testread, nullptr },
-    {"perftest", "cmd1|all|compulsory[;cmd2...] timeout repeat_count n1[;n2...] (parts in [] are optional, alternatives separated by |)",
-     "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest, nullptr },
-    {"stopwatch", "on|off|next (alternatives separated by |)", "(?:(on)|(off)|(next))", &MainProgram::cmd_stopwatch, nullptr },
-    {"random_seed", "new-random-seed-integer", numx, &MainProgram::cmd_randseed, nullptr },
-    {"#", "comment text", ".*", &MainProgram::cmd_comment, nullptr },
-};
+    assert( begin == end && "Impossible number of parameters!");
 
-MainProgram::CmdResult MainProgram::help_command(std::ostream& output, MatchIter /*begin*/, MatchIter /*end*/)
-{
-    output << "Commands:" << endl;
-    for (auto& i : cmds_)
+    if (!ds_.is_mapped())
     {
-        output << "  " << i.cmd << " " << i.info << endl;
+        output << "No snapshot is mapped" << endl;
+        return {};
     }
 
+    ds_.close_mapped();
+    output << "Closed the mapped snapshot" << endl;
+    view_dirty = true;
     return {};
 }
 
-MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end)
+MainProgram::CmdResult MainProgram::cmd_open_log(std::ostream& output, MatchIter begin, MatchIter end)
 {
-#ifdef _GLIBCXX_DEBUG
-    output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
-#endif // _GLIBCXX_DEBUG
+    string directory = *begin++;
+    string groupsizestr = *begin++;
+    string intervalstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
 
-    try {
-    // Note: everything below is indented too little by one indentation level! (because of try block above)
+    MutationLogSettings settings;
+    if (!groupsizestr.empty()) { settings.group_size = std::max(convert_string_to<unsigned int>(groupsizestr), 1u); }
+    if (!intervalstr.empty()) { settings.checkpoint_interval = convert_string_to<unsigned long int>(intervalstr); }
 
-    vector<string> optional_cmds({"remove_town", "towns_nearest", "longest_vassal_path", "total_net_tax"});
-    vector<string> nondefault_cmds({"remove_town", "find_towns"});
+    string error;
+    if (!ds_.open_log(directory, settings, error))
+    {
+        output << error << "!" << endl;
+        view_dirty = true; // A failed recovery may have changed the database
+        return {};
+    }
 
-    string commandstr = *begin++;
-    unsigned int timeout = convert_string_to<unsigned int>(*begin++);
-    unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
-    string sizes = *begin++;
-    assert(begin == end && "Invalid number of parameters");
+    auto log = ds_.mutation_log();
+    output << "Recovered " << ds_.town_count() << " towns and " << ds_.all_roads().size() << " roads from '" << directory
+           << "' (" << log->replayed() << " changes replayed), logging changes to it" << endl;
+    view_dirty = true;
+    return {};
+}
 
-    vector<string> testcmds;
-    bool additional_get_cmds = true;
-    if (commandstr != "all" && commandstr != "compulsory")
+MainProgram::CmdResult MainProgram::cmd_close_log(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    if (!ds_.mutation_log())
     {
-        additional_get_cmds = false;
-        smatch scmd;
-        auto cbeg = commandstr.cbegin();
-        auto cend = commandstr.cend();
-        for ( ; regex_search(cbeg, cend, scmd, commands_regex_); cbeg = scmd.suffix().first)
-        {
-            testcmds.push_back(scmd[1]);
-        }
+        output << "The mutation log isn't open" << endl;
+        return {};
     }
 
-    vector<unsigned int> init_ns;
-    smatch size;
-    auto sbeg = sizes.cbegin();
-    auto send = sizes.cend();
-    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    string error;
+    if (!ds_.close_log(error))
     {
-        init_ns.push_back(convert_string_to<unsigned int>(size[1]));
+        output << error << "!" << endl;
+        return {};
     }
 
-    output << "Timeout for each N is " << timeout << " sec. " << endl;
-    output << "For each N perform " << repeat_count << " random command(s) from:" << endl;
+    output << "Closed the mutation log" << endl;
+    return {};
+}
 
-    // Initialize test functions
-    vector<void(MainProgram::*)()> testfuncs;
-    if (testcmds.empty())
-    { // Add all commands
-        for (auto& i : cmds_)
-        {
-            if (i.testfunc)
-            {
-                if (find(nondefault_cmds.begin(), nondefault_cmds.end(), i.cmd) == nondefault_cmds.end() &&
-                    (commandstr == "all" || find(optional_cmds.begin(), optional_cmds.end(), i.cmd) == optional_cmds.end()))
-                {
-                    output << i.cmd << " ";
-                    testfuncs.push_back(i.testfunc);
-                }
-            }
-        }
+MainProgram::CmdResult MainProgram::cmd_checkpoint(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    string error;
+    if (!ds_.checkpoint(error))
+    {
+        output << error << "!" << endl;
+        return {};
     }
-    else
+
+    output << "Checkpoint written after " << ds_.mutation_log()->lsn() << " changes" << endl;
+    return {};
+}
+
+bool MainProgram::is_recordable(string const& cmd)
+{
+    // Commands that read other commands (or control the program) aren't recorded themselves,
+    // the commands executed by them are recorded one by one instead
+    static vector<string> const nonrecordable_cmds({"read", "testread", "perftest", "record", "replay", "stopwatch", "help", "parse_benchmark", "concurrent_benchmark", "snapshot_benchmark", "sort_threads", "sort_benchmark", "hash_benchmark", "log_benchmark", "batch", "#"});
+    return find(nonrecordable_cmds.begin(), nonrecordable_cmds.end(), cmd) == nonrecordable_cmds.end();
+}
+
+MainProgram::CmdResult MainProgram::cmd_record(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    string off = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    if (!off.empty())
     {
-        for (auto& i : testcmds)
+        if (recorder_)
         {
-            auto pos = find_if(cmds_.begin(), cmds_.end(), [&i](auto const& cmd){ return cmd.cmd == i; });
-            if (pos != cmds_.end() && pos->testfunc)
-            {
-                output << i << " ";
-                testfuncs.push_back(pos->testfunc);
-            }
-            else
-            {
-                output << "(cannot test " << i << ") ";
-            }
+            recorder_.reset();
+            output << "Recording stopped." << endl;
         }
+        else
+        {
+            output << "Not recording!" << endl;
+        }
+        return {};
     }
-    output << endl << endl;
 
-    if (testfuncs.empty())
+    auto recorder = std::make_unique<TraceWriter>(filename);
+    if (!recorder->ok())
     {
-        output << "No commands to test!" << endl;
+        output << "Cannot open file '" << filename << "'!" << endl;
         return {};
     }
 
-#ifdef USE_PERF_EVENT
-    output << setw(7) << "N" << " , " << setw(12) << "add (sec)" << " , " << setw(12) << "add (count)" << " , " << setw(12) << "cmds (sec)" << " , "
-           << setw(12) << "cmds (count)"  << " , " << setw(12) << "total (sec)" << " , " << setw(12) << "total (count)" << endl;
-#else
-    output << setw(7) << "N" << " , " << setw(12) << "add (sec)" << " , " << setw(12) << "cmds (sec)" << " , "
-           << setw(12) << "total (sec)" << endl;
-#endif
-    flush_output(output);
+    recorder_ = move(recorder);
+    output << "Recording commands to '" << filename << "'" << endl;
+    return {};
+}
 
-    auto stop = false;
-    for (unsigned int n : init_ns)
+MainProgram::CmdResult MainProgram::cmd_replay(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    TraceReader trace(filename);
+    if (!trace.ok())
     {
-        if (stop) { break; }
+        output << "Cannot open trace file '" << filename << "'!" << endl;
+        return {};
+    }
 
-        output << setw(7) << n << " , " << flush;
+    // Timing statistics for each command, in the order the commands were first replayed
+    struct ReplayStats
+    {
+        string cmd;
+        unsigned long int count = 0;
+        double total = 0;
+        double max = 0;
+    };
+    vector<ReplayStats> stats;
 
-        ds_.clear_all();
-        ds_.clear_roads();
-        init_primes();
+    unsigned long int replayed = 0;
+    unsigned long int skipped = 0;
+    unsigned long int differing = 0;
+    ostringstream dummyoutput; // Output of the replayed commands is discarded
 
-        Stopwatch stopwatch(true); // Use also instruction counting, if enabled
+    TraceRecord record;
+    while (trace.read(record))
+    {
+        // The commands are called directly with the recorded parameters, no parsing needed
+        auto pos = find_cmd(record.cmd);
+        if (!pos || !pos->func || !is_recordable(pos->cmd) || record.params.size() != pos->param_count)
+        {
+            ++skipped;
+            continue;
+        }
 
-        // Add random towns
-        for (unsigned int i = 0; i < n / 1000; ++i)
+        Stopwatch stopwatch;
+        CmdResult result;
+        try
         {
             stopwatch.start();
-            add_random_towns(1000);
+            result = (this->*(pos->func))(dummyoutput, record.params.cbegin(), record.params.cend());
             stopwatch.stop();
+        }
+        catch (NotImplemented const& e)
+        {
+            output << "NotImplemented from replayed cmd " << pos->cmd << " : " << e.what() << endl;
+            ++skipped;
+            continue;
+        }
+        catch (std::invalid_argument const&)
+        {
+            ++skipped;
+            continue;
+        }
+        dummyoutput.str(string());
 
-            if (stopwatch.elapsed() >= timeout)
-            {
-                output << "Timeout!" << endl;
-                stop = true;
-                break;
-            }
-            if (check_stop())
-            {
-                output << "Stopped!" << endl;
-                stop = true;
-                break;
-            }
+        auto cmdstats = find_if(stats.begin(), stats.end(), [&record](ReplayStats const& s) { return s.cmd == record.cmd; });
+        if (cmdstats == stats.end())
+        {
+            stats.push_back({record.cmd});
+            cmdstats = stats.end()-1;
         }
-        if (stop) { break; }
+        auto elapsed = stopwatch.elapsed();
+        ++cmdstats->count;
+        cmdstats->total += elapsed;
+        cmdstats->max = max(cmdstats->max, elapsed);
 
-        if (n % 1000 != 0)
+        if (static_cast<std::uint8_t>(result.first) != record.result_type || result.second.size() != record.result_size)
         {
-            stopwatch.start();
-            add_random_towns(n % 1000);
-            stopwatch.stop();
+            ++differing;
         }
+        ++replayed;
+    }
 
-        // Add random roads
-        for (unsigned int i = 0; i < n / 1000; ++i)
+    if (trace.corrupted())
+    {
+        output << "Trace file '" << filename << "' is corrupted, replay stopped early!" << endl;
+    }
+
+    output << "Replayed " << replayed << " commands from '" << filename << "'";
+    if (skipped > 0) { output << ", skipped " << skipped; }
+    output << endl;
+
+    output << setw(26) << "command" << " , " << setw(9) << "count" << " , " << setw(12) << "total (sec)" << " , "
+           << setw(12) << "mean (sec)" << " , " << setw(12) << "max (sec)" << endl;
+    for (auto const& s : stats)
+    {
+        output << setw(26) << s.cmd << " , " << setw(9) << s.count << " , " << setw(12) << s.total << " , "
+               << setw(12) << s.total / s.count << " , " << setw(12) << s.max << endl;
+    }
+
+    if (differing > 0)
+    {
+        output << differing << " command(s) returned a different result type or size than in the recording!" << endl;
+    }
+
+    view_dirty = true;
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_parse_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    string repeatstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    unsigned int repeat_count = repeatstr.empty() ? 1 : convert_string_to<unsigned int>(repeatstr);
+
+    MappedFile input(filename);
+    if (!input.ok())
+    {
+        output << "Cannot open file '" << filename << "'!" << endl;
+        return {};
+    }
+
+    // Only parse the lines, nothing is executed
+    vector<string_view> lines;
+    LineReader reader(input.contents());
+    string_view line;
+    while (reader.getline(line))
+    {
+        if (!line.empty()) { lines.push_back(line); }
+    }
+
+    using ParseFunc = ParseStatus(MainProgram::*)(string_view, CmdInfo const*&, Params&);
+    vector<pair<string, ParseFunc>> const parsers{{"tokenizer", &MainProgram::parse_command},
+                                                  {"regex", &MainProgram::parse_command_regex}};
+
+    init_reference_regexs(); // Not counted in the regex parsing time
+
+    output << "Parsing " << lines.size() << " lines from '" << filename << "' " << repeat_count << " time(s)" << endl;
+    output << setw(10) << "parser" << " , " << setw(12) << "total (sec)" << " , " << setw(12) << "lines/sec" << endl;
+    for (auto const& [name, parser] : parsers)
+    {
+        unsigned long int ok_count = 0; // Used so that the parsing isn't optimized away
+        CmdInfo const* cmd = nullptr;
+        Params params;
+        Stopwatch stopwatch;
+        stopwatch.start();
+        for (unsigned int i = 0; i < repeat_count; ++i)
         {
-            stopwatch.start();
-            add_random_roads(1000);
-            stopwatch.stop();
+            for (auto const& l : lines)
+            {
+                if ((this->*parser)(l, cmd, params) == ParseStatus::OK) { ++ok_count; }
+            }
+        }
+        stopwatch.stop();
+        auto elapsed = stopwatch.elapsed();
+        output << setw(10) << name << " , " << setw(12) << elapsed << " , " << setw(12)
+               << (elapsed > 0 ? (static_cast<double>(lines.size()) * repeat_count / elapsed) : 0) << endl;
+        if (ok_count == 0 && !lines.empty()) { output << "No valid commands in the file!" << endl; }
+    }
+
+    // Both parsers must accept and reject exactly the same lines
+    unsigned long int differing = 0;
+    for (auto const& l : lines)
+    {
+        CmdInfo const* cmd1 = nullptr;
+        CmdInfo const* cmd2 = nullptr;
+        Params params1;
+        Params params2;
+        auto status1 = parse_command(l, cmd1, params1);
+        auto status2 = parse_command_regex(l, cmd2, params2);
+        if (status1 != status2 || (status1 != ParseStatus::UNKNOWN_CMD && cmd1 != cmd2) ||
+            (status1 == ParseStatus::OK && params1 != params2))
+        {
+            if (differing == 0) { output << "First difference between the parsers: " << l << endl; }
+            ++differing;
+        }
+    }
+    if (differing > 0)
+    {
+        output << differing << " line(s) parsed differently by the parsers!" << endl;
+    }
 
-            if (stopwatch.elapsed() >= timeout)
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_concurrent_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string sizestr = *begin++;
+    string secondsstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto size = convert_string_to<unsigned int>(sizestr);
+    auto seconds = convert_string_to<unsigned int>(secondsstr);
+    if (size < 2 || seconds == 0)
+    {
+        output << "Need at least 2 towns and 1 second per run!" << endl;
+        return {};
+    }
+
+    // The benchmark uses its own database, the main one is left untouched
+    BulkData data;
+    generate_bulk_data(size, size, data);
+    vector<TownID> ids;
+    ids.reserve(data.towns.size());
+    for (auto const& town : data.towns) { ids.push_back(town.id); }
+
+    output << "Concurrent queries on " << size << " towns with one writer, " << seconds << " sec per run" << endl;
+    output << setw(7) << "readers" << " , " << setw(12) << "queries/sec" << " , " << setw(12) << "per reader" << " , "
+           << setw(12) << "edits/sec" << endl;
+    for (unsigned int readers : {1, 2, 4, 8})
+    {
+        ConcurrentDatastructures cds;
+        cds.add_towns(data.towns);
+        cds.add_vassalships(data.vassalships);
+        cds.add_roads(data.roads);
+
+        atomic<bool> stop = false;
+        vector<unsigned long int> query_counts(readers, 0);
+        unsigned long int edit_count = 0;
+
+        // Each thread has its own random engine, seeded from the main one so that runs are repeatable
+        auto reader = [&cds, &ids, &stop](minstd_rand::result_type seed, unsigned long int& count)
+        {
+            minstd_rand engine(seed);
+            uniform_int_distribution<std::size_t> pick(0, ids.size()-1);
+            unsigned long int local_count = 0; // Not updating the shared vector in the loop avoids false sharing
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                auto const& id = ids[pick(engine)];
+                switch (local_count % 8)
+                {
+                case 0: case 1: case 2: cds.get_town_name(id); break;
+                case 3: case 4: cds.get_town_coordinates(id); break;
+                case 5: cds.get_roads_from(id); break;
+                case 6: cds.taxer_path(id); break;
+                default: cds.least_towns_route(id, ids[pick(engine)]); break;
+                }
+                ++local_count;
+            }
+            count = local_count;
+        };
+
+        // The writer keeps changing names and roads, so the readers have to wait for it now and then
+        auto writer = [this, &cds, &ids, &stop, &edit_count](minstd_rand::result_type seed)
+        {
+            minstd_rand engine(seed);
+            uniform_int_distribution<std::size_t> pick(0, ids.size()-1);
+            unsigned long int local_count = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                auto const& id1 = ids[pick(engine)];
+                auto const& id2 = ids[pick(engine)];
+                switch (local_count % 3)
+                {
+                case 0: cds.add_road(id1, id2); break;
+                case 1: cds.remove_road(id1, id2); break;
+                default: cds.change_town_name(id1, n_to_name(pick(engine))); break;
+                }
+                ++local_count;
+            }
+            edit_count = local_count;
+        };
+
+        vector<thread> threads;
+        threads.reserve(readers + 1);
+        for (unsigned int i = 0; i < readers; ++i)
+        {
+            threads.emplace_back(reader, rand_engine_(), std::ref(query_counts[i]));
+        }
+        threads.emplace_back(writer, rand_engine_());
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        stop = true;
+        for (auto& t : threads) { t.join(); }
+
+        auto queries = std::accumulate(query_counts.begin(), query_counts.end(), 0ul);
+        output << setw(7) << readers << " , " << setw(12) << queries / seconds << " , " << setw(12) << queries / seconds / readers
+               << " , " << setw(12) << edit_count / seconds << endl;
+    }
+
+    return {};
+}
+
+namespace
+{
+// Latencies of the reader queries, and the short edits and long writes done during one mixed run
+struct MixedRunResult
+{
+    vector<std::chrono::nanoseconds::rep> latencies;
+    unsigned long int edit_count = 0;
+    double edit_seconds = 0;
+    unsigned long int long_write_count = 0;
+    double long_write_seconds = 0;
+};
+
+// The writer makes short edits for this long before the first long write, and between long writes
+constexpr auto LONG_WRITE_PERIOD = std::chrono::seconds(1);
+
+// Readers time every query while one writer keeps editing: adding and removing roads and
+// renaming towns. Once every LONG_WRITE_PERIOD, after a warm-up of short edits, the writer
+// does a trim_road_network() and adds the trimmed roads back in one add_roads(), so that the
+// readers have to cope with long writes too. The long writes are timed separately, so that
+// they don't hide the throughput of the short edits.
+template <typename Database>
+MixedRunResult run_mixed_workload(Database& db, vector<TownSpec> const& towns, vector<pair<TownID, TownID>> const& roads,
+                                  unsigned int readers, unsigned int seconds, minstd_rand& seed_engine)
+{
+    using Clock = std::chrono::steady_clock;
+    atomic<bool> stop = false;
+    vector<vector<std::chrono::nanoseconds::rep>> latencies(readers);
+    MixedRunResult result;
+
+    auto reader = [&db, &towns, &stop](minstd_rand::result_type seed, vector<std::chrono::nanoseconds::rep>& samples)
+    {
+        minstd_rand engine(seed);
+        uniform_int_distribution<std::size_t> pick(0, towns.size()-1);
+        for (unsigned long int i = 0; !stop.load(std::memory_order_relaxed); ++i)
+        {
+            auto const& id = towns[pick(engine)].id;
+            auto start = Clock::now();
+            switch (i % 8)
+            {
+            case 0: case 1: db.get_town_name(id); break;
+            case 2: case 3: db.get_town_coordinates(id); break;
+            case 4: db.get_town_tax(id); break;
+            case 5: db.taxer_path(id); break;
+            case 6: db.get_roads_from(id); break;
+            default: db.least_towns_route(id, towns[pick(engine)].id); break;
+            }
+            samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+    };
+
+    auto writer = [&db, &towns, &roads, &stop, &result](minstd_rand::result_type seed)
+    {
+        minstd_rand engine(seed);
+        uniform_int_distribution<std::size_t> pick(0, towns.size()-1);
+        std::chrono::duration<double> edit_time{0};
+        std::chrono::duration<double> long_write_time{0};
+        auto next_long_write = Clock::now() + LONG_WRITE_PERIOD;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            auto start = Clock::now();
+            if (start >= next_long_write)
+            {
+                db.trim_road_network();
+                db.add_roads(roads);
+                auto finish = Clock::now();
+                long_write_time += finish - start;
+                ++result.long_write_count;
+                next_long_write = finish + LONG_WRITE_PERIOD;
+                continue;
+            }
+
+            auto const& town1 = towns[pick(engine)];
+            auto const& town2 = towns[pick(engine)];
+            switch (result.edit_count % 16)
+            {
+            case 0: db.change_town_name(town1.id, town2.name); break;
+            default:
+                if (result.edit_count % 2 == 0) { db.add_road(town1.id, town2.id); }
+                else { db.remove_road(town1.id, town2.id); }
+            }
+            edit_time += Clock::now() - start;
+            ++result.edit_count;
+        }
+        result.edit_seconds = edit_time.count();
+        result.long_write_seconds = long_write_time.count();
+    };
+
+    vector<thread> threads;
+    threads.reserve(readers + 1);
+    for (unsigned int i = 0; i < readers; ++i)
+    {
+        threads.emplace_back(reader, seed_engine(), std::ref(latencies[i]));
+    }
+    threads.emplace_back(writer, seed_engine());
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& t : threads) { t.join(); }
+
+    for (auto const& samples : latencies)
+    {
+        result.latencies.insert(result.latencies.end(), samples.begin(), samples.end());
+    }
+    return result;
+}
+}
+
+MainProgram::CmdResult MainProgram::cmd_snapshot_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string sizestr = *begin++;
+    string secondsstr = *begin++;
+    string readersstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto size = convert_string_to<unsigned int>(sizestr);
+    auto seconds = convert_string_to<unsigned int>(secondsstr);
+    auto readers = convert_string_to<unsigned int>(readersstr);
+    if (size < 2 || seconds == 0 || readers == 0)
+    {
+        output << "Need at least 2 towns, 1 second per run and 1 reader!" << endl;
+        return {};
+    }
+
+    // The benchmark uses its own databases, the main one is left untouched
+    BulkData data;
+    generate_bulk_data(size, size, data);
+
+    output << "Mixed queries and edits on " << size << " towns, " << readers << " reader(s) and one writer, "
+           << seconds << " sec per run" << endl;
+    output << setw(10) << "database" << " , " << setw(12) << "queries/sec" << " , " << setw(10) << "p50 (us)" << " , "
+           << setw(10) << "p99 (us)" << " , " << setw(10) << "max (us)" << " , " << setw(10) << "edits/sec" << " , "
+           << setw(11) << "long writes" << " , " << setw(13) << "long write ms" << endl;
+
+    auto print_result = [&output, seconds](string const& name, MixedRunResult& result)
+    {
+        auto& latencies = result.latencies;
+        auto percentile = [&latencies](double p)
+        {
+            if (latencies.empty()) { return 0.0; }
+            auto nth = latencies.begin() + static_cast<std::ptrdiff_t>(p * (latencies.size()-1));
+            std::nth_element(latencies.begin(), nth, latencies.end());
+            return *nth / 1000.0;
+        };
+        output << setw(10) << name << " , " << setw(12) << latencies.size() / seconds << " , " << setw(10) << percentile(0.5)
+               << " , " << setw(10) << percentile(0.99) << " , " << setw(10) << percentile(1.0) << " , " << setw(10);
+        // The edit throughput is over the time spent in short edits, and only shown once one has finished
+        if (result.edit_count > 0 && result.edit_seconds > 0) { output << static_cast<unsigned long int>(result.edit_count / result.edit_seconds); }
+        else { output << "-"; }
+        output << " , " << setw(11) << result.long_write_count << " , " << setw(13);
+        if (result.long_write_count > 0) { output << 1000 * result.long_write_seconds / result.long_write_count; }
+        else { output << "-"; }
+        output << endl;
+    };
+
+    {
+        ConcurrentDatastructures locked;
+        locked.add_towns(data.towns);
+        locked.add_vassalships(data.vassalships);
+        locked.add_roads(data.roads);
+        auto result = run_mixed_workload(locked, data.towns, data.roads, readers, seconds, rand_engine_);
+        print_result("locked", result);
+    }
+    {
+        SnapshotDatastructures snapshots;
+        snapshots.add_towns(data.towns);
+        snapshots.add_vassalships(data.vassalships);
+        snapshots.add_roads(data.roads);
+        auto result = run_mixed_workload(snapshots, data.towns, data.roads, readers, seconds, rand_engine_);
+        print_result("snapshot", result);
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_log_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string countstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto count = convert_string_to<unsigned int>(countstr);
+    if (count < 2)
+    {
+        output << "Need at least 2 changes!" << endl;
+        return {};
+    }
+
+    // The same changes for every run: new towns, with a road to an earlier town after every
+    // fourth one and a rename of an earlier town after every eighth one
+    vector<TownSpec> towns;
+    towns.reserve(count);
+    vector<unsigned int> others;
+    others.reserve(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        towns.push_back({n_to_townid(i), n_to_name(i), {random<int>(1, 10000), random<int>(1, 10000)}, random<int>(1, 100)});
+        others.push_back(i > 0 ? random<unsigned int>(0, i) : 0);
+    }
+
+    auto directory = (std::filesystem::temp_directory_path() / ("prg2-log-benchmark-" + std::to_string(random<unsigned int>(0, 1000000)))).string();
+
+    struct Run
+    {
+        char const* name;
+        bool logged;
+        MutationLogSettings settings;
+    };
+    MutationLogSettings every_change;
+    every_change.group_size = 1;
+    Run const runs[] = { {"off", false, {}}, {"group commit", true, {}}, {"sync every change", true, every_change} };
+
+    output << "Adding " << count << " towns with " << count / 4 << " roads and " << count / 8 << " renames" << endl;
+    output << setw(18) << "log" << " , " << setw(12) << "time (sec)" << " , " << setw(12) << "changes/sec" << " , "
+           << setw(8) << "syncs" << " , " << setw(8) << "slowdown" << endl;
+    double base_time = 0;
+    for (auto const& run : runs)
+    {
+        std::error_code ignored;
+        std::filesystem::remove_all(directory, ignored);
+
+        Datastructures ds;
+        string error;
+        if (run.logged && !ds.open_log(directory, run.settings, error))
+        {
+            output << error << "!" << endl;
+            return {};
+        }
+
+        Stopwatch stopwatch;
+        stopwatch.start();
+        unsigned long int changes = 0;
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            auto const& town = towns[i];
+            changes += ds.add_town(town.id, town.name, town.coord, town.tax);
+            if (i % 4 == 3) { changes += ds.add_road(town.id, towns[others[i]].id); }
+            if (i % 8 == 7) { changes += ds.change_town_name(towns[others[i]].id, town.name); }
+        }
+        auto syncs = run.logged ? ds.mutation_log()->syncs() : 0;
+        if (run.logged && !ds.close_log(error))
+        {
+            output << error << "!" << endl;
+            return {};
+        }
+        stopwatch.stop();
+
+        auto time = stopwatch.elapsed();
+        if (!run.logged) { base_time = time; }
+        output << setw(18) << run.name << " , " << setw(12) << time << " , " << setw(12)
+               << static_cast<unsigned long int>(time > 0 ? changes / time : 0) << " , " << setw(8) << syncs
+               << " , " << setw(8) << (base_time > 0 ? time / base_time : 0) << endl;
+
+        // Recovery loads the last checkpoint and replays the changes after it
+        if (run.logged)
+        {
+            Datastructures recovered;
+            stopwatch.reset();
+            stopwatch.start();
+            if (!recovered.open_log(directory, run.settings, error))
+            {
+                output << error << "!" << endl;
+                return {};
+            }
+            stopwatch.stop();
+            output << setw(18) << "" << "   recovered " << recovered.town_count() << " towns in " << stopwatch.elapsed()
+                   << " sec, replaying " << recovered.mutation_log()->replayed() << " changes" << endl;
+            if (recovered.town_count() != ds.town_count() || recovered.all_roads() != ds.all_roads())
+            {
+                output << "The recovered database differs!" << endl;
+            }
+        }
+    }
+
+    std::error_code ignored;
+    std::filesystem::remove_all(directory, ignored);
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_sort_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string maxsizestr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto max_size = convert_string_to<unsigned int>(maxsizestr);
+
+    // Same kind of data as towns_nearest() sorts: random towns' distances from a point, and pointers to their ids
+    struct TownDistance
+    {
+        TownID const* id;
+        Distance distance;
+    };
+    auto key = [](TownDistance const& town) { return town.distance; };
+    auto tie_less = [](TownDistance const& town1, TownDistance const& town2) { return *town1.id < *town2.id; };
+    auto less = [](TownDistance const& town1, TownDistance const& town2)
+    {
+        return std::tie(town1.distance, *town1.id) < std::tie(town2.distance, *town2.id);
+    };
+
+    output << "Sorting towns by distance" << endl;
+    output << setw(10) << "N" << " , " << setw(15) << "std::sort (sec)" << " , " << setw(14) << "radix (sec)" << " , "
+           << setw(8) << "speedup" << endl;
+    for (unsigned long int size = 1000; size <= max_size; size *= 10)
+    {
+        vector<TownID> ids;
+        ids.reserve(size);
+        vector<TownDistance> towns;
+        towns.reserve(size);
+        for (unsigned long int i = 0; i < size; ++i)
+        {
+            ids.push_back(n_to_townid(i));
+            Coord coord{random<int>(1, 10000), random<int>(1, 10000)};
+            towns.push_back({nullptr, static_cast<Distance>(std::sqrt(coord.x*coord.x + coord.y*coord.y))});
+        }
+        for (unsigned long int i = 0; i < size; ++i) { towns[i].id = &ids[i]; }
+
+        auto comparison_sorted = towns;
+        Stopwatch stopwatch;
+        stopwatch.start();
+        std::sort(comparison_sorted.begin(), comparison_sorted.end(), less);
+        stopwatch.stop();
+        auto comparison_time = stopwatch.elapsed();
+
+        auto radix_sorted = towns;
+        stopwatch.reset();
+        stopwatch.start();
+        radix_sort(radix_sorted, key, tie_less);
+        stopwatch.stop();
+        auto radix_time = stopwatch.elapsed();
+
+        output << setw(10) << size << " , " << setw(15) << comparison_time << " , " << setw(14) << radix_time << " , "
+               << setw(8) << (radix_time > 0 ? comparison_time / radix_time : 0) << endl;
+
+        auto same_order = std::equal(comparison_sorted.begin(), comparison_sorted.end(), radix_sorted.begin(),
+                                     [](auto const& town1, auto const& town2) { return town1.id == town2.id; });
+        if (!same_order) { output << "The sorts gave different orders!" << endl; }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_hash_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string maxsizestr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto max_size = convert_string_to<unsigned int>(maxsizestr);
+
+    // Inserts N ids, finds them all and N missing ids in random order, then erases them all,
+    // first with the kind of std::unordered_map the database used before and then with FlatTownMap
+    using ChainedMap = std::unordered_map<TownID, unsigned long int, std::hash<TownID>, std::equal_to<TownID>,
+                                          PoolAllocator<std::pair<const TownID, unsigned long int>>>;
+    using FlatMap = FlatTownMap<unsigned long int>;
+
+    output << "Hash table operations, ns per operation" << endl;
+    output << setw(10) << "N" << " , " << setw(18) << "table" << " , " << setw(8) << "insert" << " , " << setw(8) << "find"
+           << " , " << setw(8) << "miss" << " , " << setw(8) << "erase" << endl;
+    for (unsigned long int size = 1000; size <= max_size; size *= 10)
+    {
+        vector<TownID> ids;
+        ids.reserve(size);
+        vector<TownID> missing_ids;
+        missing_ids.reserve(size);
+        for (unsigned long int i = 0; i < size; ++i)
+        {
+            ids.push_back(n_to_townid(i));
+            missing_ids.push_back(n_to_townid(size + i));
+        }
+        auto lookup_ids = ids;
+        shuffle(lookup_ids.begin(), lookup_ids.end(), rand_engine_);
+        shuffle(missing_ids.begin(), missing_ids.end(), rand_engine_);
+
+        auto run = [&](auto& map, string const& name)
+        {
+            auto per_operation = [size](Stopwatch& stopwatch) { return stopwatch.elapsed() * 1e9 / size; };
+            Stopwatch stopwatch;
+            stopwatch.start();
+            for (unsigned long int i = 0; i < size; ++i) { map.insert({ids[i], i}); }
+            stopwatch.stop();
+            auto insert_time = per_operation(stopwatch);
+
+            unsigned long int found = 0;
+            stopwatch.reset();
+            stopwatch.start();
+            for (auto const& id : lookup_ids) { found += map.find(id)->second; }
+            stopwatch.stop();
+            auto find_time = per_operation(stopwatch);
+
+            stopwatch.reset();
+            stopwatch.start();
+            for (auto const& id : missing_ids) { found += (map.find(id) == map.end()) ? 0 : 1; }
+            stopwatch.stop();
+            auto miss_time = per_operation(stopwatch);
+
+            stopwatch.reset();
+            stopwatch.start();
+            for (auto const& id : lookup_ids) { map.erase(id); }
+            stopwatch.stop();
+            auto erase_time = per_operation(stopwatch);
+
+            output << setw(10) << size << " , " << setw(18) << name << " , " << setw(8) << insert_time << " , " << setw(8) << find_time
+                   << " , " << setw(8) << miss_time << " , " << setw(8) << erase_time << endl;
+            if (found != size * (size - 1) / 2 || !map.empty()) { output << "The " << name << " gave wrong results!" << endl; }
+        };
+
+        {
+            SizeClassPool pool;
+            ChainedMap chained{ ChainedMap::allocator_type{ &pool } };
+            run(chained, "std::unordered_map");
+        }
+        {
+            SizeClassPool pool;
+            FlatMap flat{ FlatMap::allocator_type{ &pool } };
+            run(flat, "FlatTownMap");
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_testread(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string infilename = *begin++;
+    string outfilename = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    MappedFile input(infilename);
+    if (input.ok())
+    {
+        MappedFile expected_output(outfilename);
+        if (expected_output.ok())
+        {
+            // The actual output is written to a temporary file and compared to the expected output line by line,
+            // so neither of them has to fit in memory
+            static unsigned int testread_count = 0; // testreads can be nested
+            auto actual_filename = (std::filesystem::temp_directory_path() /
+                                    ("prg2-testread-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+                                     + "-" + std::to_string(++testread_count) + ".txt")).string();
+            struct RemoveFile
+            {
+                string filename;
+                ~RemoveFile() { std::remove(filename.c_str()); }
+            } remove_actual{actual_filename};
+
+            {
+                ofstream actual_file(actual_filename, std::ios::binary | std::ios::trunc);
+                if (!actual_file)
+                {
+                    output << "Cannot create temporary file '" << actual_filename << "'!" << endl;
+                    return {};
+                }
+                command_parser(input.contents(), actual_file, PromptStyle::NO_NESTING);
+            }
+
+            MappedFile actual_output(actual_filename);
+            if (!actual_output.ok())
+            {
+                output << "Cannot open file '" << actual_filename << "'!" << endl;
+                return {};
+            }
+
+            // First pass: column widths
+            auto max_line_length = [](string_view text, string_view heading)
+            {
+                auto max_length = heading.length();
+                LineReader lines(text);
+                string_view line;
+                while (lines.getline(line)) { max_length = max(max_length, line.length()); }
+                return max_length;
+            };
+            string heading_actual = "Actual output";
+            auto actual_max_length = max_line_length(actual_output.contents(), heading_actual);
+            string heading_expected = "Expected output";
+            auto expected_max_length = max_line_length(expected_output.contents(), heading_expected);
+
+            output << "  " << heading_actual << string(actual_max_length - heading_actual.length(), ' ') << " | " << heading_expected << endl;
+            output << "--" << string(actual_max_length, '-') << "-|-" << string(expected_max_length, '-') << endl;
+
+            // Second pass: the comparison
+            LineReader actual_lines(actual_output.contents());
+            LineReader expected_lines(expected_output.contents());
+            string_view actual_line;
+            string_view expected_line;
+            bool actual_left = actual_lines.getline(actual_line);
+            bool expected_left = expected_lines.getline(expected_line);
+
+            bool lines_ok = true;
+            while (expected_left || actual_left)
+            {
+                if (expected_left)
+                {
+                    if (actual_left)
+                    {
+                        bool ok = (expected_line == actual_line);
+                        output << (ok ? ' ' : '?') << ' ' << actual_line << string(actual_max_length - actual_line.length(), ' ')
+                               << " | " << expected_line << endl;
+                        lines_ok = lines_ok && ok;
+                        actual_left = actual_lines.getline(actual_line);
+                    }
+                    else
+                    { // Actual output was too short
+                        output << "? " << string(actual_max_length, ' ')
+                               << " | " << expected_line << endl;
+                        lines_ok = false;
+                    }
+                    expected_left = expected_lines.getline(expected_line);
+                }
+                else
+                { // Actual output was too long
+                    output << "? " << actual_line << string(actual_max_length - actual_line.length(), ' ')
+                           << " | " << endl;
+                    lines_ok = false;
+                    actual_left = actual_lines.getline(actual_line);
+                }
+            }
+            if (lines_ok)
+            {
+                output << "**No differences in output.**" << endl;
+                if (test_status_ == TestStatus::NOT_RUN)
+                {
+                    test_status_ = TestStatus::NO_DIFFS;
+                }
+            }
+            else
+            {
+                output << "**Differences found! (Lines beginning with '?')**" << endl;
+                test_status_ = TestStatus::DIFFS_FOUND;
+            }
+
+        }
+        else
+        {
+            output << "Cannot open file '" << outfilename << "'!" << endl;
+        }
+    }
+    else
+    {
+        output << "Cannot open file '" << infilename << "'!" << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_stopwatch(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string on = *begin++;
+    string off = *begin++;
+    string next = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    if (!on.empty())
+    {
+        stopwatch_mode = StopwatchMode::ON;
+        output << "Stopwatch: on" << endl;
+    }
+    else if (!off.empty())
+    {
+        stopwatch_mode = StopwatchMode::OFF;
+        output << "Stopwatch: off" << endl;
+    }
+    else if (!next.empty())
+    {
+        stopwatch_mode = StopwatchMode::NEXT;
+        output << "Stopwatch: on for the next command" << endl;
+    }
+    else
+    {
+        assert(!"Impossible stopwatch mode!");
+    }
+
+    return {};
+}
+
+std::string MainProgram::print_town_name(TownID const& id, std::ostream &output, bool nl)
+{
+    string storage;
+    OutputBuffer buffer(output, storage);
+    print_town_name(id, buffer, nl);
+    try
+    {
+        return (id != NO_TOWNID) ? ds_.get_town_name(id) : "";
+    }
+    catch (NotImplemented const&)
+    {
+        return "";
+    }
+}
+
+void MainProgram::print_town_name(TownID const& id, OutputBuffer& output, bool nl)
+{
+    try
+    {
+        print_town_name(TownView{ id, (id != NO_TOWNID) ? ds_.get_town_info(id) : TownInfo{} }, output, nl);
+    }
+    catch (NotImplemented const& e)
+    {
+        output << '\n' << "NotImplemented while printing town name : " << e.what() << '\n';
+        std::cerr << endl << "NotImplemented while printing town name : " << e.what() << endl;
+    }
+}
+
+void MainProgram::print_town_name(TownView const& town, OutputBuffer& output, bool nl)
+{
+    if (town.id != NO_TOWNID.view())
+    {
+        if (!town.info.name.empty())
+        {
+            output << town.info.name;
+        }
+        else
+        {
+            output << "*";
+        }
+
+        if (nl) { output << '\n'; }
+    }
+    else
+    {
+        output << "--NO_TOWNID--";
+        if (nl) { output << '\n'; }
+    }
+}
+
+std::string MainProgram::print_coord(Coord coord, std::ostream& output, bool nl)
+{
+    string storage;
+    OutputBuffer buffer(output, storage);
+    print_coord(coord, buffer, nl);
+    if (coord == NO_COORD) { return ""; }
+    return "(" + std::to_string(coord.x) + "," + std::to_string(coord.y) + ")";
+}
+
+void MainProgram::print_coord(Coord coord, OutputBuffer& output, bool nl)
+{
+    if (coord != NO_COORD)
+    {
+        output << '(' << coord.x << ',' << coord.y << ')';
+    }
+    else
+    {
+        output << "(--NO_COORD--)";
+    }
+    if (nl) { output << '\n'; }
+}
+
+string const townidx = "([a-zA-Z0-9]+)";
+string const namex = "([a-zA-Z0-9-]+)";
+string const numx = "([0-9]+)";
+string const optcoordx = "\\([[:space:]]*[0-9]+[[:space:]]*,[[:space:]]*[0-9]+[[:space:]]*\\)";
+string const coordx = "\\([[:space:]]*([0-9]+)[[:space:]]*,[[:space:]]*([0-9]+)[[:space:]]*\\)";
+string const wsx = "[[:space:]]+";
+string const listx = "(towns_alphabetically|towns_distance_increasing|all_roads)";
+
+vector<MainProgram::CmdInfo> MainProgram::cmds_ =
+{
+    {"add_town", "ID Name (x,y) tax", townidx+wsx+namex+wsx+coordx+wsx+numx, &MainProgram::cmd_add_town, nullptr },
+    {"random_add", "number_of_towns_to_add  (minx,miny) (maxx,maxy) (coordinates optional)",
+     numx+"(?:"+wsx+coordx+wsx+coordx+")?", &MainProgram::cmd_random_add, &MainProgram::test_random_add },
+    {"random_roads", "max_number_of_roads_to_add", numx,
+     &MainProgram::cmd_random_roads, &MainProgram::test_random_roads },
+    {"random_road_network", "", "", &MainProgram::cmd_random_road_network, nullptr },
+    {"print_town", "TownID", townidx, &MainProgram::cmd_print_town, &MainProgram::test_print_town },
+    {"all_towns", "", "", &MainProgram::cmd_all_towns, &MainProgram::test_all_towns },
+    {"all_roads", "", "", &MainProgram::cmd_all_roads, &MainProgram::test_all_roads },
+    {"town_count", "", "", &MainProgram::cmd_town_count, nullptr },
+    {"clear_all", "", "", &MainProgram::cmd_clear_all, nullptr },
+    {"towns_alphabetically", "", "", &MainProgram::NoParViewCmd<&Datastructures::towns_alphabetically_view>, &MainProgram::NoParListTestCmd<&Datastructures::towns_alphabetically> },
+    {"towns_distance_increasing", "", "", &MainProgram::NoParListCmd<&Datastructures::towns_distance_increasing>,
+                                          &MainProgram::NoParListTestCmd<&Datastructures::towns_distance_increasing> },
+    {"page", "towns_alphabetically|towns_distance_increasing|all_roads offset limit (limit items of the list from offset on)",
+     listx+wsx+numx+wsx+numx, &MainProgram::cmd_page, nullptr },
+    {"page_after", "towns_alphabetically|towns_distance_increasing|all_roads limit [cursor] (limit items of the list after the cursor of the previous page)",
+     listx+wsx+numx+"(?:"+wsx+"([0-9a-f]+))?", &MainProgram::cmd_page_after, nullptr },
+    {"mindist", "", "", &MainProgram::NoParTownCmd<&Datastructures::min_distance>, &MainProgram::NoParTownTestCmd<&Datastructures::min_distance> },
+    {"maxdist", "", "", &MainProgram::NoParTownCmd<&Datastructures::max_distance>, &MainProgram::NoParTownTestCmd<&Datastructures::max_distance> },
+    {"towns_nearest", "(x,y)", coordx, &MainProgram::cmd_towns_nearest, &MainProgram::test_towns_nearest },
+    {"remove_town", "ID", townidx, &MainProgram::cmd_remove_town, &MainProgram::test_remove_town },
+    {"find_towns", "name", namex, &MainProgram::cmd_find_towns, &MainProgram::test_find_towns },
+    {"change_town_name", "ID newname", townidx+wsx+namex, &MainProgram::cmd_change_town_name, &MainProgram::test_change_town_name },
+    {"add_vassalship", "VassalID TaxerID", townidx+wsx+townidx, &MainProgram::cmd_add_vassalship, nullptr },
+    {"town_vassals", "TownID", townidx, &MainProgram::cmd_town_vassals, &MainProgram::test_town_vassals },
+    {"add_road", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_add_road, nullptr },
+    {"remove_road", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_remove_road, &MainProgram::test_remove_road },
+    {"roads_from", "TownID", townidx, &MainProgram::cmd_roads_from, &MainProgram::test_roads_from },
+    {"clear_roads", "", "", &MainProgram::cmd_clear_roads, nullptr },
+    {"taxer_path", "ID", townidx, &MainProgram::cmd_taxer_path, &MainProgram::test_taxer_path },
+    {"longest_vassal_path", "ID", townidx, &MainProgram::cmd_longest_vassal_path, &MainProgram::test_longest_vassal_path },
+    {"total_net_tax", "ID", townidx, &MainProgram::cmd_total_net_tax, &MainProgram::test_total_net_tax },
+    {"any_route", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_any_route, &MainProgram::test_any_route },
+    {"shortest_route", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_shortest_route, &MainProgram::test_shortest_route },
+    {"least_towns_route", "Town1ID Town2ID", townidx+wsx+townidx, &MainProgram::cmd_least_towns_route, &MainProgram::test_least_towns_route },
+    {"road_cycle_route", "TownID", townidx, &MainProgram::cmd_road_cycle_route, &MainProgram::test_road_cycle_route },
+    {"trim_road_network", "", "", &MainProgram::cmd_trim_road_network, &MainProgram::test_trim_road_network },
+    {"quit", "", "", nullptr, nullptr },
+    {"help", "", "", &MainProgram::help_command, nullptr },
+    {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
+    {"load_data", "\"in-filename\" (add_town, add_vassalship and add_road lines only)", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_load_data, nullptr },
+    {"save_snapshot", "\"out-filename\" (the whole database in binary)", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_save_snapshot, nullptr },
+    {"load_snapshot", "\"in-filename\" (replaces the database with one saved by save_snapshot)", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_load_snapshot, nullptr },
+    {"open_snapshot", "\"in-filename\" [check] (queries a file saved by save_snapshot in place, read-only)", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(check))?", &MainProgram::cmd_open_snapshot, nullptr },
+    {"close_snapshot", "(closes the snapshot opened by open_snapshot, leaving the database empty)", "", &MainProgram::cmd_close_snapshot, nullptr },
+    {"open_log", "\"directory\" [group_size [checkpoint_interval]] (recovers the database from the directory and logs the changes to it)",
+     "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+numx+"(?:"+wsx+numx+")?)?", &MainProgram::cmd_open_log, nullptr },
+    {"close_log", "", "", &MainProgram::cmd_close_log, nullptr },
+    {"checkpoint", "(writes the whole database to the mutation log's directory)", "", &MainProgram::cmd_checkpoint, nullptr },
+    {"testread", "\"in-filename\" \"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_testread, nullptr },
+    {"record", "\"trace-filename\"|off (alternatives separated by |)", "(?:\"([-a-zA-Z0-9 ./:_]+)\"|(off))", &MainProgram::cmd_record, nullptr },
+    {"replay", "\"trace-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_replay, nullptr },
+    {"parse_benchmark", "\"in-filename\" [repeat_count]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+numx+")?", &MainProgram::cmd_parse_benchmark, nullptr },
+    {"snapshot_benchmark", "town_count seconds_per_run reader_count (query latencies with a locked and a snapshot database)", numx+wsx+numx+wsx+numx,
+     &MainProgram::cmd_snapshot_benchmark, nullptr },
+    {"log_benchmark", "change_count (changes per second without the mutation log, with group commit and syncing every change)", numx, &MainProgram::cmd_log_benchmark, nullptr },
+    {"sort_benchmark", "max_size (std::sort and radix sort by distance for N = 1000, 10000, ... max_size)", numx, &MainProgram::cmd_sort_benchmark, nullptr },
+    {"hash_benchmark", "max_size (std::unordered_map and FlatTownMap insert, find and erase for N = 1000, 10000, ... max_size)", numx, &MainProgram::cmd_hash_benchmark, nullptr },
+    {"concurrent_benchmark", "town_count seconds_per_run (1, 2, 4 and 8 reader threads with one writer)", numx+wsx+numx, &MainProgram::cmd_concurrent_benchmark, nullptr },
+    {"perftest", "cmd1|all|compulsory[;cmd2...] timeout repeat_count n1[;n2...] [warmup=count] [trials=count] [bulk=0|1] [dist=uniform|zipf:s|hotspot:p] (parts in [] are optional, alternatives separated by |)",
+     "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)((?:"+wsx+"[a-z_]+=[-0-9a-zA-Z_.:]+)*)", &MainProgram::cmd_perftest, nullptr },
+    {"batch", "{ (followed by commands one per line and a closing }, consecutive read-only commands are run in parallel)", "\\{",
+     &MainProgram::cmd_batch, nullptr },
+    {"stopwatch", "on|off|next (alternatives separated by |)", "(?:(on)|(off)|(next))", &MainProgram::cmd_stopwatch, nullptr },
+    {"random_seed", "new-random-seed-integer", numx, &MainProgram::cmd_randseed, nullptr },
+    {"sort_threads", "[thread_count] (threads used for sorting, without a count prints the current one)", "(?:"+numx+")?", &MainProgram::cmd_sort_threads, nullptr },
+    {"#", "comment text", ".*", &MainProgram::cmd_comment, nullptr },
+};
+
+MainProgram::CmdResult MainProgram::help_command(std::ostream& output, MatchIter /*begin*/, MatchIter /*end*/)
+{
+    output << "Commands:" << endl;
+    for (auto& i : cmds_)
+    {
+        output << "  " << i.cmd << " " << i.info << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end)
+{
+#ifdef _GLIBCXX_DEBUG
+    output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
+#endif // _GLIBCXX_DEBUG
+
+    try {
+    // Note: everything below is indented too little by one indentation level! (because of try block above)
+
+    vector<string> optional_cmds({"remove_town", "towns_nearest", "longest_vassal_path", "total_net_tax"});
+    vector<string> nondefault_cmds({"remove_town", "find_towns"});
+
+    string commandstr = *begin++;
+    unsigned int timeout = convert_string_to<unsigned int>(*begin++);
+    unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
+    string sizes = *begin++;
+    string optionstr = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    PerftestOptions options;
+    if (!parse_perftest_options(optionstr, options, output))
+    {
+        return {};
+    }
+
+    vector<string> testcmds;
+    bool additional_get_cmds = true;
+    if (commandstr != "all" && commandstr != "compulsory")
+    {
+        additional_get_cmds = false;
+        smatch scmd;
+        auto cbeg = commandstr.cbegin();
+        auto cend = commandstr.cend();
+        for ( ; regex_search(cbeg, cend, scmd, commands_regex_); cbeg = scmd.suffix().first)
+        {
+            testcmds.push_back(scmd[1]);
+        }
+    }
+
+    vector<unsigned int> init_ns;
+    smatch size;
+    auto sbeg = sizes.cbegin();
+    auto send = sizes.cend();
+    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    {
+        init_ns.push_back(convert_string_to<unsigned int>(size[1]));
+    }
+
+    output << "Timeout for each N is " << timeout << " sec. " << endl;
+    if (options.warmup > 0)
+    {
+        output << "Before timing perform " << options.warmup << " untimed warm-up command(s)." << endl;
+    }
+    if (options.bulk)
+    {
+        output << "Generate the towns and roads in bulk and add them with the batch operations." << endl;
+    }
+    if (options.distribution.type == TownDistribution::ZIPF)
+    {
+        output << "Choose towns with a Zipf distribution (s=" << options.distribution.zipf_exponent << ")." << endl;
+    }
+    else if (options.distribution.type == TownDistribution::HOTSPOT)
+    {
+        output << "Choose towns and coordinates from a hotspot area with probability " << options.distribution.hotspot_probability << "." << endl;
+    }
+    if (options.trials > 1)
+    {
+        output << "Repeat each N " << options.trials << " times with fresh seeds, times are means over the trials." << endl;
+    }
+    output << "For each N perform " << repeat_count << " random command(s) from:" << endl;
+
+    // Initialize test functions
+    vector<void(MainProgram::*)()> testfuncs;
+    if (testcmds.empty())
+    { // Add all commands
+        for (auto& i : cmds_)
+        {
+            if (i.testfunc)
+            {
+                if (find(nondefault_cmds.begin(), nondefault_cmds.end(), i.cmd) == nondefault_cmds.end() &&
+                    (commandstr == "all" || find(optional_cmds.begin(), optional_cmds.end(), i.cmd) == optional_cmds.end()))
+                {
+                    output << i.cmd << " ";
+                    testfuncs.push_back(i.testfunc);
+                }
+            }
+        }
+    }
+    else
+    {
+        for (auto& i : testcmds)
+        {
+            auto pos = find_if(cmds_.begin(), cmds_.end(), [&i](auto const& cmd){ return cmd.cmd == i; });
+            if (pos != cmds_.end() && pos->testfunc)
+            {
+                output << i << " ";
+                testfuncs.push_back(pos->testfunc);
+            }
+            else
+            {
+                output << "(cannot test " << i << ") ";
+            }
+        }
+    }
+    output << endl << endl;
+
+    if (testfuncs.empty())
+    {
+        output << "No commands to test!" << endl;
+        return {};
+    }
+
+    bool stats = options.trials > 1;
+    output << setw(7) << "N" << " , ";
+    if (options.bulk) { output << setw(12) << "gen (sec)" << " , "; }
+    output << setw(12) << "add (sec)";
+    if (stats) { output << " , " << setw(12) << "add stddev"; }
+#ifdef USE_PERF_EVENT
+    output << " , " << setw(12) << "add (count)";
+#endif
+    output << " , " << setw(12) << "cmds (sec)";
+    if (stats) { output << " , " << setw(12) << "cmds stddev" << " , " << setw(12) << "cmds min"; }
+#ifdef USE_PERF_EVENT
+    output << " , " << setw(12) << "cmds (count)";
+#endif
+#ifdef COUNT_ALLOCATIONS
+    output << " , " << setw(12) << "add (allocs)" << " , " << setw(12) << "cmd (allocs)" << " , " << setw(12) << "get (allocs)";
+#endif
+    output << " , " << setw(12) << "gets (sec)" << " , " << setw(12) << "total (sec)";
+    output << " , " << setw(12) << "name B/town" << " , " << setw(12) << "str B/town" << endl;
+    flush_output(output);
+
+    auto stop = false;
+    for (unsigned int n : init_ns)
+    {
+        if (stop) { break; }
+
+        output << setw(7) << n << " , " << flush;
+
+        SampleStats genstats;
+        SampleStats addstats;
+        SampleStats cmdstats;
+        SampleStats getstats;
+        SampleStats addcounts;
+        SampleStats cmdcounts;
+        SampleStats addallocs;
+        SampleStats cmdallocs;
+        SampleStats getallocs;
+        SampleStats namebytes;
+        SampleStats stringbytes;
+        for (unsigned int trial = 0; trial < options.trials; ++trial)
+        {
+            // Each additional trial gets a fresh (but reproducible) random sequence
+            if (trial > 0) { rand_engine_.seed(rand_engine_()); }
+
+            PerftestSample sample;
+            if (!perftest_trial(output, n, testfuncs, additional_get_cmds, repeat_count, options, timeout, sample))
+            {
+                stop = true;
+                break;
+            }
+
+            genstats.add(sample.gensec);
+            addstats.add(sample.addsec);
+            cmdstats.add(sample.cmdsec);
+            getstats.add(sample.getsec);
+            addcounts.add(sample.addcount);
+            cmdcounts.add(sample.cmdcount);
+            addallocs.add(sample.addallocs);
+            cmdallocs.add(sample.cmdallocs);
+            getallocs.add(sample.getallocs);
+            namebytes.add(sample.namebytes);
+            stringbytes.add(sample.stringbytes);
+        }
+        if (stop) { break; }
+
+        if (options.bulk) { output << setw(12) << genstats.mean() << " , "; }
+        output << setw(12) << addstats.mean();
+        if (stats) { output << " , " << setw(12) << addstats.stddev(); }
+#ifdef USE_PERF_EVENT
+        output << " , " << setw(12) << static_cast<long long>(addcounts.mean());
+#endif
+        output << " , " << setw(12) << cmdstats.mean();
+        if (stats) { output << " , " << setw(12) << cmdstats.stddev() << " , " << setw(12) << cmdstats.min(); }
+#ifdef USE_PERF_EVENT
+        output << " , " << setw(12) << static_cast<long long>(cmdcounts.mean());
+#endif
+#ifdef COUNT_ALLOCATIONS
+        output << " , " << setw(12) << addallocs.mean() << " , " << setw(12) << cmdallocs.mean() << " , " << setw(12) << getallocs.mean();
+#endif
+        output << " , " << setw(12) << getstats.mean()
+               << " , " << setw(12) << addstats.mean()+cmdstats.mean()+getstats.mean();
+        output << " , " << setw(12) << namebytes.mean() << " , " << setw(12) << stringbytes.mean();
+
+//        unsigned long int maxmem;
+//        string unit;
+//        tie(maxmem, unit) = mempeak();
+//        maxmem -=  startmem;
+//        if (maxmem != 0)
+//        {
+//            output << ", memory " << maxmem << " " << unit;
+//        }
+        output << endl;
+        flush_output(output);
+    }
+
+    ds_.clear_all();
+    ds_.clear_roads();
+    init_primes();
+    init_test_distribution({});
+
+    }
+    catch (NotImplemented const&)
+    {
+        // Clean up after NotImplemented
+        ds_.clear_all();
+        init_primes();
+        init_test_distribution({});
+        throw;
+    }
+
+#ifdef _GLIBCXX_DEBUG
+    output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
+#endif // _GLIBCXX_DEBUG
+
+    return {};
+}
+
+bool MainProgram::parse_perftest_options(std::string const& optionstr, PerftestOptions& options, std::ostream& output)
+{
+    smatch option;
+    auto obeg = optionstr.cbegin();
+    auto oend = optionstr.cend();
+    for ( ; regex_search(obeg, oend, option, options_regex_); obeg = option.suffix().first)
+    {
+        string name = option[1];
+        string value = option[2];
+        try
+        {
+            if (name == "warmup")
+            {
+                options.warmup = convert_string_to<unsigned int>(value);
+            }
+            else if (name == "trials")
+            {
+                options.trials = convert_string_to<unsigned int>(value);
+                if (options.trials == 0)
+                {
+                    output << "Number of perftest trials must be at least 1!" << endl;
+                    return false;
+                }
+            }
+            else if (name == "dist")
+            {
+                auto colon = value.find(':');
+                string type = value.substr(0, colon);
+                string parameter = (colon != string::npos) ? value.substr(colon+1) : "";
+                if (type == "uniform" && parameter.empty())
+                {
+                    options.distribution.type = TownDistribution::UNIFORM;
+                }
+                else if (type == "zipf")
+                {
+                    options.distribution.type = TownDistribution::ZIPF;
+                    if (!parameter.empty()) { options.distribution.zipf_exponent = convert_string_to<double>(parameter); }
+                    if (!(options.distribution.zipf_exponent > 0))
+                    {
+                        output << "Zipf exponent must be positive!" << endl;
+                        return false;
+                    }
+                }
+                else if (type == "hotspot")
+                {
+                    options.distribution.type = TownDistribution::HOTSPOT;
+                    if (!parameter.empty()) { options.distribution.hotspot_probability = convert_string_to<double>(parameter); }
+                    if (!(options.distribution.hotspot_probability >= 0 && options.distribution.hotspot_probability <= 1))
+                    {
+                        output << "Hotspot probability must be between 0 and 1!" << endl;
+                        return false;
+                    }
+                }
+                else
+                {
+                    output << "Unknown town distribution '" << value << "'!" << endl;
+                    return false;
+                }
+            }
+            else if (name == "bulk")
+            {
+                options.bulk = convert_string_to<bool>(value);
+            }
+            else
+            {
+                output << "Unknown perftest option '" << name << "'!" << endl;
+                return false;
+            }
+        }
+        catch (std::invalid_argument const&)
+        {
+            output << "Invalid value '" << value << "' for perftest option '" << name << "'!" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MainProgram::perftest_trial(std::ostream& output, unsigned int n, std::vector<void(MainProgram::*)()> const& testfuncs,
+                                 bool additional_get_cmds, unsigned int repeat_count, PerftestOptions const& options,
+                                 unsigned int timeout, PerftestSample& sample)
+{
+    ds_.clear_all();
+    ds_.clear_roads();
+    init_primes();
+
+    Stopwatch stopwatch(true); // Use also instruction counting, if enabled
+#ifdef COUNT_ALLOCATIONS
+    auto addallocs = allocation_count();
+#endif
+
+    if (options.bulk)
+    {
+        // Generating the data isn't counted in the add time
+        BulkData data;
+        Stopwatch genwatch;
+        genwatch.start();
+        generate_bulk_data(n, n, data);
+        genwatch.stop();
+        sample.gensec = genwatch.elapsed();
+
+#ifdef COUNT_ALLOCATIONS
+        addallocs = allocation_count();
+#endif
+        stopwatch.start();
+        add_bulk_data(data);
+        stopwatch.stop();
+    }
+    else
+    {
+        // Add random towns
+        for (unsigned int i = 0; i < n / 1000; ++i)
+        {
+            stopwatch.start();
+            add_random_towns(1000);
+            stopwatch.stop();
+
+            if (stopwatch.elapsed() >= timeout)
+            {
+                output << "Timeout!" << endl;
+                return false;
+            }
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                return false;
+            }
+        }
+
+        if (n % 1000 != 0)
+        {
+            stopwatch.start();
+            add_random_towns(n % 1000);
+            stopwatch.stop();
+        }
+
+        // Add random roads
+        for (unsigned int i = 0; i < n / 1000; ++i)
+        {
+            stopwatch.start();
+            add_random_roads(1000);
+            stopwatch.stop();
+
+            if (stopwatch.elapsed() >= timeout)
+            {
+                output << "Timeout!" << endl;
+                return false;
+            }
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                return false;
+            }
+        }
+
+        if (n % 1000 != 0)
+        {
+            stopwatch.start();
+            add_random_roads(n % 1000);
+            stopwatch.stop();
+        }
+    }
+
+#ifdef USE_PERF_EVENT
+    sample.addcount = stopwatch.count();
+#endif
+#ifdef COUNT_ALLOCATIONS
+    if (n > 0) { sample.addallocs = static_cast<double>(allocation_count() - addallocs) / n; }
+#endif
+    sample.addsec = stopwatch.elapsed();
+
+    if (sample.addsec >= timeout)
+    {
+        output << "Timeout!" << endl;
+        return false;
+    }
+
+    init_test_distribution(options.distribution);
+
+    // Warm-up commands are the same random mix as the timed ones, they just aren't timed.
+    // This gets page faults and allocator growth after the build out of the measurements.
+    for (unsigned int warmup = 0; warmup < options.warmup; ++warmup)
+    {
+        auto cmdpos = random(testfuncs.begin(), testfuncs.end());
+        (this->**cmdpos)();
+        if (additional_get_cmds && random_towns_added_ > 0)
+        {
+            test_get_functions(n_to_townid(random_test_town()));
+        }
+
+        if (warmup % 10 == 0 && check_stop())
+        {
+            output << "Stopped!" << endl;
+            return false;
+        }
+    }
+
+    Stopwatch cmdwatch(true); // Use also instruction counting, if enabled
+    Stopwatch getwatch;
+#ifdef COUNT_ALLOCATIONS
+    std::uint64_t cmdallocs = 0;
+    std::uint64_t getallocs = 0;
+    unsigned int getcount = 0;
+#endif
+    for (unsigned int repeat = 0; repeat < repeat_count; ++repeat)
+    {
+        auto cmdpos = random(testfuncs.begin(), testfuncs.end());
+
+#ifdef COUNT_ALLOCATIONS
+        auto allocs = allocation_count();
+#endif
+        cmdwatch.start();
+        (this->**cmdpos)();
+        cmdwatch.stop();
+#ifdef COUNT_ALLOCATIONS
+        cmdallocs += allocation_count() - allocs;
+#endif
+
+        if (additional_get_cmds)
+        {
+            if (random_towns_added_ > 0) // Don't do anything if there's no towns
+            {
+                TownID id = n_to_townid(random_test_town());
+#ifdef COUNT_ALLOCATIONS
+                allocs = allocation_count();
+#endif
+                getwatch.start();
+                test_get_functions(id);
+                getwatch.stop();
+#ifdef COUNT_ALLOCATIONS
+                getallocs += allocation_count() - allocs;
+                ++getcount;
+#endif
+            }
+        }
+
+        if (repeat % 10 == 0)
+        {
+            if (sample.addsec + cmdwatch.elapsed() + getwatch.elapsed() >= timeout)
+            {
+                output << "Timeout!" << endl;
+                return false;
+            }
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                return false;
+            }
+        }
+    }
+
+#ifdef USE_PERF_EVENT
+    sample.cmdcount = cmdwatch.count();
+#endif
+    sample.cmdsec = cmdwatch.elapsed();
+    sample.getsec = getwatch.elapsed();
+#ifdef COUNT_ALLOCATIONS
+    if (repeat_count > 0) { sample.cmdallocs = static_cast<double>(cmdallocs) / repeat_count; }
+    if (getcount > 0) { sample.getallocs = static_cast<double>(getallocs) / getcount; }
+#endif
+
+    // The names are stored in an arena, compare its memory use to std::strings in the towns
+    if (auto towns = ds_.town_count(); towns > 0)
+    {
+        auto memory = ds_.name_memory();
+        sample.namebytes = static_cast<double>(memory.arena) / towns;
+        sample.stringbytes = static_cast<double>(memory.strings) / towns;
+    }
+
+    return true;
+}
+
+void MainProgram::init_test_distribution(TestDistribution const& distribution)
+{
+    test_distribution_ = distribution;
+    zipf_.reset();
+    hotspot_towns_.clear();
+    hotspot_min_ = NO_COORD;
+    hotspot_max_ = NO_COORD;
+
+    if (distribution.type == TownDistribution::ZIPF)
+    {
+        zipf_ = std::make_unique<ZipfDistribution>(random_towns_added_, distribution.zipf_exponent);
+    }
+    else if (distribution.type == TownDistribution::HOTSPOT)
+    {
+        // The hotspot is a square covering 1% of the area of the random towns, at a random location
+        Coord min{1, 1};
+        Coord max{10000, 10000};
+        int side = (max.x - min.x) / 10;
+        hotspot_min_ = {random<int>(min.x, max.x - side), random<int>(min.y, max.y - side)};
+        hotspot_max_ = {hotspot_min_.x + side, hotspot_min_.y + side};
+
+        for (unsigned long int n = 0; n < random_towns_added_; ++n)
+        {
+            auto [x, y] = ds_.get_town_coordinates(n_to_townid(n));
+            if (x >= hotspot_min_.x && x < hotspot_max_.x && y >= hotspot_min_.y && y < hotspot_max_.y)
+            {
+                hotspot_towns_.push_back(n);
+            }
+        }
+    }
+}
+
+unsigned long int MainProgram::random_test_town()
+{
+    switch (test_distribution_.type)
+    {
+        case TownDistribution::ZIPF:
+        {
+            if (random_towns_added_ == 0) { break; }
+            // Towns may have been added since the last call
+            if (zipf_->size() != random_towns_added_) { zipf_->set_size(random_towns_added_); }
+            // The lowest numbered towns are the most popular ones
+            return (*zipf_)(rand_engine_) - 1;
+        }
+        case TownDistribution::HOTSPOT:
+        {
+            if (!hotspot_towns_.empty() &&
+                std::uniform_real_distribution<double>(0.0, 1.0)(rand_engine_) < test_distribution_.hotspot_probability)
+            {
+                return hotspot_towns_[random<decltype(hotspot_towns_)::size_type>(0, hotspot_towns_.size())];
+            }
+            break;
+        }
+        case TownDistribution::UNIFORM:
+        {
+            break;
+        }
+    }
+
+    return random<decltype(random_towns_added_)>(0, random_towns_added_);
+}
+
+Coord MainProgram::random_test_coord()
+{
+    if (test_distribution_.type == TownDistribution::ZIPF && random_towns_added_ > 0)
+    {
+        // Popular towns are also popular places to look around
+        auto coord = ds_.get_town_coordinates(n_to_townid(random_test_town()));
+        if (coord != NO_COORD) { return coord; }
+    }
+    else if (test_distribution_.type == TownDistribution::HOTSPOT &&
+             std::uniform_real_distribution<double>(0.0, 1.0)(rand_engine_) < test_distribution_.hotspot_probability)
+    {
+        return {random<int>(hotspot_min_.x, hotspot_max_.x), random<int>(hotspot_min_.y, hotspot_max_.y)};
+    }
+
+    return {random<int>(1, 10000), random<int>(1, 10000)};
+}
+
+MainProgram::CmdResult MainProgram::cmd_comment(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
+{
+    return {};
+}
+
+bool MainProgram::command_parse_line(string_view inputline, ostream& output)
+{
+    Params params;
+    return command_parse_line(inputline, output, params);
+}
+
+bool MainProgram::command_parse_line(string_view inputline, ostream& output, Params& params)
+{
+//    static unsigned int nesting_level = 0; // UGLY! Remember nesting level to print correct amount of >:s.
+//    if (promptstyle != PromptStyle::NO_NESTING) { ++nesting_level; }
+
+    if (inputline.empty()) { return true; }
+
+    if (batch_lines_)
+    {
+        // Collect the batch until the closing brace
+        auto first = inputline.find_first_not_of(" \t\r");
+        auto last = inputline.find_last_not_of(" \t\r");
+        if (first != string_view::npos && inputline.substr(first, last-first+1) == "}")
+        {
+            auto lines = move(*batch_lines_);
+            batch_lines_.reset();
+            return run_batch(lines, output);
+        }
+        batch_lines_->emplace_back(inputline);
+        return true;
+    }
+
+    CmdInfo const* pos = nullptr;
+    auto status = parse_command(inputline, pos, params);
+    if (status == ParseStatus::OK)
+    {
+        auto& cmd = pos->cmd;
+        if (pos->func)
+        {
+            Stopwatch stopwatch;
+            bool use_stopwatch = (stopwatch_mode != StopwatchMode::OFF);
+            // Reset stopwatch mode if only for the next command
+            if (stopwatch_mode == StopwatchMode::NEXT) { stopwatch_mode = StopwatchMode::OFF; }
+
+           TestStatus initial_status = test_status_;
+           test_status_ = TestStatus::NOT_RUN;
+
+            bool use_recorder = recorder_ && is_recordable(cmd);
+            if (use_stopwatch || use_recorder)
+            {
+                stopwatch.start();
+            }
+
+            CmdResult result;
+            try
+            {
+                result = (this->*(pos->func))(output, params.cbegin(), params.cend());
+            }
+            catch (NotImplemented const& e)
+            {
+                output << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
+                std::cerr << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
+            }
+
+            if (use_stopwatch || use_recorder)
+            {
+                stopwatch.stop();
+            }
+
+            {
+                // One buffer for the whole result, so the stream is written and flushed only once
+                OutputBuffer buffer(output, output_storage_);
+                print_result(result, buffer);
+            }
+
+            finish_command(*pos, params, move(result), stopwatch.elapsed(), use_stopwatch, output);
+
+            if (test_status_ != TestStatus::NOT_RUN)
+            {
+                output << "Testread-tests have been run, " << ((test_status_ == TestStatus::DIFFS_FOUND) ? "differences found!" : "no differences found.") << endl;
+            }
+            if (test_status_ == TestStatus::NOT_RUN || (test_status_ == TestStatus::NO_DIFFS && initial_status == TestStatus::DIFFS_FOUND))
+            {
+                test_status_ = initial_status;
+            }
+        }
+        else
+        { // No function to run = quit command
+            return false;
+        }
+    }
+    else if (status == ParseStatus::INVALID_PARAMS)
+    {
+        output << "Invalid parameters for command '" << pos->cmd << "'!" << endl;
+    }
+    else
+    {
+        output << "Unknown command!" << endl;
+    }
+
+    return true; // Signal continuing
+}
+
+namespace
+{
+// Character classes of the parameter regexs, [[:space:]] is the same as isspace() in the "C" locale
+inline bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+inline bool is_alnum(char c) { return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+inline bool is_name(char c) { return is_alnum(c) || c == '-'; }
+
+template <typename Pred>
+string_view::size_type skip_while(string_view str, string_view::size_type pos, Pred pred)
+{
+    while (pos < str.size() && pred(str[pos])) { ++pos; }
+    return pos;
+}
+}
+
+MainProgram::ParseStatus MainProgram::parse_command(string_view inputline, CmdInfo const*& cmd, Params& params)
+{
+    // Same as matching "[[:space:]]*(cmd1|cmd2|...)(?:[[:space:]]*$|[[:space:]]+(.*))" and then the command's
+    // parameter regex, but without std::regex for the common commands
+    auto cmdbegin = skip_while(inputline, 0, is_space);
+    auto cmdend = skip_while(inputline, cmdbegin, [](char c){ return !is_space(c); });
+    auto cmdstr = inputline.substr(cmdbegin, cmdend-cmdbegin);
+
+    cmd = find_cmd(cmdstr);
+    if (!cmd) { return ParseStatus::UNKNOWN_CMD; }
+
+    // The parameters are what is left after the whitespace, (.*) doesn't match line terminators
+    auto parambegin = skip_while(inputline, cmdend, is_space);
+    auto paramstr = inputline.substr(parambegin);
+    if (paramstr.find_first_of("\r\n") != string_view::npos) { return ParseStatus::UNKNOWN_CMD; }
+
+    if (cmd->use_param_tokens)
+    {
+        return match_param_tokens(*cmd, paramstr, params) ? ParseStatus::OK : ParseStatus::INVALID_PARAMS;
+    }
+
+    cmatch match;
+    bool matched = regex_match(paramstr.data(), paramstr.data()+paramstr.size(), match, cmd->param_regex);
+    if (!matched) { return ParseStatus::INVALID_PARAMS; }
+
+    assert(!match.empty());
+    params.resize(match.size()-1);
+    for (std::size_t i = 1; i < match.size(); ++i)
+    {
+        params[i-1].assign(match[i].first, match[i].second);
+    }
+
+    return ParseStatus::OK;
+}
+
+MainProgram::ParseStatus MainProgram::parse_command_regex(string_view inputline, CmdInfo const*& cmd, Params& params)
+{
+    init_reference_regexs();
+
+    cmatch match;
+    bool matched = regex_match(inputline.data(), inputline.data()+inputline.size(), match, cmds_regex_);
+    if (!matched) { return ParseStatus::UNKNOWN_CMD; }
+
+    assert(match.size() == 3);
+    string cmdstr = match[1];
+    string paramstr = match[2];
+
+    auto pos = find_if(cmds_.begin(), cmds_.end(), [&cmdstr](CmdInfo const& ci) { return ci.cmd == cmdstr; });
+    assert(pos != cmds_.end());
+    cmd = &*pos;
+
+    smatch match2;
+    bool matched2 = regex_match(paramstr, match2, pos->param_regex);
+    if (!matched2) { return ParseStatus::INVALID_PARAMS; }
+
+    assert(!match2.empty());
+    params.clear();
+    for (auto i = ++(match2.begin()); i != match2.end(); ++i)
+    {
+        params.push_back(*i);
+    }
+
+    return ParseStatus::OK;
+}
+
+bool MainProgram::match_param_tokens(CmdInfo const& cmd, string_view paramstr, Params& params)
+{
+    // The tokens never overlap (e.g. an ID is always followed by whitespace or end of line),
+    // so greedy matching without backtracking gives the same result as the regex.
+    // The only backtracking needed is skipping an optional group that didn't match.
+    std::size_t nparams = 0;
+    auto add_param = [&params, &nparams](string_view value)
+    {
+        if (nparams == params.size()) { params.emplace_back(); }
+        params[nparams++].assign(value.data(), value.size());
+    };
+
+    auto const& tokens = cmd.param_tokens;
+    string_view::size_type pos = 0;
+    std::size_t opt_token = tokens.size(); // Index of the OPT_BEGIN being matched, if any
+    string_view::size_type opt_pos = 0;
+    std::size_t opt_nparams = 0;
+
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+    {
+        bool ok = true;
+        switch (tokens[i])
+        {
+            case ParamToken::TOWNID:
+            case ParamToken::NAME:
+            case ParamToken::NUM:
+            {
+                auto end = (tokens[i] == ParamToken::TOWNID) ? skip_while(paramstr, pos, is_alnum)
+                         : (tokens[i] == ParamToken::NAME) ? skip_while(paramstr, pos, is_name)
+                                                           : skip_while(paramstr, pos, is_digit);
+                ok = (end != pos);
+                if (ok) { add_param(paramstr.substr(pos, end-pos)); pos = end; }
+                break;
+            }
+            case ParamToken::COORD:
             {
-                output << "Timeout!" << endl;
-                stop = true;
+                // \([[:space:]]*([0-9]+)[[:space:]]*,[[:space:]]*([0-9]+)[[:space:]]*\)
+                auto p = pos;
+                auto expect = [&paramstr, &p](char c){ if (p < paramstr.size() && paramstr[p] == c) { ++p; return true; } return false; };
+                ok = expect('(');
+                auto xbegin = p = skip_while(paramstr, p, is_space);
+                auto xend = p = skip_while(paramstr, p, is_digit);
+                p = skip_while(paramstr, p, is_space);
+                ok = ok && xend != xbegin && expect(',');
+                auto ybegin = p = skip_while(paramstr, p, is_space);
+                auto yend = p = skip_while(paramstr, p, is_digit);
+                p = skip_while(paramstr, p, is_space);
+                ok = ok && yend != ybegin && expect(')');
+                if (ok)
+                {
+                    add_param(paramstr.substr(xbegin, xend-xbegin));
+                    add_param(paramstr.substr(ybegin, yend-ybegin));
+                    pos = p;
+                }
                 break;
             }
-            if (check_stop())
+            case ParamToken::WS:
             {
-                output << "Stopped!" << endl;
-                stop = true;
+                auto end = skip_while(paramstr, pos, is_space);
+                ok = (end != pos);
+                pos = end;
+                break;
+            }
+            case ParamToken::OPT_BEGIN:
+            {
+                opt_token = i;
+                opt_pos = pos;
+                opt_nparams = nparams;
+                break;
+            }
+            case ParamToken::OPT_END:
+            {
+                opt_token = tokens.size();
+                break;
+            }
+            case ParamToken::REST:
+            {
+                // .* isn't a group, so there's no parameter
+                pos = paramstr.size();
                 break;
             }
         }
-        if (stop) { break; }
 
-        if (n % 1000 != 0)
+        if (!ok)
         {
-            stopwatch.start();
-            add_random_roads(n % 1000);
-            stopwatch.stop();
+            if (opt_token == tokens.size()) { return false; }
+
+            // Skip the optional group, its parameters are left empty like unmatched regex groups
+            pos = opt_pos;
+            nparams = opt_nparams;
+            for (i = opt_token+1; tokens[i] != ParamToken::OPT_END; ++i)
+            {
+                if (tokens[i] == ParamToken::COORD) { add_param({}); add_param({}); }
+                else if (tokens[i] != ParamToken::WS) { add_param({}); }
+            }
+            opt_token = tokens.size();
         }
+    }
 
-#ifdef USE_PERF_EVENT
-        auto addcount = stopwatch.count();
-#endif
-        auto addsec = stopwatch.elapsed();
+    // Trailing whitespace is allowed
+    pos = skip_while(paramstr, pos, is_space);
+    if (pos != paramstr.size()) { return false; }
 
-#ifdef USE_PERF_EVENT
-        output << setw(12) << addsec << " , " << setw(12) << addcount << " , " << flush;
+    params.resize(nparams);
+    return true;
+}
+
+void MainProgram::finish_command(CmdInfo const& cmd, Params const& params, CmdResult&& result, double elapsed,
+                                 bool use_stopwatch, std::ostream& output)
+{
+    if (recorder_ && is_recordable(cmd.cmd))
+    {
+        auto elapsed_ns = static_cast<std::uint64_t>(elapsed * 1e9);
+        recorder_->write({cmd.cmd, params, static_cast<std::uint8_t>(result.first), result.second.size(), elapsed_ns});
+    }
+
+    // The views of the result may be left dangling by the next command, the GUI draws prev_result later
+#ifdef GRAPHICAL_GUI
+    result.second.keep_ids();
 #else
-        output << setw(12) << addsec << " , " << flush;
+    result.second.views.clear();
 #endif
+    if (result != prev_result)
+    {
+        prev_result = move(result);
+        view_dirty = true;
+    }
+
+    if (use_stopwatch)
+    {
+        output << "Command '" << cmd.cmd << "': " << elapsed << " sec" << endl;
+    }
+}
+
+bool MainProgram::is_read_only(string const& cmd)
+{
+    // Commands that only read the data, these can be run in parallel within a batch
+    static vector<string> const read_only_cmds({"print_town", "town_count", "all_towns", "all_roads",
+                                                "towns_alphabetically", "towns_distance_increasing", "mindist", "maxdist",
+                                                "towns_nearest", "find_towns", "town_vassals", "roads_from",
+                                                "taxer_path", "longest_vassal_path", "total_net_tax",
+                                                "any_route", "shortest_route", "least_towns_route", "road_cycle_route",
+                                                "page", "page_after", "#"});
+    return find(read_only_cmds.begin(), read_only_cmds.end(), cmd) != read_only_cmds.end();
+}
+
+MainProgram::CmdResult MainProgram::cmd_batch(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
 
-        if (addsec >= timeout)
+    batch_lines_.emplace();
+    batch_parser_depth_ = parser_depth_;
+    output << "Reading batch until '}'..." << endl;
+    return {};
+}
+
+bool MainProgram::run_batch(vector<string> const& lines, ostream& output)
+{
+    if (!thread_pool_) { thread_pool_ = std::make_unique<ThreadPool>(); }
+
+    // A read-only command of the batch, run in parallel with its neighbours
+    struct BatchCommand
+    {
+        CmdInfo const* cmd = nullptr;
+        Params params;
+        CmdResult result;
+        double elapsed = 0;
+        string output;
+        std::exception_ptr error;
+    };
+    vector<BatchCommand> group;
+    Params params;
+
+    std::size_t i = 0;
+    while (i < lines.size())
+    {
+        // Collect consecutive read-only commands
+        group.clear();
+        for (; i < lines.size(); ++i)
         {
-            output << "Timeout!" << endl;
-            stop = true;
-            break;
+            BatchCommand command;
+            if (parse_command(lines[i], command.cmd, command.params) != ParseStatus::OK ||
+                !command.cmd->func || !is_read_only(command.cmd->cmd))
+            {
+                break;
+            }
+            group.push_back(move(command));
         }
 
-        stopwatch.start();
-        for (unsigned int repeat = 0; repeat < repeat_count; ++repeat)
+        thread_pool_->parallel_for(group.size(), [this, &group](std::size_t j)
         {
-            auto cmdpos = random(testfuncs.begin(), testfuncs.end());
-
-            (this->**cmdpos)();
-            if (additional_get_cmds)
+            auto& command = group[j];
+            try
             {
-                if (random_towns_added_ > 0) // Don't do anything if there's no towns
+                ostringstream cmdoutput;
+                Stopwatch stopwatch;
+                stopwatch.start();
+                try
                 {
-                    TownID id = n_to_townid(random<decltype(random_towns_added_)>(0, random_towns_added_));
-                    ds_.get_town_name(id);
-                    ds_.get_town_coordinates(id);
-                    ds_.get_town_tax(id);
+                    command.result = (this->*(command.cmd->func))(cmdoutput, command.params.cbegin(), command.params.cend());
                 }
-            }
-
-            if (repeat % 10 == 0)
-            {
-                stopwatch.stop();
-                if (stopwatch.elapsed() >= timeout)
+                catch (NotImplemented const& e)
                 {
-                    output << "Timeout!" << endl;
-                    stop = true;
-                    break;
+                    cmdoutput << endl << "NotImplemented from cmd " << command.cmd->cmd << " : " << e.what() << endl;
+                    std::cerr << endl << "NotImplemented from cmd " << command.cmd->cmd << " : " << e.what() << endl;
                 }
-                if (check_stop())
+                stopwatch.stop();
+                command.elapsed = stopwatch.elapsed();
+
                 {
-                    output << "Stopped!" << endl;
-                    stop = true;
-                    break;
+                    string storage;
+                    OutputBuffer buffer(cmdoutput, storage);
+                    print_result(command.result, buffer);
                 }
-                stopwatch.start();
+                command.output = cmdoutput.str();
             }
-        }
-        stopwatch.stop();
-        if (stop) { break; }
+            catch (...)
+            {
+                // Thrown again in the main thread in the command's turn
+                command.error = std::current_exception();
+            }
+        });
 
-#ifdef USE_PERF_EVENT
-        auto totalcount = stopwatch.count();
-#endif
-        auto totalsec = stopwatch.elapsed();
+        // The results are output in the original order
+        for (auto& command : group)
+        {
+            if (command.error) { std::rethrow_exception(command.error); }
 
-#ifdef USE_PERF_EVENT
-        output << setw(12) << totalsec-addsec << " , " << setw(12) << totalcount-addcount << " , " << setw(12) << totalsec << " , " << setw(12) << totalcount;
-#else
-        output << setw(12) << totalsec-addsec << " , " << setw(12) << totalsec;
-#endif
+            bool use_stopwatch = (stopwatch_mode != StopwatchMode::OFF);
+            if (stopwatch_mode == StopwatchMode::NEXT) { stopwatch_mode = StopwatchMode::OFF; }
 
-//        unsigned long int maxmem;
-//        string unit;
-//        tie(maxmem, unit) = mempeak();
-//        maxmem -=  startmem;
-//        if (maxmem != 0)
-//        {
-//            output << ", memory " << maxmem << " " << unit;
-//        }
-        output << endl;
-        flush_output(output);
+            output << command.output;
+            finish_command(*command.cmd, command.params, move(command.result), command.elapsed, use_stopwatch, output);
+        }
+
+        // Everything else (mutations, errors...) acts as a barrier and is run alone
+        if (i < lines.size())
+        {
+            CmdInfo const* cmd = nullptr;
+            if (parse_command(lines[i], cmd, params) == ParseStatus::OK && cmd->func == &MainProgram::cmd_batch)
+            {
+                output << "Batches cannot be nested!" << endl;
+            }
+            else if (!command_parse_line(lines[i], output, params))
+            {
+                return false;
+            }
+            ++i;
+        }
     }
 
-    ds_.clear_all();
-    ds_.clear_roads();
-    init_primes();
+    return true;
+}
 
-    }
-    catch (NotImplemented const&)
+void MainProgram::end_unterminated_batch(ostream& output)
+{
+    if (batch_lines_ && batch_parser_depth_ == parser_depth_)
     {
-        // Clean up after NotImplemented
-        ds_.clear_all();
-        init_primes();
-        throw;
+        output << "Batch not terminated with '}', " << batch_lines_->size() << " command(s) ignored!" << endl;
+        batch_lines_.reset();
     }
-
-#ifdef _GLIBCXX_DEBUG
-    output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
-#endif // _GLIBCXX_DEBUG
-
-    return {};
 }
 
-MainProgram::CmdResult MainProgram::cmd_comment(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
+TownViews MainProgram::towns_info(std::vector<TownID> const& towns, OutputBuffer& output)
 {
-    return {};
+    try
+    {
+        auto infos = ds_.get_towns_info(towns);
+        TownViews views;
+        views.reserve(infos.size());
+        for (std::size_t i = 0; i < infos.size(); ++i) { views.push_back({towns[i], infos[i]}); }
+        return views;
+    }
+    catch (NotImplemented const& e)
+    {
+        output << '\n' << "NotImplemented while printing towns : " << e.what() << '\n';
+        std::cerr << endl << "NotImplemented while printing towns : " << e.what() << endl;
+        return {};
+    }
 }
 
-bool MainProgram::command_parse_line(string inputline, ostream& output)
+void MainProgram::print_result(CmdResult const& result, OutputBuffer& output)
 {
-//    static unsigned int nesting_level = 0; // UGLY! Remember nesting level to print correct amount of >:s.
-//    if (promptstyle != PromptStyle::NO_NESTING) { ++nesting_level; }
-
-    if (inputline.empty()) { return true; }
+    if (result.first == ResultType::NOTHING || result.second.size() == 0) { return; }
 
-    smatch match;
-    bool matched = regex_match(inputline, match, cmds_regex_);
-    if (matched)
+    if (result.second.failed())
     {
-        assert(match.size() == 3);
-        string cmd = match[1];
-        string params = match[2];
+        output << ((result.first == ResultType::ROUTE) ? "Failed (NO_TOWNID returned)!!" : "Failed (NO_... returned)!!") << '\n';
+        return;
+    }
 
-        auto pos = find_if(cmds_.begin(), cmds_.end(), [cmd](CmdInfo const& ci) { return ci.cmd == cmd; });
-        assert(pos != cmds_.end());
+    // Results from the *_view() functions have the towns' data already, the ids are looked up all at once, one lookup per town
+    TownViews looked_up;
+    if (result.second.views.empty()) { looked_up = towns_info(result.second.ids, output); }
+    auto const& towns = result.second.views.empty() ? looked_up : result.second.views;
 
-        smatch match2;
-        bool matched2 = regex_match(params, match2, pos->param_regex);
-        if (matched2)
+    switch (result.first)
+    {
+        case ResultType::LIST:
         {
-            if (pos->func)
+            for (std::size_t num = 1; num <= towns.size(); ++num)
             {
-                assert(!match2.empty());
-
-                Stopwatch stopwatch;
-                bool use_stopwatch = (stopwatch_mode != StopwatchMode::OFF);
-                // Reset stopwatch mode if only for the next command
-                if (stopwatch_mode == StopwatchMode::NEXT) { stopwatch_mode = StopwatchMode::OFF; }
-
-               TestStatus initial_status = test_status_;
-               test_status_ = TestStatus::NOT_RUN;
-
-                if (use_stopwatch)
-                {
-                    stopwatch.start();
-                }
-
-                CmdResult result;
-                try
-                {
-                    result = (this->*(pos->func))(output, ++(match2.begin()), match2.end());
-                }
-                catch (NotImplemented const& e)
+                if (result.second.size() > 1) { output << num << ". "; }
+                print_town(towns[num-1], output);
+            }
+            break;
+        }
+        case ResultType::HIERARCHY:
+        {
+            for (std::size_t num = 1; num <= towns.size(); ++num)
+            {
+                if (result.second.size() > 1)
                 {
-                    output << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
-                    std::cerr << endl << "NotImplemented from cmd " << pos->cmd << " : " << e.what() << endl;
+                    output << num << ". ";
+                    print_town_name(towns[num-1], output, false);
+//                                        if (num < towns.size()) { output << " ->"; }
                 }
-
-                if (use_stopwatch)
+                else
                 {
-                    stopwatch.stop();
+                    print_town_name(towns[num-1], output, false);
                 }
+                output << '\n';
+            }
+            break;
+        }
+    case ResultType::ROUTE:
+        {
+            unsigned int num = 1;
+            Distance dist = 0;
+            Coord prev_coord = NO_COORD;
+            for (auto const& town : towns)
+            {
+                output << num << ". ";
+                print_town_name(town, output, false);
 
-                switch (result.first)
+                Coord coord = town.info.coord;
+                if (num != 1)
                 {
-                    case ResultType::NOTHING:
+                    Distance d = calc_distance(prev_coord, coord);
+                    if (d != NO_DISTANCE && dist != NO_DISTANCE)
                     {
-                        break;
+                        dist += d;
+                        output << " (distance " << dist << ")";
                     }
-                    case ResultType::LIST:
-                    {
-                        auto& towns = result.second;
-                        if (!towns.empty())
-                        {
-                            if (towns.size() == 1 && towns.front() == NO_TOWNID)
-                            {
-                                output << "Failed (NO_... returned)!!" << std::endl;
-                            }
-                            else
-                            {
-                                unsigned int num = 0;
-                                for (TownID id : towns)
-                                {
-                                    ++num;
-                                    if (towns.size() > 1) { output << num << ". "; }
-                                    print_town(id, output);
-                                }
-                            }
-                        }
-                        break;
-                    }
-                    case ResultType::HIERARCHY:
-                    {
-                        auto& towns = result.second;
-                        if (!towns.empty())
-                        {
-                            if (towns.size() == 1 && towns.front() == NO_TOWNID)
-                            {
-                                output << "Failed (NO_... returned)!!" << std::endl;
-                            }
-                            else
-                            {
-                                unsigned int num = 0;
-                                for (TownID id : towns)
-                                {
-                                    ++num;
-                                    if (towns.size() > 1)
-                                    {
-                                        output << num << ". ";
-                                        print_town_name(id, output,false);
-//                                        if (num < towns.size()) { output << " ->"; }
-                                    }
-                                    else
-                                    {
-                                        print_town_name(id, output,false);
-                                    }
-                                    output << std::endl;
-                                }
-                            }
-                        }
-                        break;
-                    }
-                case ResultType::ROUTE:
-                    {
-                        auto& route = result.second;
-                        if (!route.empty())
-                        {
-                            if (route.size() == 1 && route.front() == NO_TOWNID)
-                            {
-                                output << "Failed (NO_TOWNID returned)!!" << std::endl;
-                            }
-                            else
-                            {
-                                unsigned int num = 1;
-                                Distance dist = 0;
-                                Coord prev_coord = NO_COORD;
-                                for (auto townid : route)
-                                {
-                                    output << num << ". ";
-                                    print_town_name(townid, output, false);
-
-                                    Coord coord = ds_.get_town_coordinates(townid);
-                                    if (num != 1)
-                                    {
-                                        Distance d = calc_distance(prev_coord, coord);
-                                        if (d != NO_DISTANCE && dist != NO_DISTANCE)
-                                        {
-                                            dist += d;
-                                            output << " (distance " << dist << ")";
-                                        }
-                                        else
-                                        {
-                                            output << " (NO_DISTANCE!)";
-                                            dist = NO_DISTANCE;
-                                        }
-                                    }
-                                    prev_coord = coord;
-                                    output << endl;
-
-                                    ++num;
-                                }
-                            }
-                        }
-                        break;
-                    }
-                    default:
+                    else
                     {
-                        assert(false && "Unsupported result type!");
+                        output << " (NO_DISTANCE!)";
+                        dist = NO_DISTANCE;
                     }
                 }
+                prev_coord = coord;
+                output << '\n';
 
-                if (result != prev_result)
-                {
-                    prev_result = move(result);
-                    view_dirty = true;
-                }
-
-                if (use_stopwatch)
-                {
-                    output << "Command '" << cmd << "': " << stopwatch.elapsed() << " sec" << endl;
-                }
-
-                if (test_status_ != TestStatus::NOT_RUN)
-                {
-                    output << "Testread-tests have been run, " << ((test_status_ == TestStatus::DIFFS_FOUND) ? "differences found!" : "no differences found.") << endl;
-                }
-                if (test_status_ == TestStatus::NOT_RUN || (test_status_ == TestStatus::NO_DIFFS && initial_status == TestStatus::DIFFS_FOUND))
-                {
-                    test_status_ = initial_status;
-                }
-            }
-            else
-            { // No function to run = quit command
-                return false;
+                ++num;
             }
+            break;
         }
-        else
+        default:
         {
-            output << "Invalid parameters for command '" << cmd << "'!" << endl;
+            assert(false && "Unsupported result type!");
         }
     }
-    else
+}
+
+void MainProgram::sort_by_id(TownViews& towns)
+{
+    // The characters after the id's end count as zeros, which sorts a shorter id before the longer ones it is a prefix of
+    auto prefix = [](std::string_view id)
     {
-        output << "Unknown command!" << endl;
-    }
+        std::uint64_t key = 0;
+        for (std::size_t i = 0; i < sizeof(key); ++i)
+        {
+            key = (key << 8) | (i < id.size() ? static_cast<unsigned char>(id[i]) : 0u);
+        }
+        return key;
+    };
 
-    return true; // Signal continuing
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> keys;
+    keys.reserve(towns.size());
+    for (std::uint32_t i = 0; i < towns.size(); ++i) { keys.push_back({prefix(towns[i].id), i}); }
+
+    std::sort(keys.begin(), keys.end(), [&towns](auto const& key1, auto const& key2)
+    {
+        return key1.first != key2.first ? key1.first < key2.first : towns[key1.second].id < towns[key2.second].id;
+    });
+
+    TownViews sorted;
+    sorted.reserve(towns.size());
+    for (auto const& key : keys) { sorted.push_back(towns[key.second]); }
+    towns.swap(sorted);
+}
+
+bool MainProgram::ResultTowns::failed() const
+{
+    return views.empty() ? (ids.size() == 1 && ids.front() == NO_TOWNID) : (views.size() == 1 && views.front().id == NO_TOWNID.view());
+}
+
+void MainProgram::ResultTowns::keep_ids()
+{
+    if (views.empty()) { return; }
+    ids.clear();
+    ids.reserve(views.size());
+    for (auto const& town : views) { ids.emplace_back(town.id); }
+    views.clear();
 }
 
 void MainProgram::command_parser(istream& input, ostream& output, PromptStyle promptstyle)
 {
+    ++parser_depth_;
     string line;
+    Params params; // Reused for all lines to avoid allocations
     do
     {
 //        output << string(nesting_level, '>') << " ";
@@ -1696,12 +3593,46 @@ void MainProgram::command_parser(istream& input, ostream& output, PromptStyle pr
 
         if (!input) { break; }
 
-        bool cont = command_parse_line(line, output);
+        bool cont = command_parse_line(line, output, params);
         view_dirty = false; // No need to keep track of individual result changes
         if (!cont) { break; }
     }
     while (input);
     //    if (promptstyle != PromptStyle::NO_NESTING) { --nesting_level; }
+    end_unterminated_batch(output);
+    --parser_depth_;
+
+    view_dirty = true; // To be safe, assume that results have been changed
+}
+
+void MainProgram::command_parser(string_view text, ostream& output, PromptStyle promptstyle)
+{
+    // Same as the istream version, including the prompt echoed after the last line
+    ++parser_depth_;
+    LineReader lines(text);
+    string_view line;
+    Params params; // Reused for all lines to avoid allocations
+    while (true)
+    {
+        output << PROMPT;
+        string_view next_line;
+        bool got_line = lines.getline(next_line);
+        // Like std::getline, the line is left unchanged at the end if the last line had no '\n'
+        if (got_line || text.empty() || text.back() == '\n') { line = next_line; }
+
+        if (promptstyle != PromptStyle::NO_ECHO)
+        {
+            output << line << endl;
+        }
+
+        if (!got_line) { break; }
+
+        bool cont = command_parse_line(line, output, params);
+        view_dirty = false; // No need to keep track of individual result changes
+        if (!cont) { break; }
+    }
+    end_unterminated_batch(output);
+    --parser_depth_;
 
     view_dirty = true; // To be safe, assume that results have been changed
 }
@@ -1806,23 +3737,25 @@ void MainProgram::init_primes()
 Name MainProgram::n_to_name(unsigned long n)
 {
     unsigned long int hash = prime1_*n + prime2_;
-    string name;
 
+    // Build the name in a local buffer so that the string is created only once
+    char buffer[std::numeric_limits<unsigned long int>::digits];
+    char* end = buffer;
     while (hash > 0)
     {
         auto hexnum = hash % 26;
         hash /= 26;
-        name.push_back('a'+hexnum);
+        *end++ = static_cast<char>('a'+hexnum);
     }
 
-    return name;
+    return Name(buffer, end);
 }
 
 TownID MainProgram::n_to_townid(unsigned long n)
 {
- std::ostringstream ostr;
- ostr << "R" << n;
- return ostr.str();
+    char buffer[1+std::numeric_limits<unsigned long int>::digits10+1] = {'R'};
+    auto end = to_chars(buffer+1, buffer+sizeof(buffer), n).ptr;
+    return TownID(buffer, static_cast<std::size_t>(end - buffer));
 }
 
 Coord MainProgram::n_to_coord(unsigned long n)
@@ -1835,6 +3768,35 @@ Coord MainProgram::n_to_coord(unsigned long n)
 
 void MainProgram::init_regexs()
 {
+    reference_regexs_ready_ = false;
+    for (auto& cmd : cmds_)
+    {
+        cmd.use_param_tokens = init_param_tokens(cmd);
+        if (cmd.use_param_tokens)
+        {
+            cmd.param_count = count_if(cmd.param_tokens.begin(), cmd.param_tokens.end(),
+                                       [](ParamToken t){ return t != ParamToken::WS && t != ParamToken::OPT_BEGIN &&
+                                                                t != ParamToken::OPT_END && t != ParamToken::REST; });
+            cmd.param_count += count(cmd.param_tokens.begin(), cmd.param_tokens.end(), ParamToken::COORD); // (x,y) is two parameters
+        }
+        else
+        {
+            cmd.param_regex = regex(cmd.param_regex_str+"[[:space:]]*", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+            cmd.param_count = cmd.param_regex.mark_count();
+        }
+    }
+    init_cmd_lookup();
+    coords_regex_ = regex(coordx+"[[:space:]]?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    times_regex_ = regex(wsx+"([0-9][0-9]):([0-9][0-9]):([0-9][0-9])", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    commands_regex_ = regex("([0-9a-zA-Z_]+);?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    sizes_regex_ = regex(numx+";?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    options_regex_ = regex("([a-z_]+)=([-0-9a-zA-Z_.:]+)", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+}
+
+void MainProgram::init_reference_regexs()
+{
+    if (reference_regexs_ready_) { return; }
+
     // Create regex <whitespace>(cmd1|cmd2|...)<whitespace>(.*)
     string cmds_regex_str = "[[:space:]]*(";
     bool first = true;
@@ -1843,14 +3805,61 @@ void MainProgram::init_regexs()
         cmds_regex_str += (first ? "" : "|") + cmd.cmd;
         first = false;
 
-        cmd.param_regex = regex(cmd.param_regex_str+"[[:space:]]*", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        if (cmd.use_param_tokens)
+        {
+            cmd.param_regex = regex(cmd.param_regex_str+"[[:space:]]*", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        }
     }
     cmds_regex_str += ")(?:[[:space:]]*$|"+wsx+"(.*))";
     cmds_regex_ = regex(cmds_regex_str, std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    coords_regex_ = regex(coordx+"[[:space:]]?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    times_regex_ = regex(wsx+"([0-9][0-9]):([0-9][0-9]):([0-9][0-9])", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    commands_regex_ = regex("([0-9a-zA-Z_]+);?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    sizes_regex_ = regex(numx+";?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    reference_regexs_ready_ = true;
+}
+
+void MainProgram::init_cmd_lookup()
+{
+    cmd_lookup_.clear();
+    for (auto& cmd : cmds_)
+    {
+        cmd_lookup_.emplace_back(cmd.cmd, &cmd);
+    }
+    sort(cmd_lookup_.begin(), cmd_lookup_.end());
+}
+
+MainProgram::CmdInfo const* MainProgram::find_cmd(string_view name) const
+{
+    auto pos = lower_bound(cmd_lookup_.begin(), cmd_lookup_.end(), name,
+                           [](auto const& entry, string_view name){ return entry.first < name; });
+    if (pos == cmd_lookup_.end() || pos->first != name) { return nullptr; }
+    return pos->second;
+}
+
+bool MainProgram::init_param_tokens(CmdInfo& cmd)
+{
+    // Split the parameter regex into the known fragments, return false if there's anything else
+    vector<pair<string, ParamToken>> const fragments{{coordx, ParamToken::COORD}, {townidx, ParamToken::TOWNID},
+                                                     {namex, ParamToken::NAME}, {numx, ParamToken::NUM},
+                                                     {wsx, ParamToken::WS}, {"(?:", ParamToken::OPT_BEGIN},
+                                                     {")?", ParamToken::OPT_END}, {".*", ParamToken::REST}};
+    cmd.param_tokens.clear();
+    string_view rest = cmd.param_regex_str;
+    bool in_optional = false;
+    while (!rest.empty())
+    {
+        auto pos = find_if(fragments.begin(), fragments.end(),
+                           [rest](auto const& fragment){ return rest.substr(0, fragment.first.size()) == fragment.first; });
+        if (pos == fragments.end()) { return false; }
+
+        // Only one level of optional groups is supported, and .* only at the end
+        auto token = pos->second;
+        if (token == ParamToken::OPT_BEGIN && in_optional) { return false; }
+        if (token == ParamToken::OPT_END && !in_optional) { return false; }
+        if (token == ParamToken::REST && rest.size() != pos->first.size()) { return false; }
+        if (token == ParamToken::OPT_BEGIN || token == ParamToken::OPT_END) { in_optional = !in_optional; }
+
+        cmd.param_tokens.push_back(token);
+        rest.remove_prefix(pos->first.size());
+    }
+    return !in_optional;
 }
 
 void MainProgram::create_road_network()
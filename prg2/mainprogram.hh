@@ -12,6 +12,7 @@
 #include <string>
 #include <random>
 #include <regex>
+#include <string_view>
 #include <chrono>
 #include <sstream>
 #include <stdexcept>
@@ -20,11 +21,22 @@
 #include <array>
 #include <functional>
 #include <utility>
+#include <initializer_list>
 #include <variant>
 #include <bitset>
 #include <cassert>
+#include <memory>
+#include <optional>
+#include <exception>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
 
 #include "datastructures.hh"
+#include "workloadtrace.hh"
+#include "mappedfile.hh"
+#include "outputbuffer.hh"
+#include "threadpool.hh"
 
 class MainWindow; // In case there's UI
 
@@ -35,15 +47,20 @@ public:
 
 
     class Stopwatch;
+    class SampleStats;
+    class ZipfDistribution;
 
     enum class PromptStyle { NORMAL, NO_ECHO, NO_NESTING };
     enum class TestStatus { NOT_RUN, NO_DIFFS, DIFFS_FOUND };
 
-    bool command_parse_line(std::string input, std::ostream& output);
+    bool command_parse_line(std::string_view input, std::ostream& output);
     void command_parser(std::istream& input, std::ostream& output, PromptStyle promptstyle);
+    void command_parser(std::string_view text, std::ostream& output, PromptStyle promptstyle);
 
     void setui(MainWindow* ui);
 
+    TestStatus test_status() const { return test_status_; }
+
     void flush_output(std::ostream& output);
     bool check_stop() const;
 
@@ -72,13 +89,54 @@ private:
     StopwatchMode stopwatch_mode = StopwatchMode::OFF;
 
     enum class ResultType { NOTHING, LIST, HIERARCHY, ROUTE, CYCLE };
-    using CmdResult = std::pair<ResultType, std::vector<TownID>>;
+    // The towns of a command's result: ids, or for the commands that use the *_view() functions
+    // of Datastructures, views that are only valid until the database is changed
+    struct ResultTowns
+    {
+        std::vector<TownID> ids;
+        TownViews views;
+
+        ResultTowns() = default;
+        ResultTowns(std::vector<TownID> towns) : ids(std::move(towns)) {}
+        ResultTowns(std::initializer_list<TownID> towns) : ids(towns) {}
+        ResultTowns(TownViews towns) : views(std::move(towns)) {}
+
+        std::size_t size() const { return views.empty() ? ids.size() : views.size(); }
+        // the single NO_TOWNID a failed function returns
+        bool failed() const;
+        // copies the ids of the views, so that the result stays valid when the database changes
+        void keep_ids();
+
+        // results with views are never equal, the towns they point to may have changed
+        bool operator==(ResultTowns const& other) const { return ids == other.ids && views.empty() && other.views.empty(); }
+        bool operator!=(ResultTowns const& other) const { return !(*this == other); }
+    };
+    using CmdResult = std::pair<ResultType, ResultTowns>;
     CmdResult prev_result;
     bool view_dirty = true;
 
     TestStatus test_status_ = TestStatus::NOT_RUN;
 
-    using MatchIter = std::smatch::const_iterator;
+    // Executed commands are written here when recording is on
+    std::unique_ptr<TraceWriter> recorder_;
+    static bool is_recordable(std::string const& cmd);
+
+    // Lines between "batch {" and "}" are collected here and then run with run_batch,
+    // consecutive read-only commands in parallel
+    std::optional<std::vector<std::string>> batch_lines_;
+    unsigned int parser_depth_ = 0; // Nesting level of command_parser (read inside read etc.)
+    unsigned int batch_parser_depth_ = 0; // The level where the batch being collected started
+    std::unique_ptr<ThreadPool> thread_pool_;
+    static bool is_read_only(std::string const& cmd);
+    bool run_batch(std::vector<std::string> const& lines, std::ostream& output);
+    void end_unterminated_batch(std::ostream& output);
+
+    // Commands get their parameters (the regex groups matched from the command line) as strings
+    using Params = std::vector<std::string>;
+    using MatchIter = Params::const_iterator;
+    // Parameter regexs built only from the fragments below are matched with a hand-written tokenizer,
+    // anything else falls back to std::regex (see init_param_tokens)
+    enum class ParamToken { TOWNID, NAME, NUM, COORD, WS, OPT_BEGIN, OPT_END, REST };
     struct CmdInfo
     {
         std::string cmd;
@@ -86,16 +144,35 @@ private:
         std::string param_regex_str;
         CmdResult(MainProgram::*func)(std::ostream& output, MatchIter begin, MatchIter end);
         void(MainProgram::*testfunc)();
-        std::regex param_regex = {};
+        std::regex param_regex = {}; // Compiled only when needed if the command uses param_tokens
+        bool use_param_tokens = false;
+        std::vector<ParamToken> param_tokens = {};
+        unsigned int param_count = 0;
     };
     static std::vector<CmdInfo> cmds_;
+    // Commands sorted by name for binary search, rebuilt by init_cmd_lookup if cmds_ is reordered
+    std::vector<std::pair<std::string_view, CmdInfo const*>> cmd_lookup_;
+    void init_cmd_lookup();
+    CmdInfo const* find_cmd(std::string_view name) const;
+    static bool init_param_tokens(CmdInfo& cmd);
+    static bool match_param_tokens(CmdInfo const& cmd, std::string_view paramstr, Params& params);
     // Regex objects and their initialization
     std::regex cmds_regex_;
     std::regex coords_regex_;
     std::regex times_regex_;
     std::regex commands_regex_;
     std::regex sizes_regex_;
+    std::regex options_regex_;
     void init_regexs();
+    // Regexs needed only by parse_command_regex, compiled on first use to keep startup fast
+    bool reference_regexs_ready_ = false;
+    void init_reference_regexs();
+
+    enum class ParseStatus { UNKNOWN_CMD, INVALID_PARAMS, OK };
+    ParseStatus parse_command(std::string_view inputline, CmdInfo const*& cmd, Params& params);
+    // The original all-regex parser, kept as a reference for parse_benchmark
+    ParseStatus parse_command_regex(std::string_view inputline, CmdInfo const*& cmd, Params& params);
+    bool command_parse_line(std::string_view inputline, std::ostream& output, Params& params);
 
 
     CmdResult cmd_add_town(std::ostream& output, MatchIter begin, MatchIter end);
@@ -124,12 +201,32 @@ private:
     CmdResult cmd_clear_roads(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_clear_all(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_find_towns(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_page(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_page_after(std::ostream& output, MatchIter begin, MatchIter end);
 
     CmdResult help_command(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_random_add(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_randseed(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_sort_threads(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_read(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_testread(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_load_data(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_save_snapshot(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_load_snapshot(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_open_snapshot(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_close_snapshot(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_open_log(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_close_log(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_checkpoint(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_record(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_replay(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_parse_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_concurrent_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_snapshot_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_sort_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_hash_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_log_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_batch(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_stopwatch(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_comment(std::ostream& output, MatchIter begin, MatchIter end);
@@ -148,7 +245,7 @@ private:
     void test_all_roads();
     void test_town_vassals();
     void test_roads_from();
-    void test_get_functions(TownID id);
+    void test_get_functions(TownID const& id);
     void test_random_roads();
     void test_any_route();
     void test_shortest_route();
@@ -156,12 +253,87 @@ private:
     void test_road_cycle_route();
     void test_trim_road_network();
 
+    // How perftest's test functions choose the towns they operate on
+    enum class TownDistribution { UNIFORM, ZIPF, HOTSPOT };
+    struct TestDistribution
+    {
+        TownDistribution type = TownDistribution::UNIFORM;
+        double zipf_exponent = 1.0; // ZIPF: town with number n is chosen with probability proportional to 1/(n+1)^s
+        double hotspot_probability = 0.9; // HOTSPOT: probability of choosing from the hotspot area
+    };
+    TestDistribution test_distribution_;
+    std::unique_ptr<ZipfDistribution> zipf_;
+    Coord hotspot_min_ = NO_COORD;
+    Coord hotspot_max_ = NO_COORD;
+    std::vector<unsigned long int> hotspot_towns_; // Numbers of the towns inside the hotspot area
+    void init_test_distribution(TestDistribution const& distribution);
+    unsigned long int random_test_town();
+    Coord random_test_coord();
+
+    // Optional name=value settings given to perftest after the sizes
+    struct PerftestOptions
+    {
+        unsigned int warmup = 0; // Untimed random commands run before the timed ones
+        unsigned int trials = 1; // Independent measurements (with fresh seeds) for each N
+        bool bulk = false; // Generate the data in bulk and add it with the batch operations
+        TestDistribution distribution;
+    };
+    // Timings of one perftest trial, the get commands are timed separately from the tested commands
+    struct PerftestSample
+    {
+        double gensec = 0;
+        double addsec = 0;
+        double cmdsec = 0;
+        double getsec = 0;
+        long long addcount = 0;
+        long long cmdcount = 0;
+        double addallocs = 0; // heap allocations per added town, with COUNT_ALLOCATIONS
+        double cmdallocs = 0; // per tested command
+        double getallocs = 0; // and per call of the get commands
+        double namebytes = 0; // memory of the names per town at the end, see Datastructures::name_memory()
+        double stringbytes = 0; // and the estimate for them as std::strings
+    };
+    bool parse_perftest_options(std::string const& optionstr, PerftestOptions& options, std::ostream& output);
+    bool perftest_trial(std::ostream& output, unsigned int n, std::vector<void(MainProgram::*)()> const& testfuncs,
+                        bool additional_get_cmds, unsigned int repeat_count, PerftestOptions const& options,
+                        unsigned int timeout, PerftestSample& sample);
+
     void add_random_towns(unsigned int size, Coord min = {1,1}, Coord max = {10000, 10000});
     void add_random_roads(unsigned int n);
+
+    // Random data generated in bulk, the same data add_random_towns() and add_random_roads() would add
+    struct BulkData
+    {
+        std::vector<TownSpec> towns;
+        std::vector<std::pair<TownID, TownID>> vassalships;
+        std::vector<std::pair<TownID, TownID>> roads;
+    };
+    void generate_bulk_data(unsigned int size, unsigned int roads, BulkData& data, Coord min = {1,1}, Coord max = {10000, 10000});
+    void add_bulk_data(BulkData const& data);
     Distance calc_distance(Coord c1, Coord c2);
-    std::string print_town(TownID id, std::ostream& output, bool nl = true);
-    std::string print_town_name(TownID id, std::ostream& output, bool nl = true);
+    std::string print_town(TownID const& id, std::ostream& output, bool nl = true);
+    std::string print_town_name(TownID const& id, std::ostream& output, bool nl = true);
     std::string print_coord(Coord coord, std::ostream& output, bool nl = true);
+    // Versions used for printing command results, these write into a buffer instead of the stream
+    void print_town(TownID const& id, OutputBuffer& output, bool nl = true);
+    void print_town_name(TownID const& id, OutputBuffer& output, bool nl = true);
+    // The same with the town's data already looked up, from a *_view() function or get_town_info()
+    void print_town(TownView const& town, OutputBuffer& output, bool nl = true);
+    void print_town_name(TownView const& town, OutputBuffer& output, bool nl = true);
+    // The towns with their data from ds_.get_towns_info(), or nothing after printing the error if it isn't implemented
+    TownViews towns_info(std::vector<TownID> const& towns, OutputBuffer& output);
+    // Prints a page of a list, numbered from first_num on
+    void print_town_page(TownViews const& towns, std::size_t first_num, std::ostream& output);
+    void print_road_page(RoadViews const& roads, std::size_t first_num, std::ostream& output);
+    // Sorts the towns by id like std::sort would sort their TownIDs. The views point to ids scattered
+    // around the database, so the first 8 characters of each id are compared as one number next to the town.
+    static void sort_by_id(TownViews& towns);
+    void print_coord(Coord coord, OutputBuffer& output, bool nl = true);
+    void print_result(CmdResult const& result, OutputBuffer& output);
+    // Things done after a command has been run and its result printed: recording, stopwatch output etc.
+    void finish_command(CmdInfo const& cmd, Params const& params, CmdResult&& result, double elapsed,
+                        bool use_stopwatch, std::ostream& output);
+    std::string output_storage_; // Reused by the OutputBuffers of command results
 
     template <typename Type>
     Type random(Type start, Type end);
@@ -170,16 +342,19 @@ private:
     template <typename From>
     static std::string convert_to_string(From from);
 
-    template<TownID(Datastructures::*MFUNC)()>
+    template<TownID(Datastructures::*MFUNC)() const>
     CmdResult NoParTownCmd(std::ostream& output, MatchIter begin, MatchIter end);
 
-    template<std::vector<TownID>(Datastructures::*MFUNC)()>
+    template<std::vector<TownID>(Datastructures::*MFUNC)() const>
     CmdResult NoParListCmd(std::ostream& output, MatchIter begin, MatchIter end);
 
-    template<TownID(Datastructures::*MFUNC)()>
+    template<TownViews(Datastructures::*MFUNC)() const>
+    CmdResult NoParViewCmd(std::ostream& output, MatchIter begin, MatchIter end);
+
+    template<TownID(Datastructures::*MFUNC)() const>
     void NoParTownTestCmd();
 
-    template<std::vector<TownID>(Datastructures::*MFUNC)()>
+    template<std::vector<TownID>(Datastructures::*MFUNC)() const>
     void NoParListTestCmd();
 
     void create_road_network();
@@ -229,27 +404,34 @@ std::string MainProgram::convert_to_string(From from)
     return ostr.str();
 }
 
-template<TownID(Datastructures::*MFUNC)()>
+template<TownID(Datastructures::*MFUNC)() const>
 MainProgram::CmdResult MainProgram::NoParTownCmd(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
 {
     auto result = (ds_.*MFUNC)();
     return {ResultType::LIST, {result}};
 }
 
-template<std::vector<TownID>(Datastructures::*MFUNC)()>
+template<std::vector<TownID>(Datastructures::*MFUNC)() const>
 MainProgram::CmdResult MainProgram::NoParListCmd(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
 {
     auto result = (ds_.*MFUNC)();
     return {ResultType::LIST, result};
 }
 
-template<TownID(Datastructures::*MFUNC)()>
+template<TownViews(Datastructures::*MFUNC)() const>
+MainProgram::CmdResult MainProgram::NoParViewCmd(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
+{
+    auto result = (ds_.*MFUNC)();
+    return {ResultType::LIST, std::move(result)};
+}
+
+template<TownID(Datastructures::*MFUNC)() const>
 void MainProgram::NoParTownTestCmd()
 {
     (ds_.*MFUNC)();
 }
 
-template<std::vector<TownID>(Datastructures::*MFUNC)()>
+template<std::vector<TownID>(Datastructures::*MFUNC)() const>
 void MainProgram::NoParListTestCmd()
 {
     (ds_.*MFUNC)();
@@ -257,6 +439,7 @@ void MainProgram::NoParListTestCmd()
 
 
 #ifdef USE_PERF_EVENT
+#include <cstring>
 extern "C"
 {
 #include <unistd.h>
@@ -406,5 +589,116 @@ private:
 #endif
 };
 
+// Collects repeated measurements (e.g. perftest trials) and calculates statistics from them
+class MainProgram::SampleStats
+{
+public:
+    void add(double sample) { samples_.push_back(sample); }
+
+    std::size_t size() const { return samples_.size(); }
+
+    double mean() const
+    {
+        if (samples_.empty()) { return 0; }
+        return std::accumulate(samples_.begin(), samples_.end(), 0.0) / samples_.size();
+    }
+
+    // Sample standard deviation, zero if there are less than two samples
+    double stddev() const
+    {
+        if (samples_.size() < 2) { return 0; }
+        auto m = mean();
+        auto sqsum = std::accumulate(samples_.begin(), samples_.end(), 0.0,
+                                     [m](double sum, double s){ return sum + (s-m)*(s-m); });
+        return std::sqrt(sqsum / (samples_.size()-1));
+    }
+
+    double min() const
+    {
+        if (samples_.empty()) { return 0; }
+        return *std::min_element(samples_.begin(), samples_.end());
+    }
+
+private:
+    std::vector<double> samples_;
+};
+
+// Zipf distributed integers 1...n, integer k has probability proportional to 1/k^s.
+// Uses rejection-inversion sampling (W. Hormann, G. Derflinger: "Rejection-inversion to generate variates
+// from monotone discrete distributions", 1996), so sampling is constant time and needs no tables even for huge n.
+class MainProgram::ZipfDistribution
+{
+public:
+    ZipfDistribution(unsigned long int n, double exponent) : exponent_(exponent)
+    {
+        set_size(n);
+    }
+
+    unsigned long int size() const { return n_; }
+
+    void set_size(unsigned long int n)
+    {
+        n_ = n;
+        h_integral_x1_ = h_integral(1.5) - 1.0;
+        h_integral_n_ = h_integral(n_ + 0.5);
+        s_ = 2.0 - h_integral_inverse(h_integral(2.5) - h(2.0));
+    }
+
+    template <typename Engine>
+    unsigned long int operator()(Engine& engine)
+    {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (;;)
+        {
+            double u = h_integral_n_ + uniform(engine) * (h_integral_x1_ - h_integral_n_);
+            double x = h_integral_inverse(u);
+            auto k = static_cast<unsigned long int>(x + 0.5);
+            if (k < 1) { k = 1; }
+            else if (k > n_) { k = n_; }
+
+            if (k - x <= s_ || u >= h_integral(k + 0.5) - h(static_cast<double>(k)))
+            {
+                return k;
+            }
+        }
+    }
+
+private:
+    double h(double x) const { return std::exp(-exponent_ * std::log(x)); }
+
+    double h_integral(double x) const
+    {
+        double logx = std::log(x);
+        return helper2((1.0 - exponent_) * logx) * logx;
+    }
+
+    double h_integral_inverse(double x) const
+    {
+        double t = x * (1.0 - exponent_);
+        if (t < -1.0) { t = -1.0; }
+        return std::exp(helper1(t) * x);
+    }
+
+    // log(1+x)/x, with a series expansion near zero
+    static double helper1(double x)
+    {
+        if (std::abs(x) > 1e-8) { return std::log1p(x) / x; }
+        return 1.0 - x * (0.5 - x * (1.0/3.0 - 0.25 * x));
+    }
+
+    // (exp(x)-1)/x, with a series expansion near zero
+    static double helper2(double x)
+    {
+        if (std::abs(x) > 1e-8) { return std::expm1(x) / x; }
+        return 1.0 + x * 0.5 * (1.0 + x * 1.0/3.0 * (1.0 + 0.25 * x));
+    }
+
+    double exponent_;
+    unsigned long int n_ = 0;
+    double h_integral_x1_ = 0;
+    double h_integral_n_ = 0;
+    double s_ = 0;
+};
+
 
 #endif // MAINPROGRAM_HH
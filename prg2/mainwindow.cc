@@ -71,6 +71,7 @@ MainWindow::MainWindow(QWidget *parent) :
     // Command selection
     // !!!!! Sort commands in alphabetical order (should not be done here, but is)
     std::sort(mainprg_.cmds_.begin(), mainprg_.cmds_.end(), [](auto const& l, auto const& r){ return l.cmd < r.cmd; });
+    mainprg_.init_cmd_lookup(); // The lookup table points to the commands, so it has to be rebuilt
     for (auto& cmd : mainprg_.cmds_)
     {
         ui->cmd_select->addItem(QString::fromStdString(cmd.cmd));
@@ -148,7 +149,7 @@ void MainWindow::update_view()
         auto fontscale = ui->fontscale->value();
 
         std::unordered_map<TownID, std::string> result_towns;
-        auto& prev_result = mainprg_.prev_result.second;
+        auto& prev_result = mainprg_.prev_result.second.ids;
         // Copy the stop id vector to the result set
         int i = 0;
         std::for_each(prev_result.begin(), prev_result.end(),
@@ -160,8 +161,24 @@ void MainWindow::update_view()
             errorset.insert("all_towns() returned error {NO_TOWNID}");
         }
 
-        for (auto& townid : towns)
+        // The coordinates and names of all the towns with one lookup each,
+        // or with the separate getters if get_towns_info() isn't implemented
+        std::vector<TownInfo> infos;
+        bool batched = true;
+        try
         {
+            infos = mainprg_.ds_.get_towns_info(towns);
+        }
+        catch (NotImplemented const& e)
+        {
+            batched = false;
+            errorset.insert(std::string("NotImplemented while updating graphics: ") + e.what());
+            std::cerr << std::endl << "NotImplemented while updating graphics: " << e.what() << std::endl;
+        }
+
+        for (std::size_t townidx = 0; townidx < towns.size(); ++townidx)
+        {
+            auto& townid = towns[townidx];
             auto res_place = std::find(prev_result.begin(), prev_result.end(), townid);
 
             QColor towncolor = Qt::white;
@@ -171,7 +188,7 @@ void MainWindow::update_view()
 
             try
             {
-                auto xy = mainprg_.ds_.get_town_coordinates(townid);
+                auto xy = batched ? infos[townidx].coord : mainprg_.ds_.get_town_coordinates(townid);
                 auto [x,y] = xy;
                 if (x == NO_VALUE || y == NO_VALUE)
                 {
@@ -217,7 +234,7 @@ void MainWindow::update_view()
                     {
                         try
                         {
-                            auto name = mainprg_.ds_.get_town_name(townid);
+                            auto name = batched ? Name(infos[townidx].name) : mainprg_.ds_.get_town_name(townid);
                             if (name == NO_NAME)
                             {
                                 errorset.insert("get_town_name() returned error NO_NAME");
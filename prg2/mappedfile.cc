@@ -0,0 +1,101 @@
+// Mappedfile.cc
+//
+// Read-only access to a whole file without copying it, and splitting
+// the contents into lines
+
+#include "mappedfile.hh"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPEDFILE_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename, Access access)
+{
+#ifdef MAPPEDFILE_USE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) { return; }
+
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_ == 0)
+        {
+            //mmap doesn't accept empty mappings
+            ok_ = true;
+        }
+        else
+        {
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                //a file read from start to end is read ahead, lookups that jump around
+                //the file only read the pages they touch
+                ::madvise(addr, size_, access == Access::SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+                data_ = static_cast<char const*>(addr);
+                mapped_ = true;
+                ok_ = true;
+            }
+        }
+    }
+    ::close(fd);
+
+    if (ok_) { return; }
+    //not a regular file (e.g. a pipe) or mapping failed, fall back to reading
+    size_ = 0;
+#endif
+    ok_ = read_file(filename);
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef MAPPEDFILE_USE_MMAP
+    if (mapped_)
+    {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+}
+
+bool MappedFile::read_file(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) { return false; }
+
+    buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (file.bad()) { return false; }
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+}
+
+bool LineReader::getline(std::string_view& line)
+{
+    if (rest_.empty())
+    {
+        line = {};
+        return false;
+    }
+
+    auto newline = static_cast<char const*>(std::memchr(rest_.data(), '\n', rest_.size()));
+    if (!newline)
+    {
+        line = rest_;
+        rest_ = {};
+        return true;
+    }
+
+    auto length = static_cast<std::size_t>(newline - rest_.data());
+    line = rest_.substr(0, length);
+    rest_.remove_prefix(length + 1);
+    return true;
+}
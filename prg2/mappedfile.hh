@@ -0,0 +1,55 @@
+// Mappedfile.hh
+//
+// Read-only access to a whole file without copying it, and splitting
+// the contents into lines
+
+#ifndef MAPPEDFILE_HH
+#define MAPPEDFILE_HH
+
+#include <string>
+#include <string_view>
+
+// The file is memory mapped where possible (POSIX), otherwise it's read into memory
+class MappedFile
+{
+public:
+    // How the contents will be read, so that the kernel knows whether to read ahead
+    enum class Access { SEQUENTIAL, RANDOM };
+
+    explicit MappedFile(std::string const& filename, Access access = Access::SEQUENTIAL);
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    // false if the file couldn't be opened or read
+    [[nodiscard]] bool ok() const { return ok_; }
+
+    // Valid as long as the MappedFile exists
+    [[nodiscard]] std::string_view contents() const { return {data_, size_}; }
+
+private:
+    bool read_file(std::string const& filename);
+
+    char const* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool ok_ = false;
+    bool mapped_ = false;
+    std::string buffer_; // used when the file isn't mapped
+};
+
+// Splits text into lines the same way as repeated std::getline calls: lines are separated by '\n',
+// which isn't included in the line, and a missing '\n' at the end still gives the last line
+class LineReader
+{
+public:
+    explicit LineReader(std::string_view text) : rest_(text) {}
+
+    // Returns false (and an empty line) when there are no more lines
+    bool getline(std::string_view& line);
+
+private:
+    std::string_view rest_;
+};
+
+#endif // MAPPEDFILE_HH
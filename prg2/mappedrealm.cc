@@ -0,0 +1,569 @@
+// Mappedrealm.cc
+//
+// Read-only queries straight from a memory mapped realm file
+
+#include "mappedrealm.hh"
+#include "distancekernel.hh"
+#include "sorting.hh"
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <stack>
+
+//the coordinate columns are passed to coord_distances() as they are in the file
+static_assert(sizeof(int) == sizeof(std::int32_t), "coordinates in realm files are 32-bit");
+
+MappedRealm::MappedRealm(const std::string& filename, bool check_contents)
+    : file_(filename, MappedFile::Access::RANDOM)
+{
+    if (!file_.ok())
+    {
+        error_ = "Cannot open file '" + filename + "'";
+        return;
+    }
+
+    const auto header = validate_realm(file_.contents(), error_, check_contents);
+    if (!header)
+        return;
+
+    towns_ = realm_section<RealmTown>(header, REALM_TOWNS);
+    xs_ = realm_section<int>(header, REALM_TOWN_XS);
+    ys_ = realm_section<int>(header, REALM_TOWN_YS);
+    index_ = realm_section<std::uint32_t>(header, REALM_ID_INDEX);
+    vassal_offsets_ = realm_section<std::uint64_t>(header, REALM_VASSAL_OFFSETS);
+    vassals_ = realm_section<std::uint32_t>(header, REALM_VASSALS);
+    road_offsets_ = realm_section<std::uint64_t>(header, REALM_ROAD_OFFSETS);
+    road_towns_ = realm_section<std::uint32_t>(header, REALM_ROAD_TOWNS);
+    roads_ = realm_section<RealmRoad>(header, REALM_ROADS);
+    strings_ = realm_section<char>(header, REALM_STRINGS);
+    header_ = header;
+}
+
+unsigned int MappedRealm::town_count() const
+{
+    return static_cast<unsigned int>(header_->town_count);
+}
+
+Name MappedRealm::get_town_name(const TownID& id) const
+{
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return NO_NAME;
+
+    return Name(name_of(town));
+}
+
+Coord MappedRealm::get_town_coordinates(const TownID& id) const
+{
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return NO_COORD;
+
+    return coord_of(town);
+}
+
+int MappedRealm::get_town_tax(const TownID& id) const
+{
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return NO_VALUE;
+
+    return towns_[town].tax;
+}
+
+TownInfo MappedRealm::get_town_info(const TownID& id) const
+{
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return {};
+
+    return { name_of(town), coord_of(town), towns_[town].tax };
+}
+
+std::vector<TownID> MappedRealm::all_towns() const
+{
+    return all_towns_as<TownID>();
+}
+
+TownViews MappedRealm::all_towns_view() const
+{
+    return all_towns_as<TownView>();
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::all_towns_as() const
+{
+    std::vector<Element> all_towns{};
+    all_towns.reserve(header_->town_count);
+    for (std::uint32_t town = 0; town < header_->town_count; ++town)
+        all_towns.push_back(town_as<Element>(town));
+    return all_towns;
+}
+
+std::vector<TownID> MappedRealm::find_towns(const Name& name) const
+{
+    std::vector<TownID> matching_towns{};
+    for (std::uint32_t town = 0; town < header_->town_count; ++town)
+        if (name_of(town) == name)
+            matching_towns.emplace_back(id_of(town));
+    return matching_towns;
+}
+
+std::vector<TownID> MappedRealm::towns_alphabetically() const
+{
+    return towns_alphabetically_as<TownID>();
+}
+
+TownViews MappedRealm::towns_alphabetically_view() const
+{
+    return towns_alphabetically_as<TownView>();
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::towns_alphabetically_as() const
+{
+    std::vector<std::uint32_t> towns(header_->town_count);
+    for (std::uint32_t town = 0; town < towns.size(); ++town)
+        towns[town] = town;
+
+    //ties are broken by id so that the order is always the same
+    std::sort(towns.begin(), towns.end(), [this](const auto& town1, const auto& town2)
+    {
+        return std::make_pair(name_of(town1), id_of(town1)) < std::make_pair(name_of(town2), id_of(town2));
+    });
+
+    return ids_of<Element>(towns.data(), towns.size());
+}
+
+std::vector<TownID> MappedRealm::towns_distance_increasing() const
+{
+    return towns_nearest({ 0, 0 });
+}
+
+TownID MappedRealm::min_distance() const
+{
+    if (header_->town_count == 0)
+        return NO_TOWNID;
+
+    return TownID(id_of(extreme_distance_town(false)));
+}
+
+TownID MappedRealm::max_distance() const
+{
+    if (header_->town_count == 0)
+        return NO_TOWNID;
+
+    return TownID(id_of(extreme_distance_town(true)));
+}
+
+std::uint32_t MappedRealm::extreme_distance_town(bool farthest) const
+{
+    std::vector<Distance> distances(header_->town_count);
+    coord_distances({ 0, 0 }, xs_, ys_, distances.size(), distances.data());
+
+    //ties are broken by id like in Datastructures, the ids are only compared for towns at the same distance
+    std::uint32_t best = 0;
+    for (std::uint32_t town = 1; town < distances.size(); ++town)
+    {
+        if (distances[town] != distances[best])
+        {
+            if (farthest ? distances[town] > distances[best] : distances[town] < distances[best])
+                best = town;
+        }
+        else if (farthest ? id_of(town) > id_of(best) : id_of(town) < id_of(best))
+        {
+            best = town;
+        }
+    }
+    return best;
+}
+
+std::vector<TownID> MappedRealm::get_town_vassals(const TownID& id) const
+{
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return { NO_TOWNID };
+
+    return ids_of(vassals_ + vassal_offsets_[town], vassal_offsets_[town + 1] - vassal_offsets_[town]);
+}
+
+std::vector<TownID> MappedRealm::taxer_path(const TownID& id) const
+{
+    return taxer_path_as<TownID>(id);
+}
+
+TownViews MappedRealm::taxer_path_view(const TownID& id) const
+{
+    return taxer_path_as<TownView>(id);
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::taxer_path_as(const TownID& id) const
+{
+    auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return { Element{ NO_TOWNID } };
+
+    std::vector taxers{ town_as<Element>(town) };
+    for (town = towns_[town].master; town != REALM_NO_INDEX; town = towns_[town].master)
+        taxers.push_back(town_as<Element>(town));
+    return taxers;
+}
+
+std::vector<TownID> MappedRealm::towns_nearest(Coord coord) const
+{
+    struct TownDistance
+    {
+        std::uint32_t town{};
+        Distance distance{};
+    };
+
+    const auto town_count = header_->town_count;
+    if (town_count == 0)
+        return {};
+
+    //the distances are calculated straight from the coordinate columns of the file
+    std::vector<Distance> distances(town_count);
+    coord_distances(coord, xs_, ys_, town_count, distances.data());
+
+    std::vector<TownDistance> towns_distance(town_count);
+    for (std::uint32_t town = 0; town < town_count; ++town)
+        towns_distance[town] = { town, distances[town] };
+
+    //ties are broken by id so that the order is always the same
+    radix_sort(towns_distance, [](const auto& town) { return town.distance; },
+               [this](const auto& town1, const auto& town2) { return id_of(town1.town) < id_of(town2.town); });
+
+    std::vector<TownID> town_ids{};
+    town_ids.reserve(town_count);
+    for (const auto& town : towns_distance)
+        town_ids.emplace_back(id_of(town.town));
+    return town_ids;
+}
+
+std::vector<TownID> MappedRealm::longest_vassal_path(const TownID& id) const
+{
+    if (header_->town_count == 0)
+        return {};
+
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return { NO_TOWNID };
+
+    std::vector longest_path{ id };
+    auto current_path = longest_path;
+    recursive_vassal_path(town, current_path, longest_path);
+    return longest_path;
+}
+
+int MappedRealm::total_net_tax(const TownID& id) const
+{
+    if (header_->town_count == 0)
+        return NO_VALUE;
+
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return NO_VALUE;
+
+    auto net_tax = recursive_net_tax(town);
+
+    //the master gets 10% of it
+    if (towns_[town].master != REALM_NO_INDEX)
+        net_tax -= static_cast<int>(.1 * net_tax);
+    return net_tax;
+}
+
+std::vector<std::pair<TownID, TownID>> MappedRealm::all_roads() const
+{
+    std::vector<std::pair<TownID, TownID>> all_roads{};
+    all_roads.reserve(header_->road_count);
+    for (std::uint64_t road = 0; road < header_->road_count; ++road)
+        all_roads.emplace_back(id_of(roads_[road].town1), id_of(roads_[road].town2));
+    return all_roads;
+}
+
+RoadViews MappedRealm::all_roads_view() const
+{
+    RoadViews all_roads{};
+    all_roads.reserve(header_->road_count);
+    for (std::uint64_t road = 0; road < header_->road_count; ++road)
+        all_roads.emplace_back(town_as<TownView>(roads_[road].town1), town_as<TownView>(roads_[road].town2));
+    return all_roads;
+}
+
+std::vector<TownID> MappedRealm::get_roads_from(const TownID& id) const
+{
+    return get_roads_from_as<TownID>(id);
+}
+
+TownViews MappedRealm::get_roads_from_view(const TownID& id) const
+{
+    return get_roads_from_as<TownView>(id);
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::get_roads_from_as(const TownID& id) const
+{
+    const auto town = find(id);
+    if (town == REALM_NO_INDEX)
+        return { Element{ NO_TOWNID } };
+
+    return ids_of<Element>(road_towns_ + road_offsets_[town], road_offsets_[town + 1] - road_offsets_[town]);
+}
+
+std::vector<TownID> MappedRealm::any_route(const TownID& fromid, const TownID& toid) const
+{
+    return least_towns_route(fromid, toid);
+}
+
+TownViews MappedRealm::any_route_view(const TownID& fromid, const TownID& toid) const
+{
+    return least_towns_route_view(fromid, toid);
+}
+
+std::vector<TownID> MappedRealm::least_towns_route(const TownID& fromid, const TownID& toid) const
+{
+    return least_towns_route_as<TownID>(fromid, toid);
+}
+
+TownViews MappedRealm::least_towns_route_view(const TownID& fromid, const TownID& toid) const
+{
+    return least_towns_route_as<TownView>(fromid, toid);
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::least_towns_route_as(const TownID& fromid, const TownID& toid) const
+{
+    if (fromid == toid)
+        return { };
+
+    const auto start = find(fromid);
+    const auto destination = find(toid);
+    if (start == REALM_NO_INDEX || destination == REALM_NO_INDEX)
+        return { Element{ NO_TOWNID } };
+
+    //bfs
+    SearchStates states(header_->town_count);
+    states[start].processed = true;
+    std::deque<std::uint32_t> queue{ start };
+
+    while (!queue.empty())
+    {
+        const auto town = queue.front();
+        queue.pop_front();
+
+        for (auto road = road_offsets_[town]; road < road_offsets_[town + 1]; ++road)
+        {
+            const auto connected_town = road_towns_[road];
+            auto& state = states[connected_town];
+            if (state.processed)
+                continue;
+
+            state.prev_town = town;
+            if (connected_town == destination)
+                return construct_town_path<Element>(destination, states);
+
+            state.processed = true;
+            queue.push_back(connected_town);
+        }
+    }
+
+    return { };
+}
+
+std::vector<TownID> MappedRealm::road_cycle_route(const TownID& startid) const
+{
+    return road_cycle_route_as<TownID>(startid);
+}
+
+TownViews MappedRealm::road_cycle_route_view(const TownID& startid) const
+{
+    return road_cycle_route_as<TownView>(startid);
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::road_cycle_route_as(const TownID& startid) const
+{
+    const auto start = find(startid);
+    if (start == REALM_NO_INDEX)
+        return { Element{ NO_TOWNID } };
+
+    //dfs
+    SearchStates states(header_->town_count);
+    std::stack<std::uint32_t> stack{};
+    stack.push(start);
+
+    while (!stack.empty())
+    {
+        const auto town = stack.top();
+        stack.pop();
+
+        if (states[town].processed)
+            continue;
+
+        states[town].processed = true;
+        stack.push(town);
+
+        for (auto road = road_offsets_[town]; road < road_offsets_[town + 1]; ++road)
+        {
+            const auto connected_town = road_towns_[road];
+            auto& state = states[connected_town];
+            if (!state.processed)
+            {
+                state.prev_town = town;
+                stack.push(connected_town);
+            }
+            //an already processed town that isn't where we came from closes the cycle
+            else if (connected_town != states[town].prev_town)
+            {
+                auto path = construct_town_path<Element>(town, states);
+                path.push_back(town_as<Element>(connected_town));
+                return path;
+            }
+        }
+    }
+
+    return { };
+}
+
+std::vector<TownID> MappedRealm::shortest_route(const TownID& fromid, const TownID& toid) const
+{
+    return shortest_route_as<TownID>(fromid, toid);
+}
+
+TownViews MappedRealm::shortest_route_view(const TownID& fromid, const TownID& toid) const
+{
+    return shortest_route_as<TownView>(fromid, toid);
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::shortest_route_as(const TownID& fromid, const TownID& toid) const
+{
+    if (fromid == toid)
+        return { };
+
+    const auto start = find(fromid);
+    const auto destination = find(toid);
+    if (start == REALM_NO_INDEX || destination == REALM_NO_INDEX)
+        return { Element{ NO_TOWNID } };
+
+    //A*
+    SearchStates states(header_->town_count);
+    states[start].processed = true;
+    states[start].distance = 0;
+
+    auto comparator = [&states](std::uint32_t first, std::uint32_t second)
+    {
+        return states[first].distance_estimate > states[second].distance_estimate;
+    };
+    std::priority_queue<std::uint32_t, std::vector<std::uint32_t>, decltype(comparator)> queue(comparator);
+    queue.push(start);
+
+    while (!queue.empty())
+    {
+        const auto town = queue.top();
+        queue.pop();
+
+        if (town == destination)
+            return construct_town_path<Element>(town, states);
+
+        for (auto road = road_offsets_[town]; road < road_offsets_[town + 1]; ++road)
+        {
+            const auto connected_town = road_towns_[road];
+            relax_a(town, connected_town, states);
+            if (!states[connected_town].processed)
+            {
+                states[connected_town].processed = true;
+                queue.push(connected_town);
+            }
+        }
+    }
+
+    return { };
+}
+
+std::uint32_t MappedRealm::find(std::string_view id) const
+{
+    //linear probing from the id's hash, the same way RealmFile::save() filled the index
+    const auto mask = header_->index_size - 1;
+    for (auto slot = realm_id_hash(id) & mask; index_[slot] != REALM_NO_INDEX; slot = (slot + 1) & mask)
+        if (id_of(index_[slot]) == id)
+            return index_[slot];
+    return REALM_NO_INDEX;
+}
+
+std::string_view MappedRealm::id_of(std::uint32_t town) const
+{
+    return { strings_ + towns_[town].id_offset, towns_[town].id_length };
+}
+
+std::string_view MappedRealm::name_of(std::uint32_t town) const
+{
+    return { strings_ + towns_[town].name_offset, towns_[town].name_length };
+}
+
+template <typename Element>
+Element MappedRealm::town_as(std::uint32_t town) const
+{
+    if constexpr (std::is_same_v<Element, TownView>)
+        return { id_of(town), { name_of(town), coord_of(town), towns_[town].tax } };
+    else
+        return TownID(id_of(town));
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::ids_of(const std::uint32_t* indices, std::uint64_t count) const
+{
+    std::vector<Element> ids{};
+    ids.reserve(count);
+    for (std::uint64_t i = 0; i < count; ++i)
+        ids.push_back(town_as<Element>(indices[i]));
+    return ids;
+}
+
+std::size_t MappedRealm::recursive_vassal_path(std::uint32_t town, std::vector<TownID>& current_path, std::vector<TownID>& longest_path) const
+{
+    for (auto vassal = vassal_offsets_[town]; vassal < vassal_offsets_[town + 1]; ++vassal)
+    {
+        current_path.emplace_back(id_of(vassals_[vassal]));
+        if (recursive_vassal_path(vassals_[vassal], current_path, longest_path) > longest_path.size())
+            longest_path = current_path;
+        current_path.pop_back();
+    }
+    return current_path.size();
+}
+
+int MappedRealm::recursive_net_tax(std::uint32_t town) const
+{
+    //each vassal pays 10% of its net tax, floored
+    int tax_earnings{};
+    for (auto vassal = vassal_offsets_[town]; vassal < vassal_offsets_[town + 1]; ++vassal)
+        tax_earnings += static_cast<int>(.1 * recursive_net_tax(vassals_[vassal]));
+    return tax_earnings + towns_[town].tax;
+}
+
+template <typename Element>
+std::vector<Element> MappedRealm::construct_town_path(std::uint32_t last_town, const SearchStates& states) const
+{
+    //go backwards from the last town until the start, which has no previous town
+    std::vector<Element> route{};
+    for (auto step = last_town; step != REALM_NO_INDEX; step = states[step].prev_town)
+        route.push_back(town_as<Element>(step));
+
+    std::reverse(route.begin(), route.end());
+    return route;
+}
+
+void MappedRealm::relax_a(std::uint32_t town, std::uint32_t connected_town, SearchStates& states) const
+{
+    const auto cost = coord_distance(coord_of(town), coord_of(connected_town));
+    const auto distance = states[town].distance;
+    auto& state = states[connected_town];
+    if (state.distance > distance + cost)
+    {
+        state.distance = distance + cost;
+        state.distance_estimate = state.distance + cost;
+        state.prev_town = town;
+    }
+}
@@ -0,0 +1,189 @@
+// Mappedrealm.hh
+//
+// Read-only queries straight from a memory mapped realm file (see realmfile.hh).
+// Opening only checks the header, so it takes the same time whatever the size of the file,
+// and processes that map the same file share one copy of it in the page cache.
+
+#ifndef MAPPEDREALM_HH
+#define MAPPEDREALM_HH
+
+#include "datastructures.hh"
+#include "mappedfile.hh"
+#include "realmfile.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The queries behave like the ones of Datastructures with the same names.
+// n is the number of towns and k the number of roads in the file.
+class MappedRealm
+{
+public:
+    // Estimate of performance: Theta(1), or Theta(n+k) with check_contents
+    // Short rationale for estimate:
+    // Mapping the file doesn't read it, and only the header and the section bounds are checked.
+    // The rest of the file is trusted to be what RealmFile::save() wrote, unless check_contents
+    // is given, in which case the whole file is checked like RealmFile::load() does.
+    explicit MappedRealm(std::string const& filename, bool check_contents = false);
+
+    MappedRealm(MappedRealm const&) = delete;
+    MappedRealm& operator=(MappedRealm const&) = delete;
+
+    // false if the file couldn't be mapped or isn't valid, the reason is in error()
+    [[nodiscard]] bool ok() const { return header_ != nullptr; }
+    [[nodiscard]] std::string const& error() const { return error_; }
+
+    // The whole file, valid as long as the MappedRealm exists
+    [[nodiscard]] std::string_view contents() const { return file_.contents(); }
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The count is in the header
+    unsigned int town_count() const;
+
+    // Estimate of performance: O(n), Omega(1)
+    // Short rationale for estimate:
+    // The id index is an open addressing hash table at most half full,
+    // so the probe sequence is constant on average and linear in the worst case
+    Name get_town_name(TownID const& id) const;
+    Coord get_town_coordinates(TownID const& id) const;
+    int get_town_tax(TownID const& id) const;
+    TownInfo get_town_info(TownID const& id) const;
+
+    // Estimate of performance: Theta(n)
+    // Short rationale for estimate:
+    // Every town in the file is gone through once
+    std::vector<TownID> all_towns() const;
+    std::vector<TownID> find_towns(Name const& name) const;
+    TownID min_distance() const;
+    TownID max_distance() const;
+
+    // Estimate of performance: Theta(nlog(n))
+    // Short rationale for estimate:
+    // The towns are sorted with std::sort, names are compared in place in the file
+    std::vector<TownID> towns_alphabetically() const;
+
+    // Estimate of performance: O(nlog(n)), Omega(n)
+    // Short rationale for estimate:
+    // The distances are calculated with coord_distances() straight from the coordinate
+    // columns of the file and radix sorted, like in Datastructures
+    std::vector<TownID> towns_distance_increasing() const;
+    std::vector<TownID> towns_nearest(Coord coord) const;
+
+    // Estimate of performance: O(n), Omega(1)
+    // Short rationale for estimate:
+    // The town is found from the id index, its vassals and roads are consecutive in the file
+    std::vector<TownID> get_town_vassals(TownID const& id) const;
+    std::vector<TownID> get_roads_from(TownID const& id) const;
+
+    // Estimate of performance: O(n), Omega(1)
+    // Short rationale for estimate:
+    // Each master on the way up is one index in the file
+    std::vector<TownID> taxer_path(TownID const& id) const;
+
+    // Estimate of performance: O(n), Omega(1)
+    // Short rationale for estimate:
+    // The same recursions as in Datastructures, through the vassal indices of the file
+    std::vector<TownID> longest_vassal_path(TownID const& id) const;
+    int total_net_tax(TownID const& id) const;
+
+    // Estimate of performance: Theta(k)
+    // Short rationale for estimate:
+    // The roads are listed in the file in all_roads() order
+    std::vector<std::pair<TownID, TownID>> all_roads() const;
+
+    // Estimate of performance: O(n+k), O((n+k)log(n)) for shortest_route()
+    // Short rationale for estimate:
+    // The same bfs, dfs and A* as in Datastructures, with the search state
+    // in vectors indexed by the towns' indices in the file
+    std::vector<TownID> any_route(TownID const& fromid, TownID const& toid) const;
+    std::vector<TownID> least_towns_route(TownID const& fromid, TownID const& toid) const;
+    std::vector<TownID> road_cycle_route(TownID const& startid) const;
+    std::vector<TownID> shortest_route(TownID const& fromid, TownID const& toid) const;
+
+    // Estimate of performance: the same as for the function of the same name without _view
+    // Short rationale for estimate:
+    // The same algorithms, with the ids and names of the towns as views into the file,
+    // so that they aren't copied or hashed like the TownIDs are
+    TownViews all_towns_view() const;
+    TownViews towns_alphabetically_view() const;
+    TownViews taxer_path_view(TownID const& id) const;
+    RoadViews all_roads_view() const;
+    TownViews get_roads_from_view(TownID const& id) const;
+    TownViews any_route_view(TownID const& fromid, TownID const& toid) const;
+    TownViews least_towns_route_view(TownID const& fromid, TownID const& toid) const;
+    TownViews road_cycle_route_view(TownID const& startid) const;
+    TownViews shortest_route_view(TownID const& fromid, TownID const& toid) const;
+
+private:
+    // the state of a single town during a graph search, like SearchState
+    struct SearchState
+    {
+        bool processed{};
+        std::uint32_t prev_town{ REALM_NO_INDEX };
+        Distance distance{ MAX_VALUE };
+        Distance distance_estimate{ MAX_VALUE };
+    };
+    using SearchStates = std::vector<SearchState>;
+
+    MappedFile file_;
+    std::string error_{};
+
+    // the sections of the file, set when the file is valid
+    RealmHeader const* header_{};
+    RealmTown const* towns_{};
+    int const* xs_{};
+    int const* ys_{};
+    std::uint32_t const* index_{};
+    std::uint64_t const* vassal_offsets_{};
+    std::uint32_t const* vassals_{};
+    std::uint64_t const* road_offsets_{};
+    std::uint32_t const* road_towns_{};
+    RealmRoad const* roads_{};
+    char const* strings_{};
+
+    // index of the town with this id, REALM_NO_INDEX if there is none
+    std::uint32_t find(std::string_view id) const;
+
+    std::string_view id_of(std::uint32_t town) const;
+
+    // index of the town nearest to or farthest from (0,0), ties broken by id like in Datastructures
+    std::uint32_t extreme_distance_town(bool farthest) const;
+    std::string_view name_of(std::uint32_t town) const;
+    Coord coord_of(std::uint32_t town) const { return { xs_[town], ys_[town] }; }
+
+    // the town as a TownID or a TownView
+    template <typename Element>
+    Element town_as(std::uint32_t town) const;
+
+    // ids (or views) of the count towns whose indices start at indices
+    template <typename Element = TownID>
+    std::vector<Element> ids_of(std::uint32_t const* indices, std::uint64_t count) const;
+
+    // the lists as ids or views, like in Datastructures
+    template <typename Element>
+    std::vector<Element> all_towns_as() const;
+    template <typename Element>
+    std::vector<Element> towns_alphabetically_as() const;
+    template <typename Element>
+    std::vector<Element> taxer_path_as(TownID const& id) const;
+    template <typename Element>
+    std::vector<Element> get_roads_from_as(TownID const& id) const;
+    template <typename Element>
+    std::vector<Element> least_towns_route_as(TownID const& fromid, TownID const& toid) const;
+    template <typename Element>
+    std::vector<Element> road_cycle_route_as(TownID const& startid) const;
+    template <typename Element>
+    std::vector<Element> shortest_route_as(TownID const& fromid, TownID const& toid) const;
+
+    // the same as in Datastructures, with town indices instead of pointers
+    std::size_t recursive_vassal_path(std::uint32_t town, std::vector<TownID>& current_path, std::vector<TownID>& longest_path) const;
+    int recursive_net_tax(std::uint32_t town) const;
+    template <typename Element>
+    std::vector<Element> construct_town_path(std::uint32_t last_town, SearchStates const& states) const;
+    void relax_a(std::uint32_t town, std::uint32_t connected_town, SearchStates& states) const;
+};
+
+#endif // MAPPEDREALM_HH
@@ -0,0 +1,505 @@
+// Mutationlog.cc
+//
+// Write-ahead log of the changes to a Datastructures, with periodic checkpoints
+
+#include "mutationlog.hh"
+#include "datastructures.hh"
+#include "mappedfile.hh"
+#include "realmfile.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+    constexpr char LOG_MAGIC[8] = "PRG2WAL";
+    constexpr std::uint64_t LOG_VERSION = 1;
+
+    // sanity limit for reading, so that a corrupted length can't make us read past the record
+    constexpr std::uint64_t MAX_RECORD_LENGTH = 1 << 26;
+
+    // a change waits for the flusher only when this many groups are waiting to be written
+    constexpr std::size_t MAX_UNWRITTEN_GROUPS = 4;
+
+    void put_varint(std::string& out, std::uint64_t value)
+    {
+        //7 bits per byte, the high bit tells whether more bytes follow
+        do
+        {
+            auto byte = static_cast<unsigned char>(value & 0x7f);
+            value >>= 7;
+            if (value)
+                byte |= 0x80;
+            out.push_back(static_cast<char>(byte));
+        } while (value);
+    }
+
+    bool get_varint(std::string_view& in, std::uint64_t& value)
+    {
+        value = 0;
+        for (auto shift = 0; shift < 64 && !in.empty(); shift += 7)
+        {
+            const auto byte = static_cast<unsigned char>(in.front());
+            in.remove_prefix(1);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool get_string(std::string_view& in, std::string_view& str)
+    {
+        std::uint64_t length{};
+        if (!get_varint(in, length) || length > in.size())
+            return false;
+        str = in.substr(0, length);
+        in.remove_prefix(length);
+        return true;
+    }
+
+    std::uint32_t checksum(std::string_view payload)
+    {
+        return static_cast<std::uint32_t>(realm_id_hash(payload));
+    }
+
+    // lsn from a file name like prefix<lsn>suffix
+    bool parse_lsn(std::string const& filename, std::string_view prefix, std::string_view suffix, std::uint64_t& lsn)
+    {
+        if (filename.size() <= prefix.size() + suffix.size() || filename.compare(0, prefix.size(), prefix) != 0 ||
+            filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) != 0)
+            return false;
+
+        const auto digits = filename.substr(prefix.size(), filename.size() - prefix.size() - suffix.size());
+        if (!std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+            return false;
+        lsn = std::stoull(digits);
+        return true;
+    }
+
+    std::string checkpoint_name(std::uint64_t lsn) { return "checkpoint-" + std::to_string(lsn) + ".realm"; }
+    std::string log_name(std::uint64_t lsn) { return "log-" + std::to_string(lsn) + ".wal"; }
+
+    // Applies a logged change to ds, returns false if the record doesn't make sense
+    bool apply(Datastructures& ds, MutationType type, std::vector<std::string_view> const& strings,
+               std::vector<std::int64_t> const& numbers)
+    {
+        auto str = [&strings](std::size_t i) { return std::string(strings[i]); };
+        auto number = [&numbers](std::size_t i) { return static_cast<int>(numbers[i]); };
+
+        //the changes were logged only when they succeeded, so replaying them succeeds too
+        switch (type)
+        {
+        case MutationType::ADD_TOWN:
+            if (strings.size() != 2 || numbers.size() != 3) { return false; }
+            ds.add_town(str(0), str(1), { number(0), number(1) }, number(2));
+            return true;
+        case MutationType::CHANGE_TOWN_NAME:
+            if (strings.size() != 2) { return false; }
+            ds.change_town_name(str(0), str(1));
+            return true;
+        case MutationType::ADD_VASSALSHIP:
+            if (strings.size() != 2) { return false; }
+            ds.add_vassalship(str(0), str(1));
+            return true;
+        case MutationType::REMOVE_TOWN:
+            if (strings.size() != 1) { return false; }
+            ds.remove_town(str(0));
+            return true;
+        case MutationType::ADD_ROAD:
+            if (strings.size() != 2) { return false; }
+            ds.add_road(str(0), str(1));
+            return true;
+        case MutationType::REMOVE_ROAD:
+            if (strings.size() != 2) { return false; }
+            ds.remove_road(str(0), str(1));
+            return true;
+        case MutationType::TRIM_ROAD_NETWORK:
+        {
+            //which roads remain depends on the order of equally long roads in memory,
+            //so the result is logged instead of running the trim again
+            if (strings.size() % 2 != 0) { return false; }
+            std::vector<std::pair<TownID, TownID>> roads{};
+            roads.reserve(strings.size() / 2);
+            for (std::size_t i = 0; i < strings.size(); i += 2)
+                roads.emplace_back(str(i), str(i + 1));
+            ds.clear_roads();
+            ds.add_roads(roads);
+            return true;
+        }
+        case MutationType::CLEAR_ROADS:
+            ds.clear_roads();
+            return true;
+        case MutationType::CLEAR_ALL:
+            ds.clear_all();
+            return true;
+        }
+        return false;
+    }
+}
+
+MutationLog::MutationLog(const std::string& directory, const MutationLogSettings& settings, Datastructures& ds)
+    : directory_(directory), settings_(settings)
+{
+    if (!recover(ds))
+        return;
+
+    //with single change groups every change is synced by append() itself
+    if (settings_.group_size > 1)
+        flusher_ = std::thread(&MutationLog::flush_old_groups, this);
+}
+
+MutationLog::~MutationLog()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    flusher_wakeup_.notify_all();
+    if (flusher_.joinable())
+        flusher_.join();
+
+    sync();
+    if (file_)
+        std::fclose(file_);
+}
+
+bool MutationLog::ok() const
+{
+    std::lock_guard lock(mutex_);
+    return error_.empty();
+}
+
+std::string MutationLog::error() const
+{
+    std::lock_guard lock(mutex_);
+    return error_;
+}
+
+std::uint64_t MutationLog::lsn() const
+{
+    std::lock_guard lock(mutex_);
+    return lsn_;
+}
+
+std::uint64_t MutationLog::syncs() const
+{
+    std::lock_guard lock(file_mutex_);
+    return syncs_;
+}
+
+bool MutationLog::append(MutationType type, std::initializer_list<std::string_view> strings, std::initializer_list<std::int64_t> numbers)
+{
+    return append_record(type, strings.begin(), strings.size(), numbers.begin(), numbers.size());
+}
+
+bool MutationLog::append(MutationType type, const std::vector<std::string_view>& strings)
+{
+    return append_record(type, strings.data(), strings.size(), nullptr, 0);
+}
+
+bool MutationLog::append_record(MutationType type, const std::string_view* strings, std::size_t string_count,
+                                const std::int64_t* numbers, std::size_t number_count)
+{
+    //the payload without the lsn is encoded outside the lock
+    std::string payload{};
+    payload.push_back(static_cast<char>(type));
+    put_varint(payload, string_count);
+    for (std::size_t i = 0; i < string_count; ++i)
+    {
+        put_varint(payload, strings[i].size());
+        payload.append(strings[i]);
+    }
+    put_varint(payload, number_count);
+    for (std::size_t i = 0; i < number_count; ++i)
+    {
+        //zigzag, so that small negative numbers are short too
+        const auto value = static_cast<std::uint64_t>(numbers[i]);
+        put_varint(payload, (value << 1) ^ (numbers[i] < 0 ? ~std::uint64_t{} : 0));
+    }
+
+    bool wait_for_disk{};
+    bool checkpoint_due{};
+    {
+        std::lock_guard lock(mutex_);
+        std::string lsn{};
+        put_varint(lsn, ++lsn_);
+        payload.insert(0, lsn);
+
+        const auto sum = checksum(payload);
+        put_varint(group_, payload.size());
+        group_.append(reinterpret_cast<char const*>(&sum), sizeof(sum));
+        group_.append(payload);
+
+        //the flusher writes full groups while the next one is being filled,
+        //unless it falls so far behind that the changes have to wait for it
+        if (group_records_++ == 0)
+            group_start_ = std::chrono::steady_clock::now();
+        if (group_records_ == 1 || group_records_ == settings_.group_size)
+            flusher_wakeup_.notify_one();
+        wait_for_disk = settings_.group_size == 1 || group_records_ >= MAX_UNWRITTEN_GROUPS * settings_.group_size;
+        checkpoint_due = settings_.checkpoint_interval && lsn_ - checkpoint_lsn_ >= settings_.checkpoint_interval;
+    }
+
+    if (wait_for_disk)
+        sync();
+    return checkpoint_due;
+}
+
+bool MutationLog::sync()
+{
+    std::lock_guard file_lock(file_mutex_);
+    return write_group();
+}
+
+bool MutationLog::write_group()
+{
+    std::string group{};
+    {
+        std::lock_guard lock(mutex_);
+        group.swap(group_);
+        group_records_ = 0;
+        if (!error_.empty())
+            return false;
+    }
+    if (group.empty())
+        return true;
+
+    if (!file_ || std::fwrite(group.data(), 1, group.size(), file_) != group.size() || !sync_file(file_))
+    {
+        set_error("Cannot write the mutation log in '" + directory_ + "'");
+        return false;
+    }
+    ++syncs_;
+    return true;
+}
+
+bool MutationLog::checkpoint(const Datastructures& ds, std::string& error)
+{
+    namespace fs = std::filesystem;
+
+    std::lock_guard file_lock(file_mutex_);
+    if (!write_group())
+    {
+        error = this->error();
+        return false;
+    }
+
+    //the caller doesn't change ds during the checkpoint, so it has exactly lsn changes
+    std::uint64_t lsn{};
+    {
+        std::lock_guard lock(mutex_);
+        lsn = lsn_;
+        checkpoint_lsn_ = lsn;
+    }
+
+    //the checkpoint must be on the disk before the older checkpoints and logs are deleted below
+    const auto directory = fs::path(directory_);
+    if (!RealmFile::save(ds, (directory / checkpoint_name(lsn)).string(), error, true))
+        return false;
+
+    //the changes up to lsn are now in the checkpoint, the next ones go to a new log
+    std::fclose(file_);
+    file_ = nullptr;
+    if (!open_file((directory / log_name(lsn)).string(), lsn, true))
+    {
+        error = this->error();
+        return false;
+    }
+
+    std::error_code ignored;
+    for (const auto& entry : fs::directory_iterator(directory, ignored))
+    {
+        const auto filename = entry.path().filename().string();
+        std::uint64_t file_lsn{};
+        if ((parse_lsn(filename, "checkpoint-", ".realm", file_lsn) || parse_lsn(filename, "log-", ".wal", file_lsn)) && file_lsn != lsn)
+            fs::remove(entry.path(), ignored);
+    }
+    sync_directory(directory_);
+    return true;
+}
+
+bool MutationLog::recover(Datastructures& ds)
+{
+    namespace fs = std::filesystem;
+
+    const auto directory = fs::path(directory_);
+    std::error_code fs_error;
+    fs::create_directories(directory, fs_error);
+    if (fs_error)
+    {
+        set_error("Cannot create directory '" + directory_ + "'");
+        return false;
+    }
+
+    std::uint64_t checkpoint_lsn{};
+    bool has_checkpoint{};
+    std::vector<std::uint64_t> logs{};
+    for (const auto& entry : fs::directory_iterator(directory, fs_error))
+    {
+        const auto filename = entry.path().filename().string();
+        std::uint64_t lsn{};
+        if (parse_lsn(filename, "checkpoint-", ".realm", lsn))
+        {
+            checkpoint_lsn = has_checkpoint ? std::max(checkpoint_lsn, lsn) : lsn;
+            has_checkpoint = true;
+        }
+        else if (parse_lsn(filename, "log-", ".wal", lsn))
+        {
+            logs.push_back(lsn);
+        }
+    }
+    std::sort(logs.begin(), logs.end());
+
+    if (has_checkpoint)
+    {
+        std::string error;
+        if (!RealmFile::load(ds, (directory / checkpoint_name(checkpoint_lsn)).string(), error))
+        {
+            set_error("Cannot recover checkpoint: " + error);
+            return false;
+        }
+    }
+    else
+    {
+        ds.clear_all();
+    }
+    lsn_ = checkpoint_lsn;
+    checkpoint_lsn_ = checkpoint_lsn;
+
+    //replay the changes after the checkpoint. A log older than the checkpoint is only left
+    //if the process died while checkpointing, its changes up to the checkpoint are skipped.
+    std::vector<std::string_view> strings{};
+    std::vector<std::int64_t> numbers{};
+    std::uint64_t valid_size{};
+    for (const auto base_lsn : logs)
+    {
+        if (base_lsn > lsn_)
+        {
+            set_error("Changes " + std::to_string(lsn_ + 1) + "-" + std::to_string(base_lsn) + " are missing from '" + directory_ + "'");
+            return false;
+        }
+
+        MappedFile file((directory / log_name(base_lsn)).string());
+        std::string_view rest = file.contents();
+        std::uint64_t version{};
+        std::uint64_t file_lsn{};
+        valid_size = 0;
+        //a log with an incomplete header was being created when the process died
+        if (rest.size() < sizeof(LOG_MAGIC) || std::memcmp(rest.data(), LOG_MAGIC, sizeof(LOG_MAGIC)) != 0)
+            continue;
+        rest.remove_prefix(sizeof(LOG_MAGIC));
+        if (!get_varint(rest, version) || version != LOG_VERSION || !get_varint(rest, file_lsn) || file_lsn != base_lsn)
+            continue;
+        valid_size = file.contents().size() - rest.size();
+
+        //a record that is cut short, corrupted or out of sequence ends the log
+        for (;;)
+        {
+            std::uint64_t length{};
+            std::uint32_t sum{};
+            if (!get_varint(rest, length) || length > MAX_RECORD_LENGTH || rest.size() < sizeof(sum) + length)
+                break;
+            std::memcpy(&sum, rest.data(), sizeof(sum));
+            auto payload = rest.substr(sizeof(sum), length);
+            if (checksum(payload) != sum)
+                break;
+            rest.remove_prefix(sizeof(sum) + length);
+
+            std::uint64_t lsn{};
+            std::uint64_t count{};
+            if (!get_varint(payload, lsn) || lsn > lsn_ + 1 || payload.empty())
+                break;
+            const auto type = static_cast<MutationType>(payload.front());
+            payload.remove_prefix(1);
+
+            strings.clear();
+            numbers.clear();
+            bool valid = get_varint(payload, count) && count <= payload.size();
+            for (std::uint64_t i = 0; valid && i < count; ++i)
+                valid = get_string(payload, strings.emplace_back());
+            valid = valid && get_varint(payload, count) && count <= payload.size();
+            for (std::uint64_t i = 0; valid && i < count; ++i)
+            {
+                std::uint64_t value{};
+                valid = get_varint(payload, value);
+                numbers.push_back(static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1));
+            }
+            if (!valid)
+                break;
+
+            if (lsn == lsn_ + 1)
+            {
+                if (!apply(ds, type, strings, numbers))
+                    break;
+                ++lsn_;
+                ++replayed_;
+            }
+            valid_size = file.contents().size() - rest.size();
+        }
+    }
+
+    //continue the last log after its last valid record, or start a new one
+    if (!logs.empty() && valid_size > 0)
+    {
+        const auto filename = (directory / log_name(logs.back())).string();
+        fs::resize_file(filename, valid_size, fs_error);
+        return !fs_error && open_file(filename, logs.back(), false);
+    }
+    return open_file((directory / log_name(lsn_)).string(), lsn_, true);
+}
+
+bool MutationLog::open_file(const std::string& filename, std::uint64_t base_lsn, bool create)
+{
+    file_ = std::fopen(filename.c_str(), create ? "wb" : "ab");
+    if (!file_)
+    {
+        set_error("Cannot open file '" + filename + "' for writing");
+        return false;
+    }
+    if (!create)
+        return true;
+
+    std::string header(LOG_MAGIC, sizeof(LOG_MAGIC));
+    put_varint(header, LOG_VERSION);
+    put_varint(header, base_lsn);
+    if (std::fwrite(header.data(), 1, header.size(), file_) != header.size() || !sync_file(file_))
+    {
+        set_error("Cannot write file '" + filename + "'");
+        return false;
+    }
+    sync_directory(directory_);
+    return true;
+}
+
+void MutationLog::set_error(const std::string& error)
+{
+    std::lock_guard lock(mutex_);
+    if (error_.empty())
+        error_ = error;
+}
+
+void MutationLog::flush_old_groups()
+{
+    std::unique_lock lock(mutex_);
+    while (!stopping_)
+    {
+        if (group_records_ == 0)
+        {
+            flusher_wakeup_.wait(lock);
+            continue;
+        }
+
+        const auto deadline = group_start_ + settings_.group_delay;
+        if (group_records_ < settings_.group_size && std::chrono::steady_clock::now() < deadline)
+        {
+            flusher_wakeup_.wait_until(lock, deadline);
+            continue;
+        }
+
+        lock.unlock();
+        sync();
+        lock.lock();
+    }
+}
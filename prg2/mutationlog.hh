@@ -0,0 +1,143 @@
+// Mutationlog.hh
+//
+// Write-ahead log of the changes to a Datastructures, with periodic checkpoints,
+// so that the database survives the process dying
+
+#ifndef MUTATIONLOG_HH
+#define MUTATIONLOG_HH
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class Datastructures;
+
+// Kinds of logged changes and their parameters (strings; numbers)
+enum class MutationType : std::uint8_t
+{
+    ADD_TOWN = 1,      // id, name; x, y, tax
+    CHANGE_TOWN_NAME,  // id, new name
+    ADD_VASSALSHIP,    // vassal id, master id
+    REMOVE_TOWN,       // id
+    ADD_ROAD,          // town1 id, town2 id
+    REMOVE_ROAD,       // town1 id, town2 id
+    TRIM_ROAD_NETWORK, // the ids of the remaining roads' towns, two per road, in all_roads() order
+    CLEAR_ROADS,
+    CLEAR_ALL
+};
+
+struct MutationLogSettings
+{
+    // A group of changes is written and synced to disk at once by a background thread, when it
+    // has group_size changes or group_delay has passed since its first change, whichever comes
+    // first. The changes wait for the disk only if a few groups are already waiting to be written.
+    // The unwritten groups are lost if the process dies. group_size 1 syncs every change before it returns.
+    std::size_t group_size = 256;
+    std::chrono::milliseconds group_delay{ 10 };
+
+    // A checkpoint is written every checkpoint_interval changes, so that recovery only replays
+    // the changes after it. 0 only writes checkpoints when asked.
+    std::uint64_t checkpoint_interval = 100000;
+};
+
+// Files in the log's directory, where lsn is the number of changes before them (log sequence number):
+//   checkpoint-<lsn>.realm  the database after lsn changes, written by RealmFile::save()
+//   log-<lsn>.wal           the changes after lsn, until the next checkpoint
+//
+// Log file format: "PRG2WAL" magic (8 bytes including the terminating zero), format version
+// and the lsn of the file name as varints, then the records one after another. Each record is
+//   payload length (varint), checksum of the payload (4 bytes, the low half of its FNV-1a hash),
+//   payload: lsn (varint), MutationType (1 byte), number of strings (varint), strings,
+//            number of numbers (varint), numbers (zigzag varints)
+// where strings are stored as their length (varint) followed by the characters, and varints are
+// unsigned LEB128 like in workload traces. A record that is cut short or doesn't match its
+// checksum ends the log, which is what a crash in the middle of a write leaves behind.
+class MutationLog
+{
+public:
+    // Estimate of performance: O(n+k+m), where n and k are the number of towns and roads
+    // in the checkpoint and m the number of changes logged after it
+    // Short rationale for estimate:
+    // Recovery loads the latest checkpoint with RealmFile::load() and replays the
+    // changes after it. Everything before the checkpoint is skipped.
+    // Replaces the contents of ds with the recovered database and starts a new log group.
+    // ok() is false and error() tells why if the directory couldn't be recovered.
+    MutationLog(std::string const& directory, MutationLogSettings const& settings, Datastructures& ds);
+    ~MutationLog();
+
+    MutationLog(MutationLog const&) = delete;
+    MutationLog& operator=(MutationLog const&) = delete;
+
+    // false if recovery or a write has failed, the reason is in error()
+    [[nodiscard]] bool ok() const;
+    [[nodiscard]] std::string error() const;
+
+    // Number of changes in the database since it was empty
+    [[nodiscard]] std::uint64_t lsn() const;
+
+    // Number of changes replayed when the log was opened, and the groups synced since
+    [[nodiscard]] std::uint64_t replayed() const { return replayed_; }
+    [[nodiscard]] std::uint64_t syncs() const;
+
+    // Estimate of performance: Theta(s), where s is the size of the change
+    // Short rationale for estimate:
+    // The change is encoded to the group's buffer, the groups are written by the flusher thread.
+    // Returns true when a checkpoint is due.
+    bool append(MutationType type, std::initializer_list<std::string_view> strings,
+                std::initializer_list<std::int64_t> numbers = {});
+    bool append(MutationType type, std::vector<std::string_view> const& strings);
+
+    // Estimate of performance: Theta(g), where g is the size of the unwritten group
+    // Short rationale for estimate:
+    // The group is written and the file synced once
+    bool sync();
+
+    // Estimate of performance: O(n+k), where n is the number of towns and k the number of roads
+    // Short rationale for estimate:
+    // The whole database is saved and synced with RealmFile::save(), after which a new log
+    // file is started and the older checkpoints and logs are deleted.
+    // A failed checkpoint doesn't stop the logging, the next one is tried after another
+    // checkpoint_interval changes. Returns false and the reason in error if it failed.
+    bool checkpoint(Datastructures const& ds, std::string& error);
+
+private:
+    std::string directory_;
+    MutationLogSettings settings_;
+    std::uint64_t replayed_ = 0;
+
+    // guards the group that hasn't been written yet, the lsn and the error
+    mutable std::mutex mutex_;
+    std::string group_;
+    std::size_t group_records_ = 0;
+    std::chrono::steady_clock::time_point group_start_{};
+    std::uint64_t lsn_ = 0;
+    std::uint64_t checkpoint_lsn_ = 0;
+    std::string error_;
+
+    // guards the file, so that the groups are written in order
+    mutable std::mutex file_mutex_;
+    std::FILE* file_ = nullptr;
+    std::uint64_t syncs_ = 0;
+
+    // writes the groups that are full or older than group_delay
+    std::thread flusher_;
+    std::condition_variable flusher_wakeup_;
+    bool stopping_ = false;
+
+    bool recover(Datastructures& ds);
+    bool open_file(std::string const& filename, std::uint64_t base_lsn, bool create);
+    bool append_record(MutationType type, std::string_view const* strings, std::size_t string_count,
+                       std::int64_t const* numbers, std::size_t number_count);
+    bool write_group(); // file_mutex_ must be held
+    void set_error(std::string const& error);
+    void flush_old_groups();
+};
+
+#endif // MUTATIONLOG_HH
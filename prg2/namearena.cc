@@ -0,0 +1,44 @@
+// Namearena.cc
+
+#include "namearena.hh"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+NameHandle NameArena::add(std::string_view name)
+{
+    //handles store 32-bit offsets
+    if (name.size() > std::numeric_limits<std::uint32_t>::max() - chars_.size())
+        throw std::length_error("NameArena: more than 4 GiB of names");
+
+    const NameHandle handle{ static_cast<std::uint32_t>(chars_.size()), static_cast<std::uint32_t>(name.size()) };
+    chars_.insert(chars_.end(), name.begin(), name.end());
+    return handle;
+}
+
+void NameArena::replace(NameHandle& handle, std::string_view name)
+{
+    if (name.size() <= handle.length)
+    {
+        std::copy(name.begin(), name.end(), chars_.begin() + handle.offset);
+        garbage_ += handle.length - name.size();
+        handle.length = static_cast<std::uint32_t>(name.size());
+        return;
+    }
+
+    const auto added = add(name);
+    release(handle);
+    handle = added;
+}
+
+bool NameArena::needs_compaction() const
+{
+    return garbage_ >= MIN_COMPACTION_GARBAGE && garbage_ > live_size();
+}
+
+void NameArena::clear()
+{
+    chars_.clear();
+    garbage_ = 0;
+}
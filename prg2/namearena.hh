@@ -0,0 +1,66 @@
+// Namearena.hh
+//
+// Append-only storage for the names of the towns. All the names are in one buffer and
+// a town only keeps a small handle to its name, instead of a std::string of its own,
+// which takes 32 bytes even when empty and a heap block of its own for long names.
+
+#ifndef NAMEARENA_HH
+#define NAMEARENA_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Position of a name in a NameArena, only valid in the arena that created it
+struct NameHandle
+{
+    std::uint32_t offset{};
+    std::uint32_t length{};
+};
+
+class NameArena
+{
+public:
+    // Estimate of performance: Theta(s) amortized, where s is the length of the name
+    // Short rationale for estimate:
+    // The name is appended to the end of the buffer, which grows like a vector
+    NameHandle add(std::string_view name);
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The handle tells where the name is, no copying.
+    // The view is valid until the next add(), replace() or clear().
+    std::string_view view(NameHandle handle) const { return { chars_.data() + handle.offset, handle.length }; }
+
+    // Estimate of performance: Theta(s) amortized, where s is the length of the new name
+    // Short rationale for estimate:
+    // A name that fits in the old one's place overwrites it, a longer one is appended.
+    // Whatever the old name doesn't use anymore becomes garbage until compaction.
+    void replace(NameHandle& handle, std::string_view name);
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The name's characters are only counted as garbage
+    void release(NameHandle handle) { garbage_ += handle.length; }
+
+    // true when there is more garbage than names, so that compacting takes
+    // at most as long as the changes that made the garbage
+    [[nodiscard]] bool needs_compaction() const;
+
+    // Characters in the buffer that are still in use and its allocated size in bytes
+    [[nodiscard]] std::size_t live_size() const { return chars_.size() - garbage_; }
+    [[nodiscard]] std::size_t capacity() const { return chars_.capacity(); }
+
+    void reserve(std::size_t size) { chars_.reserve(size); }
+    void clear();
+
+private:
+    // compaction isn't worth it for arenas smaller than this
+    static constexpr std::size_t MIN_COMPACTION_GARBAGE = 4096;
+
+    std::vector<char> chars_{};
+    std::size_t garbage_ = 0;
+};
+
+#endif // NAMEARENA_HH
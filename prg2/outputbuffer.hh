@@ -0,0 +1,83 @@
+// Outputbuffer.hh
+//
+// Fast formatting of command results: text is collected into a string
+// and written to the output stream in large pieces
+
+#ifndef OUTPUTBUFFER_HH
+#define OUTPUTBUFFER_HH
+
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <charconv>
+#include <type_traits>
+
+// Writes to the buffer never flush the stream, use '\n' instead of std::endl.
+// Everything is written to the stream (and the stream flushed) by flush() or the destructor.
+class OutputBuffer
+{
+public:
+    // The storage is cleared, but its capacity is reused, so a long-lived storage string avoids allocations
+    OutputBuffer(std::ostream& output, std::string& storage) : output_(output), buffer_(storage)
+    {
+        buffer_.clear();
+    }
+
+    ~OutputBuffer() { flush(); }
+
+    OutputBuffer(OutputBuffer const&) = delete;
+    OutputBuffer& operator=(OutputBuffer const&) = delete;
+
+    OutputBuffer& operator<<(std::string_view str)
+    {
+        buffer_.append(str.data(), str.size());
+        write_if_full();
+        return *this;
+    }
+
+    OutputBuffer& operator<<(char c)
+    {
+        buffer_.push_back(c);
+        write_if_full();
+        return *this;
+    }
+
+    template <typename Int, typename = std::enable_if_t<std::is_integral_v<Int> && !std::is_same_v<Int, char> && !std::is_same_v<Int, bool>>>
+    OutputBuffer& operator<<(Int value)
+    {
+        char digits[24]; // enough for any 64-bit integer with sign
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        buffer_.append(digits, end);
+        write_if_full();
+        return *this;
+    }
+
+    void flush()
+    {
+        write();
+        output_.flush();
+    }
+
+private:
+    // Bounds the memory used for huge results
+    static constexpr std::string::size_type MAX_BUFFERED = 1 << 20;
+
+    void write_if_full()
+    {
+        if (buffer_.size() >= MAX_BUFFERED) { write(); }
+    }
+
+    void write()
+    {
+        if (!buffer_.empty())
+        {
+            output_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+            buffer_.clear();
+        }
+    }
+
+    std::ostream& output_;
+    std::string& buffer_;
+};
+
+#endif // OUTPUTBUFFER_HH
@@ -0,0 +1,59 @@
+#-------------------------------------------------
+#
+# Headless batch engine: the same command interpreter as prg2.pro,
+# but without Qt or the GUI. Commands are read from a file or stdin,
+# run "prg2-headless --help" for the command line options.
+#
+#-------------------------------------------------
+
+# Uncomment the line below to use Linux kernel performance events for the perftest command
+# NOTE: If you uncomment or recomment the line, remember to recompile EVERYTHING
+#  QMAKE_CXXFLAGS += -DUSE_PERF_EVENT
+
+# Uncomment the line below to show the heap allocations per command in perftest
+# NOTE: If you uncomment or recomment the line, remember to recompile EVERYTHING
+#  QMAKE_CXXFLAGS += -DCOUNT_ALLOCATIONS
+
+CONFIG += c++17 warn_on console thread
+CONFIG -= qt app_bundle
+
+TARGET = prg2-headless
+TEMPLATE = app
+
+SOURCES += \
+    batchmain.cc \
+    datastructures.cc \
+    mainprogram.cc \
+    workloadtrace.cc \
+    mappedfile.cc \
+    threadpool.cc \
+    concurrentdatastructures.cc \
+    snapshotdatastructures.cc \
+    distancekernel.cc \
+    realmfile.cc \
+    mappedrealm.cc \
+    mutationlog.cc \
+    allocationcounter.cc \
+    namearena.cc \
+    sizeclasspool.cc
+
+HEADERS += \
+    datastructures.hh \
+    mainprogram.hh \
+    workloadtrace.hh \
+    mappedfile.hh \
+    outputbuffer.hh \
+    threadpool.hh \
+    concurrentdatastructures.hh \
+    snapshotdatastructures.hh \
+    sorting.hh \
+    distancekernel.hh \
+    realmfile.hh \
+    mappedrealm.hh \
+    mutationlog.hh \
+    townid.hh \
+    allocationcounter.hh \
+    namearena.hh \
+    smallvector.hh \
+    sizeclasspool.hh \
+    flattownmap.hh
@@ -17,6 +17,10 @@
 # "Rebuild all" from the Build menu
 #  QMAKE_CXXFLAGS += -DUSE_PERF_EVENT
 
+# Uncomment the line below to show the heap allocations per command in perftest
+# NOTE: If you uncomment or recomment the line, remember to recompile EVERYTHING
+#  QMAKE_CXXFLAGS += -DCOUNT_ALLOCATIONS
+
 QT       += core gui
 
 CONFIG += c++17 warn_on
@@ -41,12 +45,41 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += \
     datastructures.cc \
     mainwindow.cc \
-    mainprogram.cc
+    mainprogram.cc \
+    workloadtrace.cc \
+    mappedfile.cc \
+    threadpool.cc \
+    concurrentdatastructures.cc \
+    snapshotdatastructures.cc \
+    distancekernel.cc \
+    realmfile.cc \
+    mappedrealm.cc \
+    mutationlog.cc \
+    allocationcounter.cc \
+    namearena.cc \
+    sizeclasspool.cc
 
 HEADERS += \
     datastructures.hh \
     mainwindow.hh \
-    mainprogram.hh
+    mainprogram.hh \
+    workloadtrace.hh \
+    mappedfile.hh \
+    outputbuffer.hh \
+    threadpool.hh \
+    concurrentdatastructures.hh \
+    snapshotdatastructures.hh \
+    sorting.hh \
+    distancekernel.hh \
+    realmfile.hh \
+    mappedrealm.hh \
+    mutationlog.hh \
+    townid.hh \
+    allocationcounter.hh \
+    namearena.hh \
+    smallvector.hh \
+    sizeclasspool.hh \
+    flattownmap.hh
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,448 @@
+// Realmfile.cc
+//
+// Versioned binary snapshot of the whole realm: towns, names, vassal links and roads.
+
+#include "realmfile.hh"
+#include "mappedfile.hh"
+#include "mappedrealm.hh"
+#include "distancekernel.hh"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define REALMFILE_USE_FSYNC
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+// Size of the hash index for count towns: a power of two with at least half of the slots
+// empty, so that probes stay short and every probe sequence ends at an empty slot
+std::uint64_t index_size_for(std::uint64_t count)
+{
+    std::uint64_t size = 1;
+    while (size < 2 * count + 1)
+        size *= 2;
+    return size;
+}
+
+template <typename Type>
+bool check_section(RealmHeader const& header, RealmSectionId id, std::uint64_t count, std::string& error)
+{
+    static char const* const names[REALM_SECTION_COUNT] = { "towns", "town x coordinates", "town y coordinates", "id index",
+                                                            "vassal offsets", "vassals", "road offsets", "road towns",
+                                                            "roads", "strings" };
+    const auto& section = header.sections[id];
+    if (section.offset % 8 != 0 || section.offset < sizeof(RealmHeader) || section.offset > header.file_size ||
+        section.size > header.file_size - section.offset || section.size != count * sizeof(Type))
+    {
+        error = std::string("Invalid ") + names[id] + " section";
+        return false;
+    }
+    return true;
+}
+
+// Offsets must start from 0, never decrease and end at the number of entries
+bool check_offsets(std::uint64_t const* offsets, std::uint64_t town_count, std::uint64_t entries)
+{
+    if (offsets[0] != 0 || offsets[town_count] != entries)
+        return false;
+    for (std::uint64_t i = 0; i < town_count; ++i)
+        if (offsets[i] > offsets[i + 1])
+            return false;
+    return true;
+}
+
+bool check_indices(std::uint32_t const* indices, std::uint64_t count, std::uint64_t town_count, bool allow_none)
+{
+    for (std::uint64_t i = 0; i < count; ++i)
+        if (indices[i] >= town_count && !(allow_none && indices[i] == REALM_NO_INDEX))
+            return false;
+    return true;
+}
+
+// Writes the file with write to a temporary file first and then renames it,
+// so that a failed save doesn't destroy an earlier snapshot. With durable the temporary
+// file is synced before the rename and the directory after it, otherwise a crash of the
+// machine could leave the new name pointing to an incomplete file.
+template <typename WriteFunc>
+bool write_file(std::string const& filename, std::string& error, bool durable, WriteFunc write)
+{
+    const auto tempname = filename + ".tmp";
+    {
+        std::ofstream file(tempname, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            error = "Cannot open file '" + tempname + "' for writing";
+            return false;
+        }
+
+        write(file);
+        if (!file.flush())
+        {
+            error = "Cannot write file '" + tempname + "'";
+            return false;
+        }
+    }
+
+    if (durable && !sync_file(tempname))
+    {
+        error = "Cannot sync file '" + tempname + "'";
+        return false;
+    }
+
+    std::error_code rename_error;
+    std::filesystem::rename(tempname, filename, rename_error);
+    if (rename_error)
+    {
+        error = "Cannot rename '" + tempname + "' to '" + filename + "'";
+        return false;
+    }
+
+    auto directory = std::filesystem::path(filename).parent_path().string();
+    if (directory.empty())
+        directory = ".";
+    if (durable && !sync_directory(directory))
+    {
+        error = "Cannot sync directory '" + directory + "'";
+        return false;
+    }
+    return true;
+}
+
+template <typename Type>
+void write_section(std::ofstream& file, RealmSection const& section, std::vector<Type> const& data)
+{
+    file.seekp(static_cast<std::streamoff>(section.offset));
+    file.write(reinterpret_cast<char const*>(data.data()), static_cast<std::streamsize>(section.size));
+}
+
+}
+
+bool sync_file(std::FILE* file)
+{
+    if (std::fflush(file) != 0)
+        return false;
+#ifdef REALMFILE_USE_FSYNC
+    return ::fsync(::fileno(file)) == 0;
+#else
+    return true;
+#endif
+}
+
+bool sync_file(std::string const& filename)
+{
+#ifdef REALMFILE_USE_FSYNC
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+#else
+    (void)filename;
+    return true;
+#endif
+}
+
+bool sync_directory(std::string const& directory)
+{
+#ifdef REALMFILE_USE_FSYNC
+    const int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+#else
+    (void)directory;
+    return true;
+#endif
+}
+
+std::uint64_t realm_id_hash(std::string_view id)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (const auto c : id)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+RealmHeader const* validate_realm(std::string_view contents, std::string& error, bool check_contents)
+{
+    if (contents.size() < sizeof(RealmHeader))
+    {
+        error = "Too short for a realm file";
+        return nullptr;
+    }
+
+    const auto header = reinterpret_cast<RealmHeader const*>(contents.data());
+    if (std::memcmp(header->magic, REALM_FILE_MAGIC, sizeof(REALM_FILE_MAGIC)) != 0)
+    {
+        error = "Not a realm file";
+        return nullptr;
+    }
+    if (header->byte_order != REALM_BYTE_ORDER)
+    {
+        error = "Realm file written on a machine with a different byte order";
+        return nullptr;
+    }
+    if (header->version != REALM_FILE_VERSION)
+    {
+        error = "Unsupported realm file version " + std::to_string(header->version);
+        return nullptr;
+    }
+    if (header->file_size != contents.size())
+    {
+        error = "Realm file is truncated";
+        return nullptr;
+    }
+
+    //town indices are 32-bit
+    const auto town_count = header->town_count;
+    if (town_count >= REALM_NO_INDEX || header->index_size != index_size_for(town_count) ||
+        header->road_count > header->file_size / sizeof(RealmRoad))
+    {
+        error = "Invalid town or road count";
+        return nullptr;
+    }
+
+    //the sizes of the variable length sections are checked against the offsets below
+    const auto& sections = header->sections;
+    if (!check_section<RealmTown>(*header, REALM_TOWNS, town_count, error) ||
+        !check_section<std::int32_t>(*header, REALM_TOWN_XS, town_count, error) ||
+        !check_section<std::int32_t>(*header, REALM_TOWN_YS, town_count, error) ||
+        !check_section<std::uint32_t>(*header, REALM_ID_INDEX, header->index_size, error) ||
+        !check_section<std::uint64_t>(*header, REALM_VASSAL_OFFSETS, town_count + 1, error) ||
+        !check_section<std::uint32_t>(*header, REALM_VASSALS, sections[REALM_VASSALS].size / sizeof(std::uint32_t), error) ||
+        !check_section<std::uint64_t>(*header, REALM_ROAD_OFFSETS, town_count + 1, error) ||
+        !check_section<std::uint32_t>(*header, REALM_ROAD_TOWNS, sections[REALM_ROAD_TOWNS].size / sizeof(std::uint32_t), error) ||
+        !check_section<RealmRoad>(*header, REALM_ROADS, header->road_count, error) ||
+        !check_section<char>(*header, REALM_STRINGS, sections[REALM_STRINGS].size, error))
+    {
+        return nullptr;
+    }
+    if (!check_contents)
+        return header;
+
+    const auto string_size = sections[REALM_STRINGS].size;
+    const auto towns = realm_section<RealmTown>(header, REALM_TOWNS);
+    for (std::uint64_t i = 0; i < town_count; ++i)
+    {
+        const auto& town = towns[i];
+        if (town.id_offset > string_size || town.id_length > string_size - town.id_offset ||
+            town.name_offset > string_size || town.name_length > string_size - town.name_offset ||
+            (town.master >= town_count && town.master != REALM_NO_INDEX))
+        {
+            error = "Invalid town " + std::to_string(i);
+            return nullptr;
+        }
+    }
+
+    const auto vassal_count = sections[REALM_VASSALS].size / sizeof(std::uint32_t);
+    const auto road_town_count = sections[REALM_ROAD_TOWNS].size / sizeof(std::uint32_t);
+    if (!check_offsets(realm_section<std::uint64_t>(header, REALM_VASSAL_OFFSETS), town_count, vassal_count) ||
+        !check_indices(realm_section<std::uint32_t>(header, REALM_VASSALS), vassal_count, town_count, false) ||
+        !check_offsets(realm_section<std::uint64_t>(header, REALM_ROAD_OFFSETS), town_count, road_town_count) ||
+        !check_indices(realm_section<std::uint32_t>(header, REALM_ROAD_TOWNS), road_town_count, town_count, false) ||
+        !check_indices(realm_section<std::uint32_t>(header, REALM_ROADS), 2 * header->road_count, town_count, false) ||
+        !check_indices(realm_section<std::uint32_t>(header, REALM_ID_INDEX), header->index_size, town_count, true))
+    {
+        error = "Invalid vassal, road or index data";
+        return nullptr;
+    }
+
+    return header;
+}
+
+bool RealmFile::save(const Datastructures& ds, const std::string& filename, std::string& error, bool durable)
+{
+    //a mapped file already is a snapshot of the database
+    if (ds.mapped_)
+    {
+        const auto contents = ds.mapped_->contents();
+        return write_file(filename, error, durable, [&contents](std::ofstream& file)
+        {
+            file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        });
+    }
+
+    const auto& towns_by_index = ds.towns_by_index_;
+    const auto town_count = towns_by_index.size();
+
+    std::vector<RealmTown> towns(town_count);
+    std::vector<std::uint64_t> vassal_offsets{ 0 };
+    std::vector<std::uint32_t> vassals{};
+    std::vector<std::uint64_t> road_offsets{ 0 };
+    std::vector<std::uint32_t> road_towns{};
+    std::vector<char> strings{};
+    vassal_offsets.reserve(town_count + 1);
+    road_offsets.reserve(town_count + 1);
+    road_towns.reserve(2 * ds.roads_.size());
+
+    for (std::size_t i = 0; i < town_count; ++i)
+    {
+        const auto town = towns_by_index[i];
+        auto& record = towns[i];
+        record.id_offset = strings.size();
+        record.id_length = static_cast<std::uint32_t>(town->id.size());
+        strings.insert(strings.end(), town->id.begin(), town->id.end());
+        const auto name = ds.names_.view(town->name);
+        record.name_offset = strings.size();
+        record.name_length = static_cast<std::uint32_t>(name.size());
+        strings.insert(strings.end(), name.begin(), name.end());
+        record.tax = town->tax;
+        record.master = town->master ? static_cast<std::uint32_t>(town->master->index) : REALM_NO_INDEX;
+
+        for (const auto& vassal : town->vassals)
+            vassals.push_back(static_cast<std::uint32_t>(vassal->index));
+        vassal_offsets.push_back(vassals.size());
+
+        for (const auto& road : town->roads_to)
+            road_towns.push_back(static_cast<std::uint32_t>(road.town->index));
+        road_offsets.push_back(road_towns.size());
+    }
+
+    //linear probing from the id's hash to the first empty slot
+    std::vector<std::uint32_t> index(index_size_for(town_count), REALM_NO_INDEX);
+    const auto mask = index.size() - 1;
+    for (std::size_t i = 0; i < town_count; ++i)
+    {
+        auto slot = realm_id_hash(towns_by_index[i]->id) & mask;
+        while (index[slot] != REALM_NO_INDEX)
+            slot = (slot + 1) & mask;
+        index[slot] = static_cast<std::uint32_t>(i);
+    }
+
+    std::vector<RealmRoad> roads{};
+    roads.reserve(ds.roads_.size());
+    for (const auto& [town1, town2] : ds.roads_)
+        roads.push_back({ static_cast<std::uint32_t>(ds.database_.at(town1).index),
+                          static_cast<std::uint32_t>(ds.database_.at(town2).index) });
+
+    //lay the sections out one after another, each at a multiple of 8 bytes
+    RealmHeader header{};
+    std::memcpy(header.magic, REALM_FILE_MAGIC, sizeof(REALM_FILE_MAGIC));
+    header.version = REALM_FILE_VERSION;
+    header.byte_order = REALM_BYTE_ORDER;
+    header.town_count = town_count;
+    header.road_count = roads.size();
+    header.index_size = index.size();
+
+    const std::uint64_t sizes[REALM_SECTION_COUNT] = {
+        towns.size() * sizeof(RealmTown), ds.town_xs_.size() * sizeof(std::int32_t), ds.town_ys_.size() * sizeof(std::int32_t),
+        index.size() * sizeof(std::uint32_t), vassal_offsets.size() * sizeof(std::uint64_t), vassals.size() * sizeof(std::uint32_t),
+        road_offsets.size() * sizeof(std::uint64_t), road_towns.size() * sizeof(std::uint32_t), roads.size() * sizeof(RealmRoad),
+        strings.size() };
+    std::uint64_t offset = sizeof(RealmHeader);
+    for (int i = 0; i < REALM_SECTION_COUNT; ++i)
+    {
+        offset = (offset + 7) / 8 * 8;
+        header.sections[i] = { offset, sizes[i] };
+        offset += sizes[i];
+    }
+    header.file_size = offset;
+
+    return write_file(filename, error, durable, [&](std::ofstream& file)
+    {
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        write_section(file, header.sections[REALM_TOWNS], towns);
+        write_section(file, header.sections[REALM_TOWN_XS], ds.town_xs_);
+        write_section(file, header.sections[REALM_TOWN_YS], ds.town_ys_);
+        write_section(file, header.sections[REALM_ID_INDEX], index);
+        write_section(file, header.sections[REALM_VASSAL_OFFSETS], vassal_offsets);
+        write_section(file, header.sections[REALM_VASSALS], vassals);
+        write_section(file, header.sections[REALM_ROAD_OFFSETS], road_offsets);
+        write_section(file, header.sections[REALM_ROAD_TOWNS], road_towns);
+        write_section(file, header.sections[REALM_ROADS], roads);
+        write_section(file, header.sections[REALM_STRINGS], strings);
+    });
+}
+
+bool RealmFile::load(Datastructures& ds, const std::string& filename, std::string& error)
+{
+    MappedFile file(filename);
+    if (!file.ok())
+    {
+        error = "Cannot open file '" + filename + "'";
+        return false;
+    }
+
+    const auto header = validate_realm(file.contents(), error);
+    if (!header)
+        return false;
+
+    const auto town_count = header->town_count;
+    const auto towns = realm_section<RealmTown>(header, REALM_TOWNS);
+    const auto xs = realm_section<std::int32_t>(header, REALM_TOWN_XS);
+    const auto ys = realm_section<std::int32_t>(header, REALM_TOWN_YS);
+    const auto vassal_offsets = realm_section<std::uint64_t>(header, REALM_VASSAL_OFFSETS);
+    const auto vassals = realm_section<std::uint32_t>(header, REALM_VASSALS);
+    const auto road_offsets = realm_section<std::uint64_t>(header, REALM_ROAD_OFFSETS);
+    const auto road_towns = realm_section<std::uint32_t>(header, REALM_ROAD_TOWNS);
+    const auto roads = realm_section<RealmRoad>(header, REALM_ROADS);
+    const auto strings = realm_section<char>(header, REALM_STRINGS);
+
+    ds.clear_all();
+    ds.database_.reserve(town_count);
+    ds.towns_by_index_.reserve(town_count);
+    ds.town_xs_.reserve(town_count);
+    ds.town_ys_.reserve(town_count);
+
+    //the towns get the same indices they had when they were saved
+    for (std::uint64_t i = 0; i < town_count; ++i)
+    {
+        const auto& record = towns[i];
+        const auto [town, inserted] = ds.database_.try_emplace(TownID(strings + record.id_offset, record.id_length));
+        if (!inserted)
+        {
+            ds.clear_all();
+            error = "Duplicate town id '" + town->first.str() + "'";
+            return false;
+        }
+        town->second.id = town->first;
+        town->second.name = ds.names_.add({ strings + record.name_offset, record.name_length });
+        town->second.coord = { xs[i], ys[i] };
+        town->second.tax = record.tax;
+        ds.index_town(&town->second);
+    }
+
+    std::vector<Distance> distances(town_count);
+    coord_distances({ 0, 0 }, ds.town_xs_.data(), ds.town_ys_.data(), town_count, distances.data());
+
+    const auto& towns_by_index = ds.towns_by_index_;
+    for (std::uint64_t i = 0; i < town_count; ++i)
+    {
+        const auto town = towns_by_index[i];
+        town->distance_from_origin = distances[i];
+        if (towns[i].master != REALM_NO_INDEX)
+            town->master = towns_by_index[towns[i].master];
+
+        town->vassals.reserve(vassal_offsets[i + 1] - vassal_offsets[i]);
+        for (auto v = vassal_offsets[i]; v < vassal_offsets[i + 1]; ++v)
+            town->vassals.push_back(towns_by_index[vassals[v]]);
+
+        town->roads_to.reserve(road_offsets[i + 1] - road_offsets[i]);
+        for (auto r = road_offsets[i]; r < road_offsets[i + 1]; ++r)
+        {
+            const auto connected_town = towns_by_index[road_towns[r]];
+            Datastructures::insert_road(town, { connected_town, coord_distance(town->coord, connected_town->coord) });
+        }
+    }
+
+    ds.roads_.reserve(header->road_count);
+    for (std::uint64_t i = 0; i < header->road_count; ++i)
+        ds.roads_.emplace_back(towns_by_index[roads[i].town1]->id, towns_by_index[roads[i].town2]->id);
+
+    //the loaded towns didn't go through the mutation log, so a checkpoint records them
+    if (ds.log_)
+        return ds.log_->checkpoint(ds, error);
+    return true;
+}
@@ -0,0 +1,127 @@
+// Realmfile.hh
+//
+// Versioned binary snapshot of the whole realm: towns, names, vassal links and roads.
+// Saving and loading skip the command parser and the single element operations,
+// so a load runs at close to the speed of reading the file.
+
+#ifndef REALMFILE_HH
+#define REALMFILE_HH
+
+#include "datastructures.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+// File layout. All integers are in the byte order of the machine that wrote the file,
+// which is checked when reading. Every section starts at a multiple of 8 bytes from the
+// start of the file, so that a memory mapped file can be used in place.
+//
+//   RealmHeader
+//   TOWNS           town_count x RealmTown, in the order of the towns' indices
+//   TOWN_XS/YS      town_count x int32, the coordinates as columns
+//   ID_INDEX        index_size x uint32, open addressing hash table (linear probing)
+//                   from realm_id_hash(id) to town index, REALM_NO_INDEX in empty slots
+//   VASSAL_OFFSETS  (town_count + 1) x uint64, the vassals of town i are
+//   VASSALS         VASSALS[VASSAL_OFFSETS[i] .. VASSAL_OFFSETS[i+1]), as uint32 town indices
+//   ROAD_OFFSETS    (town_count + 1) x uint64, and the same for the towns each town has a road to
+//   ROAD_TOWNS      uint32 town indices
+//   ROADS           road_count x RealmRoad, the list of roads in all_roads() order
+//   STRINGS         the ids and names, referred to by offset and length
+
+constexpr char REALM_FILE_MAGIC[8] = "PRG2RLM";
+constexpr std::uint32_t REALM_FILE_VERSION = 1;
+constexpr std::uint32_t REALM_BYTE_ORDER = 0x01020304;
+constexpr std::uint32_t REALM_NO_INDEX = 0xffffffff;
+
+enum RealmSectionId
+{
+    REALM_TOWNS, REALM_TOWN_XS, REALM_TOWN_YS, REALM_ID_INDEX, REALM_VASSAL_OFFSETS, REALM_VASSALS,
+    REALM_ROAD_OFFSETS, REALM_ROAD_TOWNS, REALM_ROADS, REALM_STRINGS, REALM_SECTION_COUNT
+};
+
+struct RealmSection
+{
+    std::uint64_t offset;
+    std::uint64_t size; // in bytes
+};
+
+struct RealmHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t town_count;
+    std::uint64_t road_count;
+    std::uint64_t index_size; // a power of two
+    std::uint64_t file_size;
+    RealmSection sections[REALM_SECTION_COUNT];
+};
+
+struct RealmTown
+{
+    std::uint64_t id_offset;
+    std::uint64_t name_offset;
+    std::uint32_t id_length;
+    std::uint32_t name_length;
+    std::int32_t tax;
+    std::uint32_t master; // REALM_NO_INDEX if the town has no master
+};
+
+struct RealmRoad
+{
+    std::uint32_t town1;
+    std::uint32_t town2;
+};
+
+// FNV-1a, the same in every build unlike std::hash, so that the index in the file stays valid
+std::uint64_t realm_id_hash(std::string_view id);
+
+// Makes what has been written to the file survive a crash of the machine, not only of the process.
+// Returns false if the file couldn't be flushed or synced.
+bool sync_file(std::FILE* file);
+bool sync_file(std::string const& filename);
+
+// Makes created, renamed and deleted files in directory survive a crash
+bool sync_directory(std::string const& directory);
+
+// Start of a section of a validated file
+template <typename Type>
+Type const* realm_section(RealmHeader const* header, RealmSectionId id)
+{
+    return reinterpret_cast<Type const*>(reinterpret_cast<char const*>(header) + header->sections[id].offset);
+}
+
+// Checks that contents is a complete realm file of this version, with every section, index
+// and string inside the file, so that reading it can't go out of bounds. The contents
+// themselves (e.g. that the vassal links form no cycles) are trusted to be what save() wrote.
+// Without check_contents only the header and the section bounds are checked, which is
+// Theta(1) instead of linear, and the towns, offsets and indices are trusted too.
+// Returns the header, or nullptr and the reason in error.
+RealmHeader const* validate_realm(std::string_view contents, std::string& error, bool check_contents = true);
+
+// Saving and loading need the internals of Datastructures, so they are its friends
+class RealmFile
+{
+public:
+    // Estimate of performance: O(n+k) on average, where n is the number of towns and k the number of roads
+    // Short rationale for estimate:
+    // Every town, vassal link and road is written once, in a few large writes.
+    // With durable, the file and the rename are synced to the disk before returning, so that
+    // the saved file survives a crash of the machine (the mutation log's checkpoints need this).
+    // Returns false and the reason in error if the file couldn't be written.
+    static bool save(Datastructures const& ds, std::string const& filename, std::string& error, bool durable = false);
+
+    // Estimate of performance: O(n+k) on average, O(n^2+k*n) in the worst case
+    // Short rationale for estimate:
+    // Reading the file is linear, and each town and road is inserted to the unordered
+    // containers once, like in the batch operations.
+    // Replaces the contents of ds. Returns false and the reason in error if the file
+    // couldn't be read or isn't valid, in which case ds is left unchanged. Duplicate ids are
+    // only noticed while loading, and leave ds empty. If ds has a mutation log open,
+    // the loaded database is written to it as a checkpoint.
+    static bool load(Datastructures& ds, std::string const& filename, std::string& error);
+};
+
+#endif // REALMFILE_HH
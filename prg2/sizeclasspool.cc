@@ -0,0 +1,44 @@
+// Sizeclasspool.cc
+
+#include "sizeclasspool.hh"
+
+#include <new>
+
+SizeClassPool::~SizeClassPool()
+{
+    for (const auto chunk : chunks_)
+        ::operator delete(chunk);
+}
+
+void* SizeClassPool::allocate(std::size_t size)
+{
+    const auto size_class = (size + SIZE_CLASS - 1) / SIZE_CLASS;
+    auto& free_list = free_lists_[size_class - 1];
+    if (free_list)
+    {
+        const auto block = free_list;
+        free_list = block->next;
+        return block;
+    }
+
+    const auto block_size = size_class * SIZE_CLASS;
+    if (static_cast<std::size_t>(chunk_end_ - chunk_position_) < block_size)
+    {
+        //the rest of the old chunk is left unused, it's less than MAX_SIZE bytes
+        chunks_.reserve(chunks_.size() + 1);
+        chunk_position_ = static_cast<char*>(::operator new(CHUNK_SIZE));
+        chunks_.push_back(chunk_position_);
+        chunk_end_ = chunk_position_ + CHUNK_SIZE;
+    }
+
+    const auto block = chunk_position_;
+    chunk_position_ += block_size;
+    return block;
+}
+
+void SizeClassPool::deallocate(void* block, std::size_t size) noexcept
+{
+    const auto size_class = (size + SIZE_CLASS - 1) / SIZE_CLASS;
+    auto& free_list = free_lists_[size_class - 1];
+    free_list = new (block) FreeBlock{ free_list };
+}
@@ -0,0 +1,110 @@
+// Sizeclasspool.hh
+//
+// Memory pool for many small objects of a few sizes, like the nodes of the town database.
+// Blocks are carved from large chunks and freed blocks are kept in a free list per size,
+// so that adding and removing towns doesn't call malloc for every node.
+
+#ifndef SIZECLASSPOOL_HH
+#define SIZECLASSPOOL_HH
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Not thread safe, the containers using it are only changed by one thread at a time
+class SizeClassPool
+{
+public:
+    // sizes are rounded up to a multiple of this, which is also the alignment of the blocks
+    static constexpr std::size_t SIZE_CLASS = 16;
+    // larger blocks than this aren't pooled
+    static constexpr std::size_t MAX_SIZE = 512;
+    static constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+
+    SizeClassPool() = default;
+    ~SizeClassPool();
+
+    SizeClassPool(SizeClassPool const&) = delete;
+    SizeClassPool& operator=(SizeClassPool const&) = delete;
+
+    [[nodiscard]] static constexpr bool is_pooled(std::size_t size, std::size_t alignment)
+    {
+        return size <= MAX_SIZE && alignment <= SIZE_CLASS;
+    }
+
+    // Estimate of performance: Theta(1) amortized
+    // Short rationale for estimate:
+    // A block is taken from the free list of its size, or cut from the current chunk.
+    // A new chunk is allocated once every CHUNK_SIZE bytes.
+    void* allocate(std::size_t size);
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The block is pushed to the free list of its size, chunks are only freed with the pool
+    void deallocate(void* block, std::size_t size) noexcept;
+
+    // Bytes allocated for the chunks
+    [[nodiscard]] std::size_t chunk_bytes() const { return chunks_.size() * CHUNK_SIZE; }
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    std::array<FreeBlock*, MAX_SIZE / SIZE_CLASS> free_lists_{};
+    std::vector<void*> chunks_{};
+    char* chunk_position_ = nullptr;
+    char* chunk_end_ = nullptr;
+};
+
+// Standard allocator that takes single objects from a SizeClassPool,
+// arrays (like the bucket arrays of hash tables) come from the heap as usual
+template <typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit PoolAllocator(SizeClassPool* pool) noexcept : pool_(pool) {}
+    template <typename U>
+    PoolAllocator(PoolAllocator<U> const& other) noexcept : pool_(other.pool()) {}
+
+    T* allocate(std::size_t count)
+    {
+        if (count == 1 && SizeClassPool::is_pooled(sizeof(T), alignof(T)))
+            return static_cast<T*>(pool_->allocate(sizeof(T)));
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T* values, std::size_t count) noexcept
+    {
+        if (count == 1 && SizeClassPool::is_pooled(sizeof(T), alignof(T)))
+            pool_->deallocate(values, sizeof(T));
+        else
+            std::allocator<T>().deallocate(values, count);
+    }
+
+    [[nodiscard]] SizeClassPool* pool() const noexcept { return pool_; }
+
+private:
+    SizeClassPool* pool_;
+};
+
+template <typename T, typename U>
+bool operator==(PoolAllocator<T> const& first, PoolAllocator<U> const& second) noexcept
+{
+    return first.pool() == second.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(PoolAllocator<T> const& first, PoolAllocator<U> const& second) noexcept
+{
+    return !(first == second);
+}
+
+#endif // SIZECLASSPOOL_HH
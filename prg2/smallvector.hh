@@ -0,0 +1,161 @@
+// Smallvector.hh
+//
+// Vector that keeps its first few elements inside the object itself, so that the
+// small lists most towns have (vassals, roads) don't need a heap allocation at all
+
+#ifndef SMALLVECTOR_HH
+#define SMALLVECTOR_HH
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+
+// Only for trivially copyable elements (pointers and small structs), which are moved
+// around with memcpy. Up to N elements are stored inline, more on the heap.
+template <typename T, std::size_t N>
+class SmallVector
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SmallVector only holds trivially copyable elements");
+    static_assert(N > 0, "SmallVector needs inline capacity");
+
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = T const*;
+
+    SmallVector() noexcept = default;
+    SmallVector(std::initializer_list<T> values) { assign(values.begin(), values.size()); }
+    SmallVector(SmallVector const& other) { assign(other.data(), other.size()); }
+
+    // the moved from vector is left empty
+    SmallVector(SmallVector&& other) noexcept : size_(other.size_), capacity_(other.capacity_), storage_(other.storage_)
+    {
+        other.size_ = 0;
+        other.capacity_ = N;
+    }
+
+    SmallVector& operator=(SmallVector const& other)
+    {
+        if (this != &other)
+        {
+            clear();
+            assign(other.data(), other.size());
+        }
+        return *this;
+    }
+
+    SmallVector& operator=(SmallVector&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            storage_ = other.storage_;
+            other.size_ = 0;
+            other.capacity_ = N;
+        }
+        return *this;
+    }
+
+    ~SmallVector() { release(); }
+
+    [[nodiscard]] T* data() noexcept { return is_inline() ? storage_.inline_values : storage_.heap_values; }
+    [[nodiscard]] T const* data() const noexcept { return is_inline() ? storage_.inline_values : storage_.heap_values; }
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] std::size_t capacity() const noexcept { return capacity_; }
+    [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+    iterator begin() noexcept { return data(); }
+    iterator end() noexcept { return data() + size_; }
+    const_iterator begin() const noexcept { return data(); }
+    const_iterator end() const noexcept { return data() + size_; }
+
+    T& operator[](std::size_t i) noexcept { assert(i < size_); return data()[i]; }
+    T const& operator[](std::size_t i) const noexcept { assert(i < size_); return data()[i]; }
+    T& back() noexcept { assert(size_ > 0); return data()[size_ - 1]; }
+    T const& back() const noexcept { assert(size_ > 0); return data()[size_ - 1]; }
+
+    // Estimate of performance: Theta(1) amortized
+    // Short rationale for estimate:
+    // The capacity doubles when the vector is full, like in std::vector
+    void push_back(T const& value)
+    {
+        if (size_ == capacity_)
+        {
+            //the value may be an element of this vector, so it's copied before growing
+            const T copy = value;
+            grow(2 * static_cast<std::size_t>(capacity_));
+            data()[size_++] = copy;
+            return;
+        }
+        data()[size_++] = value;
+    }
+
+    void pop_back() noexcept { assert(size_ > 0); --size_; }
+
+    // Estimate of performance: O(s), where s is the size of the vector
+    // Short rationale for estimate:
+    // The elements after the erased one are moved one step towards the beginning
+    iterator erase(const_iterator position) noexcept
+    {
+        assert(position >= begin() && position < end());
+        const auto index = static_cast<std::size_t>(position - begin());
+        T* values = data();
+        std::memmove(values + index, values + index + 1, (size_ - index - 1) * sizeof(T));
+        --size_;
+        return values + index;
+    }
+
+    void reserve(std::size_t capacity)
+    {
+        if (capacity > capacity_)
+            grow(capacity);
+    }
+
+    // Keeps the capacity like std::vector
+    void clear() noexcept { size_ = 0; }
+
+private:
+    std::uint32_t size_ = 0;
+    std::uint32_t capacity_ = N;
+    union Storage
+    {
+        // the inline elements are created by writing them, like in std::vector's spare capacity
+        Storage() noexcept : heap_values(nullptr) {}
+        T inline_values[N];
+        T* heap_values;
+    } storage_{};
+
+    [[nodiscard]] bool is_inline() const noexcept { return capacity_ == N; }
+
+    void grow(std::size_t capacity)
+    {
+        T* values = new T[capacity];
+        if (size_ > 0)
+            std::memcpy(values, data(), size_ * sizeof(T));
+        release();
+        storage_.heap_values = values;
+        capacity_ = static_cast<std::uint32_t>(capacity);
+    }
+
+    void release() noexcept
+    {
+        if (!is_inline())
+            delete[] storage_.heap_values;
+    }
+
+    // for an empty vector
+    void assign(T const* values, std::size_t count)
+    {
+        reserve(count);
+        if (count > 0)
+            std::memcpy(data(), values, count * sizeof(T));
+        size_ = static_cast<std::uint32_t>(count);
+    }
+};
+
+#endif // SMALLVECTOR_HH
@@ -0,0 +1,476 @@
+// Snapshotdatastructures.cc
+
+#include "snapshotdatastructures.hh"
+#include "distancekernel.hh"
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+
+namespace
+{
+
+// Search state of a town, kept in an unordered map by the town's entry in its chunk
+using TownEntry = TownSnapshot::Chunk::value_type;
+
+struct SnapshotSearchState
+{
+    TownEntry const* prev_town = nullptr;
+    Distance distance = MAX_VALUE;
+    Distance distance_estimate = MAX_VALUE;
+};
+
+using SnapshotSearchStates = std::unordered_map<TownEntry const*, SnapshotSearchState>;
+
+std::vector<TownID> construct_snapshot_path(TownEntry const* last_town, SnapshotSearchStates const& states)
+{
+    std::vector route{ last_town->first };
+    for (auto step = states.at(last_town).prev_town; step; step = states.at(step).prev_town)
+    {
+        route.push_back(step->first);
+    }
+    //flip the route from end->start to start->end
+    std::reverse(route.begin(), route.end());
+    return route;
+}
+
+}
+
+unsigned int TownSnapshot::chunk_bits_for(std::size_t town_count)
+{
+    auto bits = MIN_CHUNK_BITS;
+    while ((std::size_t{1} << bits) * CHUNK_SIZE < town_count)
+        ++bits;
+    return bits;
+}
+
+TownSnapshot::Chunk::value_type const* TownSnapshot::find_entry(TownID const& id) const
+{
+    auto const& towns = chunk(chunk_of(id));
+    const auto town = towns.find(id);
+    return town == towns.end() ? nullptr : &*town;
+}
+
+TownSnapshot::TownRecord const* TownSnapshot::find(TownID const& id) const
+{
+    const auto town = find_entry(id);
+    return town ? &town->second : nullptr;
+}
+
+Name TownSnapshot::get_town_name(TownID const& id) const
+{
+    const auto town = find(id);
+    return town ? town->name : NO_NAME;
+}
+
+Coord TownSnapshot::get_town_coordinates(TownID const& id) const
+{
+    const auto town = find(id);
+    return town ? town->coord : NO_COORD;
+}
+
+int TownSnapshot::get_town_tax(TownID const& id) const
+{
+    const auto town = find(id);
+    return town ? town->tax : NO_VALUE;
+}
+
+std::vector<TownID> TownSnapshot::get_town_vassals(TownID const& id) const
+{
+    const auto town = find(id);
+    return town ? town->vassals : std::vector<TownID>{ NO_TOWNID };
+}
+
+std::vector<TownID> TownSnapshot::get_roads_from(TownID const& id) const
+{
+    const auto town = find(id);
+    return town ? town->roads : std::vector<TownID>{ NO_TOWNID };
+}
+
+std::vector<TownID> TownSnapshot::taxer_path(TownID const& id) const
+{
+    auto town = find(id);
+    if (!town)
+        return { NO_TOWNID };
+
+    //the town itself is the first element, then deeper and deeper masters
+    std::vector taxers{ id };
+    while (town->master != NO_TOWNID)
+    {
+        taxers.push_back(town->master);
+        town = find(town->master);
+    }
+    return taxers;
+}
+
+std::vector<TownID> TownSnapshot::least_towns_route(TownID const& fromid, TownID const& toid) const
+{
+    //if the start and destination are the same, there is no route
+    if (fromid == toid)
+        return { };
+
+    //if either of the towns doesn't exist
+    const auto start = find_entry(fromid);
+    const auto destination = find_entry(toid);
+    if (!start || !destination)
+        return { NO_TOWNID };
+
+    //a town is processed once it has a state
+    SnapshotSearchStates states{};
+    states.emplace(start, SnapshotSearchState{});
+    std::deque<TownEntry const*> queue{ start };
+
+    while (!queue.empty())
+    {
+        const auto town = queue.front();
+        queue.pop_front();
+
+        for (auto const& road : town->second.roads)
+        {
+            const auto connected_town = find_entry(road);
+            const auto [state, inserted] = states.emplace(connected_town, SnapshotSearchState{});
+            if (!inserted)
+                continue;
+            state->second.prev_town = town;
+
+            //if the currently processed town is
+            //the destination town, we're done
+            if (connected_town == destination)
+                return construct_snapshot_path(destination, states);
+
+            queue.push_back(connected_town);
+        }
+    }
+
+    return { };
+}
+
+std::vector<TownID> TownSnapshot::shortest_route(TownID const& fromid, TownID const& toid) const
+{
+    //if the start and destination are the same, there is no route
+    if (fromid == toid)
+        return { };
+
+    //if either of the towns doesn't exist
+    const auto start = find_entry(fromid);
+    const auto destination = find_entry(toid);
+    if (!start || !destination)
+        return { NO_TOWNID };
+
+    //a town is processed once it has a state
+    SnapshotSearchStates states{};
+    states.emplace(start, SnapshotSearchState{}).first->second.distance = 0;
+
+    //the queue holds pointers to the states, which stay valid while the map grows,
+    //so the comparator doesn't need to look the towns up
+    using QueueItem = SnapshotSearchStates::value_type*;
+    auto comparator = [](QueueItem first, QueueItem second)
+    {
+        return first->second.distance_estimate > second->second.distance_estimate;
+    };
+    std::priority_queue<QueueItem, std::vector<QueueItem>, decltype(comparator)> queue(comparator);
+    queue.push(&*states.find(start));
+
+    while (!queue.empty())
+    {
+        const auto [town, town_state] = *queue.top();
+        queue.pop();
+
+        //if the currently processed town is
+        //the destination town, we're done
+        if (town == destination)
+            return construct_snapshot_path(destination, states);
+
+        for (auto const& road : town->second.roads)
+        {
+            const auto connected_town = find_entry(road);
+            const auto [state, inserted] = states.emplace(connected_town, SnapshotSearchState{});
+
+            //set the distance & distance estimate for
+            //the town connected by this road, like relax_a() does
+            const auto length = coord_distance(town->second.coord, connected_town->second.coord);
+            auto& next = state->second;
+            if (next.distance > town_state.distance + length)
+            {
+                next.distance = town_state.distance + length;
+                next.distance_estimate = next.distance + length;
+                next.prev_town = town;
+            }
+            if (inserted)
+                queue.push(&*state);
+        }
+    }
+
+    return { };
+}
+
+SnapshotDatastructures::SnapshotDatastructures()
+{
+    publish_all();
+}
+
+std::shared_ptr<TownSnapshot const> SnapshotDatastructures::snapshot() const
+{
+    return std::atomic_load(&current_);
+}
+
+unsigned int SnapshotDatastructures::town_count() const
+{
+    return snapshot()->town_count();
+}
+
+Name SnapshotDatastructures::get_town_name(TownID const& id) const
+{
+    return snapshot()->get_town_name(id);
+}
+
+Coord SnapshotDatastructures::get_town_coordinates(TownID const& id) const
+{
+    return snapshot()->get_town_coordinates(id);
+}
+
+int SnapshotDatastructures::get_town_tax(TownID const& id) const
+{
+    return snapshot()->get_town_tax(id);
+}
+
+std::vector<TownID> SnapshotDatastructures::get_town_vassals(TownID const& id) const
+{
+    return snapshot()->get_town_vassals(id);
+}
+
+std::vector<TownID> SnapshotDatastructures::get_roads_from(TownID const& id) const
+{
+    return snapshot()->get_roads_from(id);
+}
+
+std::vector<TownID> SnapshotDatastructures::taxer_path(TownID const& id) const
+{
+    return snapshot()->taxer_path(id);
+}
+
+std::vector<TownID> SnapshotDatastructures::least_towns_route(TownID const& fromid, TownID const& toid) const
+{
+    return snapshot()->least_towns_route(fromid, toid);
+}
+
+std::vector<TownID> SnapshotDatastructures::shortest_route(TownID const& fromid, TownID const& toid) const
+{
+    return snapshot()->shortest_route(fromid, toid);
+}
+
+void SnapshotDatastructures::clear_all()
+{
+    std::lock_guard lock(write_mutex_);
+    ds_.clear_all();
+    publish_all();
+}
+
+bool SnapshotDatastructures::add_town(TownID const& id, Name const& name, Coord coord, int tax)
+{
+    std::lock_guard lock(write_mutex_);
+    if (!ds_.add_town(id, name, coord, tax))
+        return false;
+    publish({ id });
+    return true;
+}
+
+bool SnapshotDatastructures::change_town_name(TownID const& id, Name const& newname)
+{
+    std::lock_guard lock(write_mutex_);
+    if (!ds_.change_town_name(id, newname))
+        return false;
+    publish({ id });
+    return true;
+}
+
+bool SnapshotDatastructures::add_vassalship(TownID const& vassalid, TownID const& masterid)
+{
+    std::lock_guard lock(write_mutex_);
+    if (!ds_.add_vassalship(vassalid, masterid))
+        return false;
+    publish({ vassalid, masterid });
+    return true;
+}
+
+bool SnapshotDatastructures::remove_town(TownID const& id)
+{
+    std::lock_guard lock(write_mutex_);
+
+    //the towns whose records mention the removed town change too,
+    //the current snapshot is up to date with ds_ while the write lock is held
+    const auto town = snapshot()->find(id);
+    if (!town)
+        return false;
+    std::vector changed{ id, town->master };
+    changed.insert(changed.end(), town->vassals.begin(), town->vassals.end());
+    changed.insert(changed.end(), town->roads.begin(), town->roads.end());
+
+    ds_.remove_town(id);
+    publish(changed);
+    return true;
+}
+
+void SnapshotDatastructures::clear_roads()
+{
+    std::lock_guard lock(write_mutex_);
+    ds_.clear_roads();
+    publish_all();
+}
+
+bool SnapshotDatastructures::add_road(TownID const& town1_id, TownID const& town2_id)
+{
+    std::lock_guard lock(write_mutex_);
+    if (!ds_.add_road(town1_id, town2_id))
+        return false;
+    publish({ town1_id, town2_id });
+    return true;
+}
+
+bool SnapshotDatastructures::remove_road(TownID const& town1_id, TownID const& town2_id)
+{
+    std::lock_guard lock(write_mutex_);
+    if (!ds_.remove_road(town1_id, town2_id))
+        return false;
+    publish({ town1_id, town2_id });
+    return true;
+}
+
+Distance SnapshotDatastructures::trim_road_network()
+{
+    std::lock_guard lock(write_mutex_);
+    const auto length = ds_.trim_road_network();
+    publish_all();
+    return length;
+}
+
+unsigned int SnapshotDatastructures::add_towns(std::vector<TownSpec> const& towns)
+{
+    std::lock_guard lock(write_mutex_);
+    const auto added = ds_.add_towns(towns);
+    std::vector<TownID> changed{};
+    changed.reserve(towns.size());
+    std::transform(towns.begin(), towns.end(), std::back_inserter(changed), [](const auto& town) { return town.id; });
+    publish(changed);
+    return added;
+}
+
+unsigned int SnapshotDatastructures::add_vassalships(std::vector<std::pair<TownID, TownID>> const& vassalships)
+{
+    std::lock_guard lock(write_mutex_);
+    const auto added = ds_.add_vassalships(vassalships);
+    std::vector<TownID> changed{};
+    changed.reserve(2 * vassalships.size());
+    for (auto const& [vassal, master] : vassalships)
+    {
+        changed.push_back(vassal);
+        changed.push_back(master);
+    }
+    publish(changed);
+    return added;
+}
+
+unsigned int SnapshotDatastructures::add_roads(std::vector<std::pair<TownID, TownID>> const& roads)
+{
+    std::lock_guard lock(write_mutex_);
+    const auto added = ds_.add_roads(roads);
+    std::vector<TownID> changed{};
+    changed.reserve(2 * roads.size());
+    for (auto const& [town1, town2] : roads)
+    {
+        changed.push_back(town1);
+        changed.push_back(town2);
+    }
+    publish(changed);
+    return added;
+}
+
+TownSnapshot::TownRecord SnapshotDatastructures::make_record(TownID const& id) const
+{
+    //the taxer path's second element is the town's master, if it has one
+    auto path = ds_.taxer_path(id);
+    return { ds_.get_town_name(id), ds_.get_town_coordinates(id), ds_.get_town_tax(id),
+             path.size() > 1 ? std::move(path[1]) : NO_TOWNID, ds_.get_town_vassals(id), ds_.get_roads_from(id) };
+}
+
+void SnapshotDatastructures::publish(std::vector<TownID> const& changed)
+{
+    //a change touching most of the towns is cheaper to do as a rebuild, and so is one after
+    //which the chunks are too few for the towns, or (with some slack, so that adding and removing
+    //the same towns doesn't rebuild every time) far too many
+    const auto previous = snapshot();
+    const auto chunk_bits = TownSnapshot::chunk_bits_for(ds_.town_count());
+    if (changed.size() > ds_.town_count() || chunk_bits > previous->chunk_bits_ || chunk_bits + 2 < previous->chunk_bits_)
+    {
+        publish_all();
+        return;
+    }
+
+    auto next = std::make_shared<TownSnapshot>(*previous);
+    ++next->version_;
+    next->town_count_ = ds_.town_count();
+
+    //every changed page and chunk is copied once, the others stay shared with the previous snapshot
+    const auto page_mask = (std::size_t{1} << previous->page_bits_) - 1;
+    std::unordered_map<std::size_t, std::shared_ptr<TownSnapshot::Page>> page_copies{};
+    std::unordered_map<std::size_t, std::shared_ptr<TownSnapshot::Chunk>> chunk_copies{};
+    for (auto const& id : changed)
+    {
+        if (id == NO_TOWNID)
+            continue;
+        const auto index = previous->chunk_of(id);
+        auto& chunk = chunk_copies[index];
+        if (!chunk)
+        {
+            chunk = std::make_shared<TownSnapshot::Chunk>(previous->chunk(index));
+            auto& page = page_copies[index >> previous->page_bits_];
+            if (!page)
+                page = std::make_shared<TownSnapshot::Page>(*previous->pages_[index >> previous->page_bits_]);
+            (*page)[index & page_mask] = chunk;
+        }
+
+        if (ds_.get_town_name(id) == NO_NAME)
+            chunk->erase(id);
+        else
+            (*chunk)[id] = make_record(id);
+    }
+    for (auto& [index, page] : page_copies)
+    {
+        next->pages_[index] = std::move(page);
+    }
+
+    std::atomic_store(&current_, std::shared_ptr<TownSnapshot const>(std::move(next)));
+}
+
+void SnapshotDatastructures::publish_all()
+{
+    const auto previous = std::atomic_load(&current_);
+    auto next = std::make_shared<TownSnapshot>();
+    next->version_ = previous ? previous->version_ + 1 : 0;
+    next->town_count_ = ds_.town_count();
+
+    //half of the chunk bits select the page, so there are about as many pages as chunks per page
+    next->chunk_bits_ = TownSnapshot::chunk_bits_for(next->town_count_);
+    next->page_bits_ = next->chunk_bits_ / 2;
+    const auto chunk_count = std::size_t{1} << next->chunk_bits_;
+    const auto page_size = std::size_t{1} << next->page_bits_;
+
+    std::vector<std::shared_ptr<TownSnapshot::Chunk>> chunks(chunk_count);
+    for (auto& chunk : chunks)
+    {
+        chunk = std::make_shared<TownSnapshot::Chunk>();
+    }
+    for (auto const& id : ds_.all_towns())
+    {
+        chunks[next->chunk_of(id)]->emplace(id, make_record(id));
+    }
+
+    next->pages_.reserve(chunk_count / page_size);
+    for (std::size_t first = 0; first < chunk_count; first += page_size)
+    {
+        next->pages_.push_back(std::make_shared<TownSnapshot::Page>(chunks.begin() + static_cast<std::ptrdiff_t>(first),
+                                                                   chunks.begin() + static_cast<std::ptrdiff_t>(first + page_size)));
+    }
+
+    std::atomic_store(&current_, std::shared_ptr<TownSnapshot const>(std::move(next)));
+}
@@ -0,0 +1,167 @@
+// Snapshotdatastructures.hh
+//
+// Versioned, immutable snapshots of the town and road data.
+// Readers pin the current snapshot and never wait for the writers,
+// writers edit a private Datastructures and then publish the next snapshot,
+// which shares every chunk and page of chunks that wasn't touched with the previous one.
+
+#ifndef SNAPSHOTDATASTRUCTURES_HH
+#define SNAPSHOTDATASTRUCTURES_HH
+
+#include "datastructures.hh"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class TownSnapshot
+{
+public:
+    // Everything a snapshot knows about a town. Vassals, master and roads
+    // are stored as ids, so that a change to one town doesn't touch its neighbours' records.
+    struct TownRecord
+    {
+        Name name;
+        Coord coord;
+        int tax = NO_VALUE;
+        TownID master = NO_TOWNID;
+        std::vector<TownID> vassals;
+        std::vector<TownID> roads;
+    };
+
+    // The towns are split into chunks of about CHUNK_SIZE towns by the hash of their id,
+    // and the chunks into pages, so that there are about as many pages as chunks per page.
+    // An edit copies only the pages and chunks of the towns it changed, the rest are shared
+    // with the previous snapshot. The number of chunks follows the number of towns, so the
+    // chunks stay small however large the database grows.
+    static constexpr std::size_t CHUNK_SIZE = 32;
+    using Chunk = std::unordered_map<TownID, TownRecord>;
+    using Page = std::vector<std::shared_ptr<Chunk const>>;
+
+    // Number of publishes before this snapshot, starting from 0 for the empty database
+    unsigned long int version() const { return version_; }
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // The count is updated when the snapshot is built
+    unsigned int town_count() const { return town_count_; }
+
+    // Estimate of performance: O(k), Omega(1), where k is the size of the town's chunk
+    // Short rationale for estimate:
+    // Finding the chunk is constant, finding the town in the chunk's unordered map
+    // is constant on average and linear in the worst case
+    TownRecord const* find(TownID const& id) const;
+
+    // Estimate of performance: same as find()
+    // Short rationale for estimate:
+    // Only one lookup is needed, copying the result is constant for these
+    Name get_town_name(TownID const& id) const;
+    Coord get_town_coordinates(TownID const& id) const;
+    int get_town_tax(TownID const& id) const;
+
+    // Estimate of performance: Theta(k) on average, where k is the number of ids returned
+    // Short rationale for estimate:
+    // The ids are copied from the town's record
+    std::vector<TownID> get_town_vassals(TownID const& id) const;
+    std::vector<TownID> get_roads_from(TownID const& id) const;
+
+    // Estimate of performance: Theta(d) on average, where d is the length of the path
+    // Short rationale for estimate:
+    // One lookup for every master on the way up
+    std::vector<TownID> taxer_path(TownID const& id) const;
+
+    // Estimate of performance: O(n+k) on average, where n is the number of towns and k the number of roads
+    // Short rationale for estimate:
+    // Same bfs and A* as in Datastructures, but the search state is kept in an
+    // unordered map, because the snapshot has no dense town indices. This makes them
+    // a few times slower than in Datastructures, but they never wait for a writer.
+    std::vector<TownID> least_towns_route(TownID const& fromid, TownID const& toid) const;
+    std::vector<TownID> shortest_route(TownID const& fromid, TownID const& toid) const;
+
+private:
+    friend class SnapshotDatastructures;
+
+    std::vector<std::shared_ptr<Page const>> pages_{};
+    unsigned long int version_ = 0;
+    unsigned int town_count_ = 0;
+
+    // there are 2^chunk_bits_ chunks, 2^page_bits_ of them on each page
+    unsigned int chunk_bits_ = 0;
+    unsigned int page_bits_ = 0;
+
+    // Number of chunk bits for town_count towns: at least 2^MIN_CHUNK_BITS chunks, and enough for CHUNK_SIZE towns per chunk
+    static constexpr unsigned int MIN_CHUNK_BITS = 4;
+    static unsigned int chunk_bits_for(std::size_t town_count);
+
+    std::size_t chunk_of(TownID const& id) const { return std::hash<TownID>()(id) & ((std::size_t{1} << chunk_bits_) - 1); }
+    Chunk const& chunk(std::size_t index) const { return *(*pages_[index >> page_bits_])[index & ((std::size_t{1} << page_bits_) - 1)]; }
+
+    // Same as find(), but gives the id stored in the chunk too
+    Chunk::value_type const* find_entry(TownID const& id) const;
+};
+
+class SnapshotDatastructures
+{
+public:
+    SnapshotDatastructures();
+
+    // Estimate of performance: Theta(1)
+    // Short rationale for estimate:
+    // Only the shared pointer is copied. std::atomic_load is used because
+    // std::atomic<std::shared_ptr> is not available before C++20.
+    std::shared_ptr<TownSnapshot const> snapshot() const;
+
+    // Queries, each of these pins the current snapshot for the duration of the call
+    unsigned int town_count() const;
+    Name get_town_name(TownID const& id) const;
+    Coord get_town_coordinates(TownID const& id) const;
+    int get_town_tax(TownID const& id) const;
+    std::vector<TownID> get_town_vassals(TownID const& id) const;
+    std::vector<TownID> get_roads_from(TownID const& id) const;
+    std::vector<TownID> taxer_path(TownID const& id) const;
+    std::vector<TownID> least_towns_route(TownID const& fromid, TownID const& toid) const;
+    std::vector<TownID> shortest_route(TownID const& fromid, TownID const& toid) const;
+
+    // Edits. Writers are serialized with each other, but never block the readers.
+    // Each edit publishes a new snapshot, see publish() for its cost.
+    // clear_roads(), trim_road_network() and clear_all() rebuild every chunk.
+    void clear_all();
+    bool add_town(TownID const& id, Name const& name, Coord coord, int tax);
+    bool change_town_name(TownID const& id, Name const& newname);
+    bool add_vassalship(TownID const& vassalid, TownID const& masterid);
+    bool remove_town(TownID const& id);
+    void clear_roads();
+    bool add_road(TownID const& town1_id, TownID const& town2_id);
+    bool remove_road(TownID const& town1_id, TownID const& town2_id);
+    Distance trim_road_network();
+    unsigned int add_towns(std::vector<TownSpec> const& towns);
+    unsigned int add_vassalships(std::vector<std::pair<TownID, TownID>> const& vassalships);
+    unsigned int add_roads(std::vector<std::pair<TownID, TownID>> const& roads);
+
+private:
+    // Only accessed by the writer holding write_mutex_
+    Datastructures ds_;
+    std::mutex write_mutex_;
+
+    // Only accessed with std::atomic_load and std::atomic_store
+    std::shared_ptr<TownSnapshot const> current_;
+
+    // helper functions for building and publishing the next snapshot
+    TownSnapshot::TownRecord make_record(TownID const& id) const;
+
+    // Estimate of performance: O(sqrt(n/k) + c*(sqrt(n/k)+k)) on average, where n is the number of towns,
+    // c the number of changed towns and k the chunk size (CHUNK_SIZE)
+    // Short rationale for estimate:
+    // The page list of sqrt(n/k) pointers is copied, and so is the page of sqrt(n/k) pointers
+    // and the chunk of about k towns of each changed town, the rest is shared.
+    // When the number of towns has outgrown the chunks (or shrunk well below them), the
+    // snapshot is rebuilt with publish_all(), which is amortized O(1) per added town.
+    void publish(std::vector<TownID> const& changed);
+
+    // Estimate of performance: O(n) on average, where n is the number of towns
+    // Short rationale for estimate:
+    // Every town's record is built again, in chunks sized for the number of towns
+    void publish_all();
+};
+
+#endif // SNAPSHOTDATASTRUCTURES_HH
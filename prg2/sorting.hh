@@ -0,0 +1,137 @@
+// Sorting.hh
+//
+// Sorting helpers for the ordered queries of Datastructures
+
+#ifndef SORTING_HH
+#define SORTING_HH
+
+#include "threadpool.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+// Below this many elements starting the threads costs more than the parallel sort saves
+constexpr std::size_t PARALLEL_SORT_MIN_SIZE = 1 << 15;
+
+// Parallel merge sort: the range is split into one run per thread of the pool, the runs
+// are sorted at the same time with std::sort, and then merged pairwise, each round of merges
+// in parallel too. Small ranges and single-threaded pools are sorted with std::sort directly.
+// less must be a strict total order (no two different elements are equivalent),
+// so that the result is the same whatever the number of threads.
+template <typename RandomIt, typename Less>
+void parallel_sort(RandomIt first, RandomIt last, Less less, ThreadPool& pool)
+{
+    using Value = typename std::iterator_traits<RandomIt>::value_type;
+
+    const auto size = static_cast<std::size_t>(std::distance(first, last));
+    const std::size_t runs = pool.size();
+    if (runs < 2 || size < PARALLEL_SORT_MIN_SIZE)
+    {
+        std::sort(first, last, less);
+        return;
+    }
+
+    //run i is [bounds[i], bounds[i+1])
+    std::vector<std::size_t> bounds(runs + 1);
+    for (std::size_t i = 0; i <= runs; ++i)
+        bounds[i] = size * i / runs;
+
+    pool.parallel_for(runs, [&](std::size_t i)
+    {
+        std::sort(first + bounds[i], first + bounds[i + 1], less);
+    });
+
+    //each round merges pairs of neighbouring runs from one buffer to the other,
+    //until a single run remains
+    std::vector<Value> source(std::make_move_iterator(first), std::make_move_iterator(last));
+    std::vector<Value> target(size);
+    for (std::size_t width = 1; width < runs; width *= 2)
+    {
+        const auto pairs = (runs + 2 * width - 1) / (2 * width);
+        pool.parallel_for(pairs, [&](std::size_t pair)
+        {
+            const auto begin = bounds[2 * width * pair];
+            const auto middle = bounds[std::min(2 * width * pair + width, runs)];
+            const auto end = bounds[std::min(2 * width * (pair + 1), runs)];
+            std::merge(std::make_move_iterator(source.begin() + begin), std::make_move_iterator(source.begin() + middle),
+                       std::make_move_iterator(source.begin() + middle), std::make_move_iterator(source.begin() + end),
+                       target.begin() + begin, less);
+        });
+        std::swap(source, target);
+    }
+
+    std::move(source.begin(), source.end(), first);
+}
+
+// Below this many elements the radix sort's passes cost more than a comparison sort
+constexpr std::size_t RADIX_SORT_MIN_SIZE = 64;
+
+// LSD radix sort by an int key, 8 bits per pass, with the key stored next to each item
+// so that the passes don't go through pointers. A pass is skipped when all the keys have the
+// same digit, so e.g. keys under 65536 only take two passes. The radix sort is stable, and
+// afterwards each run of equal keys is sorted with tie_less, which makes the order unique.
+// Theta(n) for the radix passes, plus O(k log k) for each run of k equal keys.
+template <typename Type, typename KeyFunc, typename TieLess>
+void radix_sort(std::vector<Type>& items, KeyFunc key, TieLess tie_less)
+{
+    const auto size = items.size();
+    if (size < RADIX_SORT_MIN_SIZE)
+    {
+        std::sort(items.begin(), items.end(), [&key, &tie_less](const auto& item1, const auto& item2)
+        {
+            const auto key1 = key(item1);
+            const auto key2 = key(item2);
+            return key1 < key2 || (key1 == key2 && tie_less(item1, item2));
+        });
+        return;
+    }
+
+    //flipping the sign bit orders negative keys before the others when compared as unsigned
+    using Keyed = std::pair<std::uint32_t, Type>;
+    std::vector<Keyed> source{};
+    source.reserve(size);
+    for (auto& item : items)
+        source.emplace_back(static_cast<std::uint32_t>(key(item)) ^ 0x80000000u, std::move(item));
+
+    std::vector<Keyed> target(size);
+    for (unsigned int shift = 0; shift < 32; shift += 8)
+    {
+        std::array<std::size_t, 256> positions{};
+        for (const auto& keyed : source)
+            ++positions[(keyed.first >> shift) & 0xff];
+        if (positions[(source.front().first >> shift) & 0xff] == size)
+            continue;
+
+        //turn the counts into the first position of each digit
+        std::size_t position = 0;
+        for (auto& count : positions)
+            position += std::exchange(count, position);
+
+        for (auto& keyed : source)
+            target[positions[(keyed.first >> shift) & 0xff]++] = std::move(keyed);
+        std::swap(source, target);
+    }
+
+    //sort the runs of equal keys
+    for (std::size_t begin = 0, end = 0; begin < size; begin = end)
+    {
+        for (end = begin + 1; end < size && source[end].first == source[begin].first; ++end) { }
+        if (end - begin > 1)
+        {
+            std::sort(source.begin() + begin, source.begin() + end, [&tie_less](const auto& item1, const auto& item2)
+            {
+                return tie_less(item1.second, item2.second);
+            });
+        }
+    }
+
+    for (std::size_t i = 0; i < size; ++i)
+        items[i] = std::move(source[i].second);
+}
+
+#endif // SORTING_HH
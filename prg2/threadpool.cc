@@ -0,0 +1,74 @@
+// Threadpool.cc
+//
+// A fixed set of worker threads for running independent tasks in parallel
+
+#include "threadpool.hh"
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+    //hardware_concurrency() may return 0 if it's not known
+    for (unsigned int i = 1; i < threads; ++i)
+        workers_.emplace_back([this] { worker(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+
+    for (auto& worker : workers_)
+        worker.join();
+}
+
+void ThreadPool::parallel_for(std::size_t count, const std::function<void(std::size_t)>& task)
+{
+    if (count == 0)
+        return;
+
+    {
+        std::lock_guard lock(mutex_);
+        task_ = &task;
+        count_ = count;
+        next_ = 0;
+        active_workers_ = workers_.size();
+        ++generation_;
+    }
+    work_available_.notify_all();
+
+    run_tasks();
+
+    //the workers may still be running their last tasks
+    std::unique_lock lock(mutex_);
+    work_done_.wait(lock, [this] { return active_workers_ == 0; });
+    task_ = nullptr;
+}
+
+void ThreadPool::worker()
+{
+    std::uint64_t seen_generation{};
+    std::unique_lock lock(mutex_);
+    for (;;)
+    {
+        work_available_.wait(lock, [this, seen_generation] { return stopping_ || generation_ != seen_generation; });
+        if (stopping_)
+            return;
+        seen_generation = generation_;
+
+        lock.unlock();
+        run_tasks();
+        lock.lock();
+
+        if (--active_workers_ == 0)
+            work_done_.notify_all();
+    }
+}
+
+void ThreadPool::run_tasks()
+{
+    //each thread takes the next unprocessed index until all have been taken
+    for (auto i = next_++; i < count_; i = next_++)
+        (*task_)(i);
+}
@@ -0,0 +1,53 @@
+// Threadpool.hh
+//
+// A fixed set of worker threads for running independent tasks in parallel
+
+#ifndef THREADPOOL_HH
+#define THREADPOOL_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // The calling thread of parallel_for takes part in the work too,
+    // so threads - 1 workers are started
+    explicit ThreadPool(unsigned int threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    // Number of threads doing the work, including the calling thread
+    [[nodiscard]] unsigned int size() const { return static_cast<unsigned int>(workers_.size()) + 1; }
+
+    // Calls task(i) for each i in [0, count) in parallel, and returns when all the calls have finished.
+    // The task must not throw, and parallel_for must not be called from inside a task.
+    void parallel_for(std::size_t count, std::function<void(std::size_t)> const& task);
+
+private:
+    void worker();
+    void run_tasks();
+
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable work_done_;
+    std::uint64_t generation_ = 0; // incremented for each parallel_for
+    std::size_t active_workers_ = 0;
+    bool stopping_ = false;
+
+    std::function<void(std::size_t)> const* task_ = nullptr;
+    std::size_t count_ = 0;
+    std::atomic<std::size_t> next_{0};
+};
+
+#endif // THREADPOOL_HH
@@ -0,0 +1,136 @@
+// Townid.hh
+//
+// Compact id type for towns. Short ids (like "R123456") are stored inside the object
+// without allocating, and the hash is calculated once when the id is created, so passing
+// ids around and looking them up from hash tables doesn't allocate or rehash them.
+
+#ifndef TOWNID_HH
+#define TOWNID_HH
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+class TownID
+{
+public:
+    // ids of at most this many characters are stored inline, longer ones on the heap
+    static constexpr std::size_t INLINE_CAPACITY = 16;
+
+    // Estimate of performance: Theta(s), where s is the length of the id
+    // Short rationale for estimate:
+    // The characters are copied and hashed once, allocating only for long ids
+    TownID() : TownID(std::string_view{}) {}
+    TownID(std::string_view id) : hash_(std::hash<std::string_view>{}(id)), size_(static_cast<std::uint32_t>(id.size()))
+    {
+        char* chars = storage_.inline_chars;
+        if (!is_inline()) { chars = storage_.heap_chars = new char[size_]; }
+        if (size_ > 0) { std::memcpy(chars, id.data(), size_); }
+    }
+    TownID(std::string const& id) : TownID(std::string_view(id)) {}
+    TownID(char const* id) : TownID(std::string_view(id)) {}
+    TownID(char const* id, std::size_t size) : TownID(std::string_view(id, size)) {}
+
+    TownID(TownID const& other) : hash_(other.hash_), size_(other.size_), storage_(other.storage_)
+    {
+        if (!is_inline())
+        {
+            storage_.heap_chars = new char[size_];
+            std::memcpy(storage_.heap_chars, other.storage_.heap_chars, size_);
+        }
+    }
+
+    // the moved from id is left empty
+    TownID(TownID&& other) noexcept : hash_(other.hash_), size_(other.size_), storage_(other.storage_)
+    {
+        other.hash_ = empty_hash();
+        other.size_ = 0;
+    }
+
+    TownID& operator=(TownID const& other)
+    {
+        if (this != &other) { TownID copy(other); swap(copy); }
+        return *this;
+    }
+
+    TownID& operator=(TownID&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~TownID()
+    {
+        if (!is_inline()) { delete[] storage_.heap_chars; }
+    }
+
+    void swap(TownID& other) noexcept
+    {
+        std::swap(hash_, other.hash_);
+        std::swap(size_, other.size_);
+        std::swap(storage_, other.storage_);
+    }
+
+    [[nodiscard]] char const* data() const noexcept { return is_inline() ? storage_.inline_chars : storage_.heap_chars; }
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+    [[nodiscard]] char const* begin() const noexcept { return data(); }
+    [[nodiscard]] char const* end() const noexcept { return data() + size_; }
+
+    // the same as std::hash<std::string_view> of the characters
+    [[nodiscard]] std::size_t hash() const noexcept { return hash_; }
+
+    [[nodiscard]] std::string_view view() const noexcept { return { data(), size_ }; }
+    operator std::string_view() const noexcept { return view(); }
+    [[nodiscard]] std::string str() const { return std::string(view()); }
+
+    // different hashes mean different ids, so most unequal ids aren't compared character by character
+    friend bool operator==(TownID const& id1, TownID const& id2) noexcept
+    {
+        return id1.hash_ == id2.hash_ && id1.view() == id2.view();
+    }
+    friend bool operator!=(TownID const& id1, TownID const& id2) noexcept { return !(id1 == id2); }
+
+    // alphabetical order of the ids
+    friend bool operator<(TownID const& id1, TownID const& id2) noexcept { return id1.view() < id2.view(); }
+    friend bool operator>(TownID const& id1, TownID const& id2) noexcept { return id2 < id1; }
+    friend bool operator<=(TownID const& id1, TownID const& id2) noexcept { return !(id2 < id1); }
+    friend bool operator>=(TownID const& id1, TownID const& id2) noexcept { return !(id1 < id2); }
+
+    friend std::ostream& operator<<(std::ostream& output, TownID const& id) { return output << id.view(); }
+
+private:
+    std::size_t hash_;
+    std::uint32_t size_;
+    union Storage
+    {
+        char inline_chars[INLINE_CAPACITY];
+        char* heap_chars;
+    } storage_{};
+
+    [[nodiscard]] bool is_inline() const noexcept { return size_ <= INLINE_CAPACITY; }
+
+    static std::size_t empty_hash() noexcept
+    {
+        static std::size_t const hash = std::hash<std::string_view>{}(std::string_view{});
+        return hash;
+    }
+};
+
+inline void swap(TownID& id1, TownID& id2) noexcept { id1.swap(id2); }
+
+// hash tables keyed by TownID use the hash calculated when the id was created
+namespace std
+{
+template<>
+struct hash<TownID>
+{
+    std::size_t operator()(TownID const& id) const noexcept { return id.hash(); }
+};
+}
+
+#endif // TOWNID_HH
@@ -0,0 +1,134 @@
+// Workloadtrace.cc
+//
+// Compact binary traces of executed commands, for recording a workload
+// and replaying it later
+
+#include "workloadtrace.hh"
+
+#include <cstring>
+
+namespace
+{
+    constexpr char TRACE_MAGIC[8] = "DSTRACE";
+    constexpr std::uint64_t TRACE_VERSION = 1;
+
+    // sanity limits for reading, so that a corrupted file can't make us allocate huge strings
+    constexpr std::uint64_t MAX_STRING_LENGTH = 1 << 20;
+    constexpr std::uint64_t MAX_PARAMS = 64;
+}
+
+TraceWriter::TraceWriter(const std::string& filename) : file_(filename, std::ios::binary | std::ios::trunc)
+{
+    file_.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    write_varint(TRACE_VERSION);
+}
+
+void TraceWriter::write(const TraceRecord& record)
+{
+    write_string(record.cmd);
+    write_varint(record.params.size());
+    for (const auto& param : record.params)
+        write_string(param);
+
+    file_.put(static_cast<char>(record.result_type));
+    write_varint(record.result_size);
+    write_varint(record.elapsed_ns);
+}
+
+void TraceWriter::write_varint(std::uint64_t value)
+{
+    //7 bits per byte, the high bit tells whether more bytes follow
+    char buffer[10];
+    auto length = 0;
+    do
+    {
+        auto byte = static_cast<unsigned char>(value & 0x7f);
+        value >>= 7;
+        if (value)
+            byte |= 0x80;
+        buffer[length++] = static_cast<char>(byte);
+    } while (value);
+
+    file_.write(buffer, length);
+}
+
+void TraceWriter::write_string(const std::string& str)
+{
+    write_varint(str.size());
+    file_.write(str.data(), static_cast<std::streamsize>(str.size()));
+}
+
+TraceReader::TraceReader(const std::string& filename) : file_(filename, std::ios::binary)
+{
+    char magic[sizeof(TRACE_MAGIC)];
+    if (!file_.read(magic, sizeof(magic)) || std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+        return;
+
+    std::uint64_t version{};
+    ok_ = read_varint(version) && version == TRACE_VERSION;
+}
+
+bool TraceReader::read(TraceRecord& record)
+{
+    if (!ok_)
+        return false;
+
+    //a clean end of file is only allowed between records
+    if (file_.peek() == std::ifstream::traits_type::eof())
+        return false;
+
+    std::uint64_t param_count{};
+    if (!read_string(record.cmd) || !read_varint(param_count) || param_count > MAX_PARAMS)
+    {
+        corrupted_ = true;
+        return false;
+    }
+
+    record.params.resize(param_count);
+    for (auto& param : record.params)
+    {
+        if (!read_string(param))
+        {
+            corrupted_ = true;
+            return false;
+        }
+    }
+
+    const auto result_type = file_.get();
+    if (result_type == std::ifstream::traits_type::eof() || !read_varint(record.result_size) || !read_varint(record.elapsed_ns))
+    {
+        corrupted_ = true;
+        return false;
+    }
+    record.result_type = static_cast<std::uint8_t>(result_type);
+
+    return true;
+}
+
+bool TraceReader::read_varint(std::uint64_t& value)
+{
+    value = 0;
+    for (auto shift = 0; shift < 64; shift += 7)
+    {
+        const auto byte = file_.get();
+        if (byte == std::ifstream::traits_type::eof())
+            return false;
+
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    //too many bytes for a 64 bit value
+    return false;
+}
+
+bool TraceReader::read_string(std::string& str)
+{
+    std::uint64_t length{};
+    if (!read_varint(length) || length > MAX_STRING_LENGTH)
+        return false;
+
+    str.resize(length);
+    return static_cast<bool>(file_.read(str.data(), static_cast<std::streamsize>(length)));
+}
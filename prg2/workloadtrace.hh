@@ -0,0 +1,72 @@
+// Workloadtrace.hh
+//
+// Compact binary traces of executed commands, for recording a workload
+// and replaying it later
+
+#ifndef WORKLOADTRACE_HH
+#define WORKLOADTRACE_HH
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+// A single executed command in a trace
+struct TraceRecord
+{
+    std::string cmd{};
+    std::vector<std::string> params{};
+    std::uint8_t result_type{};
+    std::uint64_t result_size{};
+    std::uint64_t elapsed_ns{};
+};
+
+// File format:
+// "DSTRACE" magic (8 bytes including the terminating zero), format version as a varint,
+// then the records one after another. Each record is
+//   command name (string), number of parameters (varint), parameters (strings),
+//   result type (1 byte), result size (varint), elapsed time in nanoseconds (varint)
+// where strings are stored as their length (varint) followed by the characters, and
+// varints are unsigned LEB128 encoded, 7 bits per byte, least significant group first.
+
+class TraceWriter
+{
+public:
+    explicit TraceWriter(std::string const& filename);
+
+    // false if the file couldn't be opened or a write has failed
+    [[nodiscard]] bool ok() const { return static_cast<bool>(file_); }
+
+    void write(TraceRecord const& record);
+
+private:
+    void write_varint(std::uint64_t value);
+    void write_string(std::string const& str);
+
+    std::ofstream file_;
+};
+
+class TraceReader
+{
+public:
+    explicit TraceReader(std::string const& filename);
+
+    // false if the file couldn't be opened or isn't a trace file
+    [[nodiscard]] bool ok() const { return ok_; }
+
+    // Reads the next record, returns false at the end of the trace or if the trace is corrupted
+    bool read(TraceRecord& record);
+
+    // true if the last read() failed because of corrupted data instead of the end of the trace
+    [[nodiscard]] bool corrupted() const { return corrupted_; }
+
+private:
+    bool read_varint(std::uint64_t& value);
+    bool read_string(std::string& str);
+
+    std::ifstream file_;
+    bool ok_ = false;
+    bool corrupted_ = false;
+};
+
+#endif // WORKLOADTRACE_HH